@@ -3,9 +3,15 @@
 
 #include "ahb.h"
 #include "log.h"
+#include "stats.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -13,73 +19,736 @@
 #include <unistd.h>
 
 #define AHB_CHUNK (1 << 20)
+#define AHB_PIPE_DEPTH 4
+
+/*
+ * The siphons are a producer/consumer pipeline over a ring of chunk buffers.
+ * The bridge is always driven from the calling thread while a helper thread
+ * services the file descriptor, so bridge transfers overlap with file or pipe
+ * I/O.
+ */
+struct ahb_pipe_chunk {
+    void *buf;
+    size_t len;
+};
+
+struct ahb_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct ahb_pipe_chunk chunks[AHB_PIPE_DEPTH];
+    unsigned int head;
+    unsigned int tail;
+    bool done;
+    int err;
+    int fd;
+    /* Written on failure so a side blocked on fd can give up */
+    int wake[2];
+};
+
+static int ahb_pipe_init(struct ahb_pipe *pipe, int fd)
+{
+    int i;
+
+    memset(pipe, 0, sizeof(*pipe));
+
+    if (pipe2(pipe->wake, O_CLOEXEC | O_NONBLOCK) < 0)
+        return -errno;
+
+    for (i = 0; i < AHB_PIPE_DEPTH; i++) {
+        pipe->chunks[i].buf = malloc(AHB_CHUNK);
+        if (!pipe->chunks[i].buf)
+            goto cleanup;
+    }
+
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+    pipe->fd = fd;
+
+    return 0;
+
+cleanup:
+    while (i--)
+        free(pipe->chunks[i].buf);
+
+    close(pipe->wake[0]);
+    close(pipe->wake[1]);
+
+    return -ENOMEM;
+}
+
+static void ahb_pipe_destroy(struct ahb_pipe *pipe)
+{
+    int i;
+
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->lock);
+
+    for (i = 0; i < AHB_PIPE_DEPTH; i++)
+        free(pipe->chunks[i].buf);
+
+    close(pipe->wake[0]);
+    close(pipe->wake[1]);
+}
+
+/* Producer: Wait for an empty chunk, NULL if the consumer failed */
+static struct ahb_pipe_chunk *ahb_pipe_get_empty(struct ahb_pipe *pipe)
+{
+    struct ahb_pipe_chunk *chunk = NULL;
+
+    pthread_mutex_lock(&pipe->lock);
+    while (!pipe->err && (pipe->head - pipe->tail) == AHB_PIPE_DEPTH)
+        pthread_cond_wait(&pipe->cond, &pipe->lock);
+    if (!pipe->err)
+        chunk = &pipe->chunks[pipe->head % AHB_PIPE_DEPTH];
+    pthread_mutex_unlock(&pipe->lock);
+
+    return chunk;
+}
+
+static void ahb_pipe_push(struct ahb_pipe *pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    pipe->head++;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+/* Consumer: Wait for a filled chunk, NULL once drained or on failure */
+static struct ahb_pipe_chunk *ahb_pipe_get_full(struct ahb_pipe *pipe)
+{
+    struct ahb_pipe_chunk *chunk = NULL;
+
+    pthread_mutex_lock(&pipe->lock);
+    while (!pipe->err && !pipe->done && pipe->head == pipe->tail)
+        pthread_cond_wait(&pipe->cond, &pipe->lock);
+    if (!pipe->err && pipe->head != pipe->tail)
+        chunk = &pipe->chunks[pipe->tail % AHB_PIPE_DEPTH];
+    pthread_mutex_unlock(&pipe->lock);
+
+    return chunk;
+}
+
+static void ahb_pipe_pop(struct ahb_pipe *pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    pipe->tail++;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+/* Either side: Record the first failure and wake the other side */
+static void ahb_pipe_fail(struct ahb_pipe *pipe, int err)
+{
+    pthread_mutex_lock(&pipe->lock);
+    if (!pipe->err) {
+        pipe->err = err;
+        if (write(pipe->wake[1], "", 1) < 0)
+            logd("Failed to wake siphon I/O thread: %d\n", -errno);
+    }
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+/*
+ * Wait for fd to become readable, so that a failure on the other side can
+ * interrupt a read that may otherwise never complete, e.g. on a tty. Returns
+ * -ECANCELED if the pipeline failed.
+ */
+static int ahb_pipe_wait_readable(struct ahb_pipe *pipe)
+{
+    struct pollfd fds[] = {
+        { .fd = pipe->fd, .events = POLLIN },
+        { .fd = pipe->wake[0], .events = POLLIN },
+    };
+
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR)
+            return -errno;
+    }
+
+    if (fds[1].revents)
+        return -ECANCELED;
+
+    return 0;
+}
+
+/* Producer: No further chunks will be pushed */
+static void ahb_pipe_finish(struct ahb_pipe *pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    pipe->done = true;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+static void *ahb_siphon_in_drain(void *data)
+{
+    struct ahb_pipe *pipe = data;
+    struct ahb_pipe_chunk *chunk;
+
+    while ((chunk = ahb_pipe_get_full(pipe))) {
+        size_t remaining = chunk->len;
+        void *cursor = chunk->buf;
+        ssize_t egress;
+
+        while (remaining) {
+            egress = write(pipe->fd, cursor, remaining);
+            if (egress == -1) {
+                ahb_pipe_fail(pipe, -errno);
+                return NULL;
+            }
+
+            cursor += egress;
+            remaining -= egress;
+        }
+
+        ahb_pipe_pop(pipe);
+    }
+
+    return NULL;
+}
 
 ssize_t ahb_siphon_in(struct ahb *ctx, uint32_t phys, size_t len, int outfd)
 {
-    ssize_t ingress, egress, remaining;
-    void *chunk, *cursor;
-    int rc = 0;
+    struct ahb_pipe_chunk *chunk;
+    enum stats_subsys prev;
+    struct ahb_pipe pipe;
+    size_t remaining;
+    ssize_t ingress;
+    pthread_t io;
+    int rc;
 
     if (!len)
         return 0;
 
-    chunk = malloc(AHB_CHUNK);
-    if (!chunk)
-        return -errno;
+    if ((rc = ahb_pipe_init(&pipe, outfd)))
+        return rc;
+
+    if ((rc = pthread_create(&io, NULL, ahb_siphon_in_drain, &pipe))) {
+        ahb_pipe_destroy(&pipe);
+        return -rc;
+    }
+
+    prev = stats_subsys_enter(stats_subsys_siphon);
 
     remaining = len;
     do {
+        if (!(chunk = ahb_pipe_get_empty(&pipe)))
+            break;
+
         ingress = remaining > AHB_CHUNK ? AHB_CHUNK : remaining;
 
-        ingress = ahb_read(ctx, phys, chunk, ingress);
-        if (ingress < 0) { rc = ingress; goto done; }
+        ingress = ahb_read(ctx, phys, chunk->buf, ingress);
+        if (ingress < 0) {
+            ahb_pipe_fail(&pipe, ingress);
+            break;
+        }
+
+        chunk->len = ingress;
+        ahb_pipe_push(&pipe);
 
         phys += ingress;
         remaining -= ingress;
 
-        cursor = chunk;
-        while (ingress) {
-            egress = write(outfd, cursor, ingress);
-            if (egress == -1) { rc = -errno; goto done; }
-
-            cursor += egress;
-            ingress -= egress;
-        }
-
         fprintf(stderr, ".");
     } while (remaining);
 
-done:
+    stats_subsys_exit(prev);
+
+    ahb_pipe_finish(&pipe);
+    pthread_join(io, NULL);
+
     fprintf(stderr, "\n");
-    free(chunk);
+
+    rc = pipe.err;
+    ahb_pipe_destroy(&pipe);
 
     return rc;
 }
 
+static void *ahb_siphon_out_fill(void *data)
+{
+    struct ahb_pipe *pipe = data;
+    struct ahb_pipe_chunk *chunk;
+    ssize_t ingress;
+
+    while ((chunk = ahb_pipe_get_empty(pipe))) {
+        /* Fill each chunk so short reads from pipes don't fragment the writes */
+        chunk->len = 0;
+        while (chunk->len < AHB_CHUNK) {
+            if ((ingress = ahb_pipe_wait_readable(pipe)) < 0) {
+                if (ingress != -ECANCELED)
+                    ahb_pipe_fail(pipe, ingress);
+                return NULL;
+            }
+
+            ingress = read(pipe->fd, chunk->buf + chunk->len, AHB_CHUNK - chunk->len);
+            if (ingress < 0) {
+                ahb_pipe_fail(pipe, -errno);
+                return NULL;
+            }
+
+            if (!ingress)
+                break;
+
+            chunk->len += ingress;
+        }
+
+        if (chunk->len)
+            ahb_pipe_push(pipe);
+
+        if (chunk->len < AHB_CHUNK)
+            break;
+    }
+
+    ahb_pipe_finish(pipe);
+
+    return NULL;
+}
+
 ssize_t ahb_siphon_out(struct ahb *ctx, uint32_t phys, int infd)
 {
-    ssize_t ingress, egress;
-    void *chunk;
-    int rc = 0;
+    struct ahb_pipe_chunk *chunk;
+    enum stats_subsys prev;
+    struct ahb_pipe pipe;
+    ssize_t egress;
+    pthread_t io;
+    int rc;
 
-    chunk = malloc(AHB_CHUNK);
-    if (!chunk)
-        return -errno;
+    if ((rc = ahb_pipe_init(&pipe, infd)))
+        return rc;
+
+    if ((rc = pthread_create(&io, NULL, ahb_siphon_out_fill, &pipe))) {
+        ahb_pipe_destroy(&pipe);
+        return -rc;
+    }
 
-    while ((ingress = read(infd, chunk, AHB_CHUNK))) {
-        if (ingress < 0) { rc = -errno; goto done; }
+    prev = stats_subsys_enter(stats_subsys_siphon);
 
-        egress = ahb_write(ctx, phys, chunk, ingress);
-        if (egress < 0) { rc = egress; goto done; }
+    while ((chunk = ahb_pipe_get_full(&pipe))) {
+        egress = ahb_write(ctx, phys, chunk->buf, chunk->len);
+        if (egress < 0) {
+            ahb_pipe_fail(&pipe, egress);
+            break;
+        }
 
-        phys += ingress;
+        phys += chunk->len;
+        ahb_pipe_pop(&pipe);
 
         fprintf(stderr, ".");
     }
 
-done:
+    stats_subsys_exit(prev);
+
+    pthread_join(io, NULL);
+
     fprintf(stderr, "\n");
-    free(chunk);
+
+    rc = pipe.err;
+    ahb_pipe_destroy(&pipe);
+
+    return rc;
+}
+
+struct ahb_ring_entry ahb_ring[AHB_RING_LEN];
+unsigned long ahb_ring_head;
+
+static const char *ahb_ring_op_names[] = {
+    [ahb_op_read] = "read  ",
+    [ahb_op_write] = "write ",
+    [ahb_op_readl] = "readl ",
+    [ahb_op_writel] = "writel",
+};
+
+/* Formatting is done by hand as the ring may be dumped from a signal handler */
+static char *ahb_ring_fmt_hex(char *cursor, uint32_t val)
+{
+    int shift;
+
+    *cursor++ = '0';
+    *cursor++ = 'x';
+    for (shift = 28; shift >= 0; shift -= 4)
+        *cursor++ = "0123456789abcdef"[(val >> shift) & 0xf];
+
+    return cursor;
+}
+
+static char *ahb_ring_fmt_dec(char *cursor, unsigned long val)
+{
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+
+    while (n)
+        *cursor++ = digits[--n];
+
+    return cursor;
+}
+
+static char *ahb_ring_fmt_str(char *cursor, const char *str)
+{
+    while (*str)
+        *cursor++ = *str++;
+
+    return cursor;
+}
+
+void ahb_ring_dump(int fd)
+{
+    unsigned long head = __atomic_load_n(&ahb_ring_head, __ATOMIC_ACQUIRE);
+    unsigned long seq;
+    ssize_t __attribute__((unused)) rc;
+
+    seq = head > AHB_RING_LEN ? head - AHB_RING_LEN + 1 : 1;
+
+    rc = write(fd, "Recent AHB accesses:\n", 21);
+
+    for (; seq <= head; seq++) {
+        struct ahb_ring_entry *slot = &ahb_ring[seq & (AHB_RING_LEN - 1)];
+        struct ahb_ring_entry entry;
+        char line[80], *cursor;
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq)
+            continue;
+
+        entry = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        /* Skip entries overwritten while they were copied */
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        cursor = line;
+        cursor = ahb_ring_fmt_dec(cursor, seq);
+        cursor = ahb_ring_fmt_str(cursor, ": ");
+        cursor = ahb_ring_fmt_str(cursor, ahb_ring_op_names[entry.type]);
+        cursor = ahb_ring_fmt_str(cursor, " ");
+        cursor = ahb_ring_fmt_hex(cursor, entry.phys);
+        if (entry.type == ahb_op_readl || entry.type == ahb_op_writel) {
+            cursor = ahb_ring_fmt_str(cursor, ": ");
+            cursor = ahb_ring_fmt_hex(cursor, entry.val);
+        } else {
+            cursor = ahb_ring_fmt_str(cursor, " for ");
+            cursor = ahb_ring_fmt_dec(cursor, entry.val);
+        }
+        if (entry.rc < 0) {
+            cursor = ahb_ring_fmt_str(cursor, " failed: -");
+            cursor = ahb_ring_fmt_dec(cursor, -entry.rc);
+        }
+        *cursor++ = '\n';
+
+        rc = write(fd, line, cursor - line);
+    }
+}
+
+void ahb_ring_failed(void)
+{
+    static bool dumped;
+
+    /* The accesses leading up to the first failure are the interesting ones */
+    if (log_enabled(level_debug) &&
+            !__atomic_exchange_n(&dumped, true, __ATOMIC_RELAXED))
+        ahb_ring_dump(fileno(stderr));
+}
+
+static void ahb_ring_signal(int signo __attribute__((unused)))
+{
+    int saved = errno;
+
+    ahb_ring_dump(STDERR_FILENO);
+
+    errno = saved;
+}
+
+int ahb_ring_dump_on_signal(int signo)
+{
+    struct sigaction sa = { 0 };
+
+    sa.sa_handler = ahb_ring_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(signo, &sa, NULL) < 0)
+        return -errno;
+
+    return 0;
+}
+
+int ahb_op_call(struct ahb *ctx, const struct ahb_ops *ops, struct ahb_op *op)
+{
+    ssize_t rc;
+
+    switch (op->type) {
+        case ahb_op_read:
+            rc = op->len > SSIZE_MAX ? -EINVAL :
+                    ops->read(ctx, op->phys, op->buf, op->len);
+            break;
+        case ahb_op_write:
+            rc = op->len > SSIZE_MAX ? -EINVAL :
+                    ops->write(ctx, op->phys, op->src, op->len);
+            break;
+        case ahb_op_readl:
+            rc = ops->readl(ctx, op->phys, op->valp);
+            break;
+        case ahb_op_writel:
+            rc = ops->writel(ctx, op->phys, op->val);
+            break;
+        default:
+            rc = -EINVAL;
+            break;
+    }
+
+    return rc < 0 ? rc : 0;
+}
+
+/* The traced accessors, for executing a batch one op at a time */
+static const struct ahb_ops ahb_op_exec_ops = {
+    .read = ahb_read,
+    .write = ahb_write,
+    .readl = ahb_readl,
+    .writel = ahb_writel,
+};
+
+static int ahb_op_exec(struct ahb *ctx, struct ahb_op *op)
+{
+    return ahb_op_call(ctx, &ahb_op_exec_ops, op);
+}
+
+int ahb_submit_fallback(struct ahb *ctx, struct ahb_op *ops, size_t n)
+{
+    size_t i;
+    int rc;
+
+    for (i = 0; i < n; i++) {
+        if ((rc = ahb_op_exec(ctx, &ops[i])) < 0) {
+            ops[i].rc = rc;
+            goto cancel;
+        }
+
+        ops[i].rc = 0;
+    }
+
+    return 0;
+
+cancel:
+    while (++i < n)
+        ops[i].rc = -ECANCELED;
+
+    return rc;
+}
+
+int ahb_submit(struct ahb *ctx, struct ahb_op *ops, size_t n)
+{
+    size_t i;
+    int rc;
+
+    if (!n)
+        return 0;
+
+    if (!ctx->ops->submit)
+        return ahb_submit_fallback(ctx, ops, n);
+
+    rc = ctx->ops->submit(ctx, ops, n);
+
+    /* Layers forward the batch to an interface that traces it */
+    if (ctx->layer)
+        return rc;
+
+    for (i = 0; i < n && ops[i].rc != -ECANCELED; i++) {
+        struct ahb_op *op = &ops[i];
+
+        switch (op->type) {
+            case ahb_op_read:
+            case ahb_op_write:
+                ahb_ring_record(ctx, op->type, op->phys, op->len, op->rc);
+                break;
+            case ahb_op_readl:
+                ahb_ring_record(ctx, op->type, op->phys,
+                                op->rc ? 0 : *op->valp, op->rc);
+                if (!op->rc)
+                    logt("%s: readl 0x%08"PRIx32": 0x%08"PRIx32"\n",
+                         __func__, op->phys, *op->valp);
+                break;
+            case ahb_op_writel:
+                ahb_ring_record(ctx, op->type, op->phys, op->val, op->rc);
+                if (!op->rc)
+                    logt("%s: writel 0x%08"PRIx32": 0x%08"PRIx32"\n",
+                         __func__, op->phys, op->val);
+                break;
+        }
+    }
+
+    return rc;
+}
+
+/* Emit the unordered ops of ops[start, end) in the given window, in order */
+static size_t ahb_schedule_window(struct ahb_op *ops, size_t start, size_t end,
+                                  uint32_t mask, uint32_t window,
+                                  struct ahb_op **order)
+{
+    size_t emitted = 0;
+    size_t i;
+
+    for (i = start; i < end; i++) {
+        if ((ops[i].phys & mask) == window)
+            order[emitted++] = &ops[i];
+    }
+
+    return emitted;
+}
+
+unsigned int ahb_schedule_windowed(struct ahb_op *ops, size_t n, uint32_t mask,
+                                   uint32_t current, struct ahb_op **order)
+{
+    uint32_t mapped = current;
+    unsigned int moves = 0;
+    size_t next = 0;
+    size_t i, j, k;
+
+    for (i = 0; i < n; i = j) {
+        uint32_t barrier;
+        bool fenced;
+
+        if (!ops[i].unordered) {
+            order[next++] = &ops[i];
+            current = ops[i].phys & mask;
+            j = i + 1;
+            continue;
+        }
+
+        /* Find the run of unordered ops, and the window of the op ending it */
+        for (j = i; j < n && ops[j].unordered; j++)
+            ;
+
+        fenced = j < n;
+        barrier = fenced ? ops[j].phys & mask : 0;
+
+        /*
+         * Use the mapped window first, and leave the barrier's window until
+         * last so the barrier doesn't need to move it. Other windows are
+         * visited in the order they're first accessed.
+         */
+        next += ahb_schedule_window(ops, i, j, mask, current, &order[next]);
+
+        for (k = i; k < j; k++) {
+            uint32_t window = ops[k].phys & mask;
+            size_t prior;
+
+            if (window == current || (fenced && window == barrier))
+                continue;
+
+            for (prior = i; prior < k; prior++) {
+                if ((ops[prior].phys & mask) == window)
+                    break;
+            }
+
+            if (prior < k)
+                continue;
+
+            next += ahb_schedule_window(ops, i, j, mask, window, &order[next]);
+        }
+
+        if (fenced && barrier != current)
+            next += ahb_schedule_window(ops, i, j, mask, barrier, &order[next]);
+
+        current = order[next - 1]->phys & mask;
+    }
+
+    assert(next == n);
+
+    for (i = 0; i < n; i++) {
+        if ((order[i]->phys & mask) != mapped) {
+            mapped = order[i]->phys & mask;
+            moves++;
+        }
+    }
+
+    return moves;
+}
+
+void ahb_batch_init(struct ahb_batch *batch, struct ahb *ahb)
+{
+    batch->ahb = ahb;
+    batch->n_ops = 0;
+    batch->overflow = false;
+    batch->unordered = false;
+}
+
+static struct ahb_op *ahb_batch_add(struct ahb_batch *batch,
+                                    enum ahb_op_type type, uint32_t phys)
+{
+    struct ahb_op *op;
+
+    if (batch->n_ops == AHB_BATCH_MAX) {
+        batch->overflow = true;
+        return NULL;
+    }
+
+    op = &batch->ops[batch->n_ops++];
+    memset(op, 0, sizeof(*op));
+    op->type = type;
+    op->phys = phys;
+    op->unordered = batch->unordered;
+    op->rc = -ECANCELED;
+
+    return op;
+}
+
+void ahb_batch_read(struct ahb_batch *batch, uint32_t phys, void *buf, size_t len)
+{
+    struct ahb_op *op;
+
+    if ((op = ahb_batch_add(batch, ahb_op_read, phys))) {
+        op->buf = buf;
+        op->len = len;
+    }
+}
+
+void ahb_batch_write(struct ahb_batch *batch, uint32_t phys, const void *buf,
+                     size_t len)
+{
+    struct ahb_op *op;
+
+    if ((op = ahb_batch_add(batch, ahb_op_write, phys))) {
+        op->src = buf;
+        op->len = len;
+    }
+}
+
+void ahb_batch_readl(struct ahb_batch *batch, uint32_t phys, uint32_t *val)
+{
+    struct ahb_op *op;
+
+    if ((op = ahb_batch_add(batch, ahb_op_readl, phys)))
+        op->valp = val;
+}
+
+void ahb_batch_writel(struct ahb_batch *batch, uint32_t phys, uint32_t val)
+{
+    struct ahb_op *op;
+
+    if ((op = ahb_batch_add(batch, ahb_op_writel, phys)))
+        op->val = val;
+}
+
+int ahb_batch_submit(struct ahb_batch *batch)
+{
+    int rc;
+
+    if (batch->overflow) {
+        loge("Batch of AHB operations exceeded %d entries\n", AHB_BATCH_MAX);
+        rc = -E2BIG;
+    } else {
+        rc = ahb_submit(batch->ahb, batch->ops, batch->n_ops);
+    }
+
+    batch->n_ops = 0;
+    batch->overflow = false;
+    batch->unordered = false;
 
     return rc;
 }
@@ -93,3 +762,14 @@ int ahb_reinit_bridge(struct ahb *ctx)
 {
     return ctx->drv->reinit ? ctx->drv->reinit(ctx) : 0;
 }
+
+int ahb_begin_session(struct ahb *ctx)
+{
+    return ctx->drv->begin ? ctx->drv->begin(ctx) : 0;
+}
+
+void ahb_end_session(struct ahb *ctx)
+{
+    if (ctx->drv->end)
+        ctx->drv->end(ctx);
+}
@@ -22,16 +22,45 @@ struct ahb_range {
 
 struct ahb;
 
+enum ahb_op_type { ahb_op_read, ahb_op_write, ahb_op_readl, ahb_op_writel };
+
+/*
+ * A single queued access. The ops of a batch are executed in order, and
+ * execution stops at the first failure. The status of each op is reported in
+ * rc: 0 on success, a negative error code if the access failed, or
+ * -ECANCELED if the op was not attempted due to an earlier failure.
+ *
+ * Consecutive ops marked unordered may instead be executed in any order that
+ * preserves the order of the ops within each 64KiB region of the AHB. Ordered
+ * ops act as barriers: they are executed after all the ops queued before them
+ * and before all the ops queued after them.
+ */
+struct ahb_op {
+    enum ahb_op_type type;
+    uint32_t phys;
+    void *buf;          /* ahb_op_read */
+    const void *src;    /* ahb_op_write */
+    size_t len;         /* ahb_op_read, ahb_op_write */
+    uint32_t *valp;     /* ahb_op_readl */
+    uint32_t val;       /* ahb_op_writel */
+    bool unordered;
+    int rc;
+};
+
 struct ahb_ops {
     ssize_t (*read)(struct ahb *ctx, uint32_t phys, void *buf, size_t len);
     ssize_t (*write)(struct ahb *ctx, uint32_t phys, const void *buf, size_t len);
     int (*readl)(struct ahb *ctx, uint32_t phys, uint32_t *val);
     int (*writel)(struct ahb *ctx, uint32_t phys, uint32_t val);
+    /* Optional, ahb_submit() falls back to the ops above if not provided */
+    int (*submit)(struct ahb *ctx, struct ahb_op *ops, size_t n);
 };
 
 struct ahb {
     const struct bridge_driver *drv;
     const struct ahb_ops *ops;
+    /* Accesses are forwarded to, and traced by, another interface */
+    bool layer;
 };
 
 static inline void ahb_init_ops(struct ahb *ctx, const struct bridge_driver *drv,
@@ -39,22 +68,81 @@ static inline void ahb_init_ops(struct ahb *ctx, const struct bridge_driver *drv
 {
     ctx->drv = drv;
     ctx->ops = ops;
+    ctx->layer = false;
+}
+
+/*
+ * A lock-free ring of the most recent accesses made by the bridges, which is
+ * cheap enough to maintain on every access. It's dumped when an access fails
+ * with debug logging enabled, and on request via ahb_ring_dump_on_signal().
+ */
+#define AHB_RING_LEN 256
+
+struct ahb_ring_entry {
+    /* Zero while the entry is being written */
+    unsigned long seq;
+    enum ahb_op_type type;
+    uint32_t phys;
+    /* The value for readl and writel, otherwise the length */
+    uint32_t val;
+    int rc;
+};
+
+extern struct ahb_ring_entry ahb_ring[AHB_RING_LEN];
+extern unsigned long ahb_ring_head;
+
+void ahb_ring_dump(int fd);
+void ahb_ring_failed(void);
+int ahb_ring_dump_on_signal(int signo);
+
+static inline void ahb_ring_record(struct ahb *ctx, enum ahb_op_type type,
+                                   uint32_t phys, uint32_t val, int rc)
+{
+    struct ahb_ring_entry *entry;
+    unsigned long seq;
+
+    if (ctx->layer)
+        return;
+
+    seq = __atomic_add_fetch(&ahb_ring_head, 1, __ATOMIC_RELAXED);
+    entry = &ahb_ring[seq & (AHB_RING_LEN - 1)];
+
+    __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    entry->type = type;
+    entry->phys = phys;
+    entry->val = val;
+    entry->rc = rc;
+    __atomic_store_n(&entry->seq, seq, __ATOMIC_RELEASE);
+
+    if (rc < 0)
+        ahb_ring_failed();
 }
 
 static inline ssize_t ahb_read(struct ahb *ctx, uint32_t phys, void *buf, size_t len)
 {
-    return ctx->ops->read(ctx, phys, buf, len);
+    ssize_t rc = ctx->ops->read(ctx, phys, buf, len);
+
+    ahb_ring_record(ctx, ahb_op_read, phys, len, rc < 0 ? rc : 0);
+
+    return rc;
 }
 
 static inline ssize_t ahb_write(struct ahb *ctx, uint32_t phys, const void *buf, size_t len)
 {
-    return ctx->ops->write(ctx, phys, buf, len);
+    ssize_t rc = ctx->ops->write(ctx, phys, buf, len);
+
+    ahb_ring_record(ctx, ahb_op_write, phys, len, rc < 0 ? rc : 0);
+
+    return rc;
 }
 
 static inline int ahb_readl(struct ahb *ctx, uint32_t phys, uint32_t *val)
 {
     int rc = ctx->ops->readl(ctx, phys, val);
-    if (!rc) {
+
+    ahb_ring_record(ctx, ahb_op_readl, phys, rc ? 0 : *val, rc);
+    if (!rc && !ctx->layer) {
         logt("%s: 0x%08"PRIx32": 0x%08"PRIx32"\n", __func__, phys, *val);
     }
 
@@ -64,13 +152,60 @@ static inline int ahb_readl(struct ahb *ctx, uint32_t phys, uint32_t *val)
 static inline int ahb_writel(struct ahb *ctx, uint32_t phys, uint32_t val)
 {
     int rc = ctx->ops->writel(ctx, phys, val);
-    if (!rc) {
+
+    ahb_ring_record(ctx, ahb_op_writel, phys, val, rc);
+    if (!rc && !ctx->layer) {
         logt("%s: 0x%08"PRIx32": 0x%08"PRIx32"\n", __func__, phys, val);
     }
 
     return rc;
 }
 
+int ahb_submit(struct ahb *ctx, struct ahb_op *ops, size_t n);
+
+/*
+ * Execute a single op with the accessors of ops, for bridges implementing
+ * submit() in terms of their own accessors. Returns 0 or a negative error.
+ */
+int ahb_op_call(struct ahb *ctx, const struct ahb_ops *ops, struct ahb_op *op);
+int ahb_submit_fallback(struct ahb *ctx, struct ahb_op *ops, size_t n);
+
+/*
+ * For bridges that reach the AHB through a single movable window: order the ops
+ * to minimise how often the window is moved, given the window currently mapped.
+ * The window of an access is its address masked by mask. Returns the number of
+ * moves required by the schedule written to order.
+ */
+unsigned int ahb_schedule_windowed(struct ahb_op *ops, size_t n, uint32_t mask,
+                                   uint32_t current, struct ahb_op **order);
+
+#define AHB_BATCH_MAX 32
+
+struct ahb_batch {
+    struct ahb *ahb;
+    size_t n_ops;
+    bool overflow;
+    bool unordered;
+    struct ahb_op ops[AHB_BATCH_MAX];
+};
+
+void ahb_batch_init(struct ahb_batch *batch, struct ahb *ahb);
+
+/*
+ * Whether subsequently queued ops may be reordered, see struct ahb_op.
+ * Submitting the batch returns it to ordered.
+ */
+static inline void ahb_batch_set_unordered(struct ahb_batch *batch,
+                                           bool unordered)
+{
+    batch->unordered = unordered;
+}
+void ahb_batch_read(struct ahb_batch *batch, uint32_t phys, void *buf, size_t len);
+void ahb_batch_write(struct ahb_batch *batch, uint32_t phys, const void *buf,
+                     size_t len);
+void ahb_batch_readl(struct ahb_batch *batch, uint32_t phys, uint32_t *val);
+void ahb_batch_writel(struct ahb_batch *batch, uint32_t phys, uint32_t val);
+int ahb_batch_submit(struct ahb_batch *batch);
 
 ssize_t ahb_siphon_in(struct ahb *ctx, uint32_t phys, size_t len, int outfd);
 ssize_t ahb_siphon_out(struct ahb *ctx, uint32_t phys, int infd);
@@ -78,4 +213,12 @@ ssize_t ahb_siphon_out(struct ahb *ctx, uint32_t phys, int infd);
 int ahb_release_bridge(struct ahb *ctx);
 int ahb_reinit_bridge(struct ahb *ctx);
 
+/*
+ * Bracket a sequence of accesses, allowing the bridge to skip per-access setup
+ * and teardown. Every successful ahb_begin_session() must be paired with an
+ * ahb_end_session(), including on error paths.
+ */
+int ahb_begin_session(struct ahb *ctx);
+void ahb_end_session(struct ahb *ctx);
+
 #endif
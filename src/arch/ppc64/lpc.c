@@ -5,15 +5,319 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "log.h"
 #include "lpc.h"
 
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 #define SYSFS_PREFIX "/sys/kernel/debug/powerpc/lpc"
 
+/* The kernel exposes the FW space directly */
+int lpc_set_fw_window(uint64_t base __unused, size_t len __unused,
+                      uint32_t offset __unused)
+{
+    return -ENOTSUP;
+}
+
+#if HAVE_IO_URING
+/*
+ * Each access to the debugfs files is a syscall, and iLPC2AHB needs around a
+ * dozen SuperIO register accesses for a single AHB access. Batches are instead
+ * submitted to an io_uring as a chain of linked requests, so they're executed
+ * in order and a failure cancels the remainder, for a single syscall.
+ */
+#define LPC_RING_ENTRIES    64
+
+struct lpc_ring {
+    int fd;
+    unsigned int entries;
+    void *sq_map;
+    size_t sq_len;
+    void *cq_map;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int lpc_ring_setup(struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, LPC_RING_ENTRIES, p);
+}
+
+static int lpc_ring_enter(struct lpc_ring *ring, unsigned int submit,
+                          unsigned int complete)
+{
+    return syscall(__NR_io_uring_enter, ring->fd, submit, complete,
+                   complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/* The read and write opcodes were introduced after io_uring itself */
+static int lpc_ring_supported(struct lpc_ring *ring)
+{
+    struct io_uring_probe *probe;
+    size_t len;
+    int rc;
+
+    len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    if (!(probe = calloc(1, len)))
+        return -ENOMEM;
+
+    rc = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+                 probe, 256);
+    if (rc < 0) {
+        rc = -errno;
+        goto done;
+    }
+
+    rc = probe->last_op >= IORING_OP_WRITE &&
+         (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+         (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+
+done:
+    free(probe);
+
+    return rc;
+}
+
+static void lpc_ring_unmap(struct lpc_ring *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_len);
+
+    if (ring->cq_map && ring->cq_map != MAP_FAILED)
+        munmap(ring->cq_map, ring->cq_len);
+
+    if (ring->sq_map && ring->sq_map != MAP_FAILED)
+        munmap(ring->sq_map, ring->sq_len);
+}
+
+static struct lpc_ring *lpc_ring_init(void)
+{
+    struct io_uring_params p;
+    struct lpc_ring *ring;
+    uint8_t *sq, *cq;
+    int rc;
+
+    if (!(ring = calloc(1, sizeof(*ring))))
+        return NULL;
+
+    memset(&p, 0, sizeof(p));
+    if ((ring->fd = lpc_ring_setup(&p)) < 0) {
+        logd("io_uring is unavailable, using synchronous LPC accesses: %d\n",
+             -errno);
+        goto cleanup_ring;
+    }
+
+    if ((rc = lpc_ring_supported(ring)) != 1) {
+        logd("io_uring doesn't support reads and writes, using synchronous LPC accesses: %d\n",
+             rc);
+        goto cleanup_fd;
+    }
+
+    ring->entries = p.sq_entries;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->sq_map = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->cq_map = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED ||
+            ring->sqes == MAP_FAILED) {
+        logd("Failed to map io_uring, using synchronous LPC accesses: %d\n",
+             -errno);
+        goto cleanup_map;
+    }
+
+    sq = ring->sq_map;
+    ring->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+
+    cq = ring->cq_map;
+    ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return ring;
+
+cleanup_map:
+    lpc_ring_unmap(ring);
+
+cleanup_fd:
+    close(ring->fd);
+
+cleanup_ring:
+    free(ring);
+
+    return NULL;
+}
+
+static void lpc_ring_destroy(struct lpc_ring *ring)
+{
+    lpc_ring_unmap(ring);
+    close(ring->fd);
+    free(ring);
+}
+
+/* Errors that leave the ring usable, where the call can simply be retried */
+static inline bool lpc_ring_retry(int err)
+{
+    return err == EINTR || err == EAGAIN || err == EBUSY;
+}
+
+/*
+ * Submit up to ring->entries ops as one chain and wait for them all. The ops
+ * reference the caller's buffers, so we don't return while any are in flight.
+ */
+static int lpc_ring_submit_chain(struct lpc *ctx, struct lpc_op *ops, size_t n)
+{
+    struct lpc_ring *ring = ctx->ring;
+    unsigned int tail, head, submitted, completed;
+    size_t failed = n;
+    int submit_err = 0;
+    int err = 0;
+    size_t i;
+    int rc;
+
+    assert(n && n <= ring->entries);
+
+    tail = *ring->sq_tail;
+    for (i = 0; i < n; i++) {
+        unsigned int index = tail++ & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        struct lpc_op *op = &ops[i];
+
+        memset(sqe, 0, sizeof(*sqe));
+        if (op->type == lpc_op_read) {
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (uintptr_t)op->buf;
+        } else {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (uintptr_t)op->src;
+        }
+        sqe->fd = ctx->fd;
+        sqe->off = op->addr;
+        sqe->len = op->len;
+        sqe->flags = i < n - 1 ? IOSQE_IO_LINK : 0;
+        sqe->user_data = i;
+
+        ring->sq_array[index] = index;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    /*
+     * The requests are consumed even if waiting for them is interrupted. If
+     * the kernel won't take the rest, withdraw them and wait for those it took.
+     */
+    submitted = 0;
+    while (submitted < n) {
+        rc = lpc_ring_enter(ring, n - submitted, n - submitted);
+        if (rc < 0 && !lpc_ring_retry(errno)) {
+            submit_err = -errno;
+            __atomic_store_n(ring->sq_tail,
+                             __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE),
+                             __ATOMIC_RELEASE);
+            break;
+        }
+        if (rc > 0)
+            submitted += rc;
+    }
+
+    completed = 0;
+    head = *ring->cq_head;
+    while (completed < submitted) {
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            rc = lpc_ring_enter(ring, 0, 1);
+            if (rc < 0 && !lpc_ring_retry(errno)) {
+                /* Closing the ring cancels the requests still in flight */
+                rc = -errno;
+                loge("Failed to wait for LPC requests, using synchronous LPC accesses: %d\n",
+                     rc);
+                lpc_ring_destroy(ring);
+                ctx->ring = NULL;
+                return rc;
+            }
+            continue;
+        }
+
+        for (; head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+               head++, completed++) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+            i = cqe->user_data;
+            if ((cqe->res < 0 || (size_t)cqe->res != ops[i].len) && i < failed) {
+                failed = i;
+                err = cqe->res < 0 ? cqe->res : -EIO;
+            }
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return err ? err : submit_err;
+}
+
+static int lpc_ring_submit(struct lpc *ctx, struct lpc_op *ops, size_t n)
+{
+    int rc;
+
+    while (n) {
+        size_t chunk = n > ctx->ring->entries ? ctx->ring->entries : n;
+
+        if ((rc = lpc_ring_submit_chain(ctx, ops, chunk)))
+            return rc;
+
+        ops += chunk;
+        n -= chunk;
+    }
+
+    return 0;
+}
+#else
+static inline struct lpc_ring *lpc_ring_init(void)
+{
+    return NULL;
+}
+
+static inline void lpc_ring_destroy(struct lpc_ring *ring __unused) { }
+
+static inline int
+lpc_ring_submit(struct lpc *ctx __unused, struct lpc_op *ops __unused,
+                size_t n __unused)
+{
+    return -ENOTSUP;
+}
+#endif
+
 int lpc_init(struct lpc *ctx, const char *space)
 {
     char pathbuf[PATH_MAX];
@@ -22,6 +326,13 @@ int lpc_init(struct lpc *ctx, const char *space)
     assert(ctx);
     assert(space);
 
+    ctx->space = space;
+    ctx->delay = 0;
+    ctx->map = NULL;
+    ctx->len = 0;
+    ctx->base = 0;
+    ctx->ring = NULL;
+
     rc = snprintf(pathbuf, sizeof(pathbuf), "%s/%s", SYSFS_PREFIX, space);
     if (rc < 0)
         return rc;
@@ -30,6 +341,8 @@ int lpc_init(struct lpc *ctx, const char *space)
     if (ctx->fd == -1)
         return -errno;
 
+    ctx->ring = lpc_ring_init();
+
     return 0;
 }
 
@@ -39,6 +352,11 @@ int lpc_destroy(struct lpc *ctx)
 
     assert(ctx);
 
+    if (ctx->ring) {
+        lpc_ring_destroy(ctx->ring);
+        ctx->ring = NULL;
+    }
+
     rc = close(ctx->fd);
     if (rc == -1)
         return -errno;
@@ -48,14 +366,9 @@ int lpc_destroy(struct lpc *ctx)
 
 int lpc_read(struct lpc *ctx, size_t addr, void *val, size_t size)
 {
-    off_t seek_rc;
     ssize_t rc;
 
-    seek_rc = lseek(ctx->fd, addr, SEEK_SET);
-    if (seek_rc == (off_t) -1)
-        return -errno;
-
-    rc = read(ctx->fd, val, size);
+    rc = pread(ctx->fd, val, size, addr);
     if (rc == -1)
         return -errno;
 
@@ -64,20 +377,41 @@ int lpc_read(struct lpc *ctx, size_t addr, void *val, size_t size)
 
 int lpc_write(struct lpc *ctx, size_t addr, const void *val, size_t size)
 {
-    off_t seek_rc;
     ssize_t rc;
 
-    seek_rc = lseek(ctx->fd, addr, SEEK_SET);
-    if (seek_rc == (off_t) -1)
-        return -errno;
-
-    rc = write(ctx->fd, val, size);
+    rc = pwrite(ctx->fd, val, size, addr);
     if (rc == -1)
         return -errno;
 
     return rc;
 }
 
+int lpc_submit(struct lpc *ctx, struct lpc_op *ops, size_t n)
+{
+    size_t i;
+    int rc;
+
+    if (ctx->ring)
+        return lpc_ring_submit(ctx, ops, n);
+
+    for (i = 0; i < n; i++) {
+        struct lpc_op *op = &ops[i];
+
+        if (op->type == lpc_op_read)
+            rc = lpc_read(ctx, op->addr, op->buf, op->len);
+        else
+            rc = lpc_write(ctx, op->addr, op->src, op->len);
+
+        if (rc < 0)
+            return rc;
+
+        if ((size_t)rc != op->len)
+            return -EIO;
+    }
+
+    return 0;
+}
+
 int lpc_readb(struct lpc *ctx, size_t addr, uint8_t *val)
 {
     int rc;
@@ -2,85 +2,345 @@
 /* Copyright 2014-2016 IBM Corp. */
 
 #include "compiler.h"
+#include "log.h"
 #include "lpc.h"
+#include "mmio.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/io.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-int lpc_init(struct lpc *ctx __unused, const char *space)
+#define LPC_IO_PORTS    0x10000
+/* Writes to the POST code port are the traditional I/O delay */
+#define LPC_DELAY_PORT  0x80
+/* LPC FW cycles carry at most 4 bytes through most chipsets */
+#define LPC_FW_WIDTH    4
+
+static uint64_t lpc_fw_base;
+static size_t lpc_fw_len;
+static uint32_t lpc_fw_offset;
+
+/*
+ * Rather than iopl(3), which grants access to every port, request access to
+ * each port the first time it's used. In practice that's just the SuperIO and
+ * SUART registers. The permission is per-thread, as is the record of it.
+ */
+static __thread unsigned long lpc_granted[LPC_IO_PORTS / (sizeof(unsigned long) * CHAR_BIT)];
+
+static inline bool lpc_port_granted(size_t port)
+{
+    const size_t bits = sizeof(unsigned long) * CHAR_BIT;
+
+    return lpc_granted[port / bits] & (1UL << (port % bits));
+}
+
+static int lpc_grant(size_t port, size_t len)
+{
+    const size_t bits = sizeof(unsigned long) * CHAR_BIT;
+    size_t i;
+
+    if (port + len > LPC_IO_PORTS)
+        return -EINVAL;
+
+    for (i = port; i < port + len; i++) {
+        if (!lpc_port_granted(i))
+            break;
+    }
+
+    if (i == port + len)
+        return 0;
+
+    if (ioperm(port, len, 1) < 0)
+        return -errno;
+
+    for (i = port; i < port + len; i++)
+        lpc_granted[i / bits] |= 1UL << (i % bits);
+
+    return 0;
+}
+
+/*
+ * Grant the ports of an access, and the delay port if the access is followed
+ * by a delay. lpc_init() only grants the delay port to the calling thread.
+ */
+static int lpc_grant_access(struct lpc *ctx, size_t port, size_t len)
 {
     int rc;
 
+    if (ctx->delay && (rc = lpc_grant(LPC_DELAY_PORT, 1)) < 0)
+        return rc;
+
+    return lpc_grant(port, len);
+}
+
+static inline void lpc_delay(struct lpc *ctx)
+{
+    unsigned int i;
+
+    for (i = 0; i < ctx->delay; i++)
+        outb(0, LPC_DELAY_PORT);
+}
+
+int lpc_set_fw_window(uint64_t base, size_t len, uint32_t offset)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    /* The L2A bridge maps at least 64KiB, at a 64KiB-aligned LPC address */
+    if (len < 0x10000 || (base | len) & (page - 1) || offset & 0xffff)
+        return -EINVAL;
+
+    if ((uint64_t)offset + len > (1ULL << 32))
+        return -EINVAL;
+
+    lpc_fw_base = base;
+    lpc_fw_len = len;
+    lpc_fw_offset = offset;
+
+    return 0;
+}
+
+/*
+ * There's no portable way to issue LPC FW cycles from an x86 host, but
+ * chipsets forward accesses to their firmware decode range as such. Where
+ * that range has been configured, map it through /dev/mem.
+ */
+static int lpc_init_fw(struct lpc *ctx)
+{
+    int rc;
+
+    if (!lpc_fw_len)
+        return -ENOTSUP;
+
+    ctx->fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (ctx->fd < 0)
+        return -errno;
+
+    ctx->map = mmap(NULL, lpc_fw_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    ctx->fd, lpc_fw_base);
+    if (ctx->map == MAP_FAILED) {
+        rc = -errno;
+        close(ctx->fd);
+        ctx->map = NULL;
+        return rc;
+    }
+
+    ctx->len = lpc_fw_len;
+    ctx->base = lpc_fw_offset;
+
+    logd("Mapped LPC FW space from 0x%" PRIx32 " at 0x%" PRIx64 " (%zu bytes)\n",
+         lpc_fw_offset, lpc_fw_base, lpc_fw_len);
+
+    return 0;
+}
+
+int lpc_init(struct lpc *ctx, const char *space)
+{
+    int rc;
+
+    ctx->space = space;
+    ctx->delay = 0;
+    ctx->map = NULL;
+    ctx->len = 0;
+    ctx->base = 0;
+    ctx->ring = NULL;
+
+    if (!strcmp(space, "fw"))
+        return lpc_init_fw(ctx);
+
     if (strcmp(space, "io"))
         return -ENOTSUP;
 
-    /* YOLO */
-    rc = iopl(3);
+    /* Fail early if we lack the privilege, and allow for calibrated delays */
+    rc = lpc_grant(LPC_DELAY_PORT, 1);
     if (rc < 0) {
-        perror("iopl");
+        errno = -rc;
+        perror("ioperm");
         return rc;
     }
 
     return 0;
 }
 
-int lpc_destroy(struct lpc *ctx __unused)
+int lpc_destroy(struct lpc *ctx)
 {
-    return 0;
+    int rc = 0;
+
+    if (!ctx->map)
+        return 0;
+
+    if (munmap(ctx->map, ctx->len) < 0)
+        rc = -errno;
+
+    if (close(ctx->fd) < 0 && !rc)
+        rc = -errno;
+
+    ctx->map = NULL;
+
+    return rc;
 }
 
-int lpc_readb(struct lpc *ctx __unused, size_t addr, uint8_t *val)
+int lpc_readb(struct lpc *ctx, size_t addr, uint8_t *val)
 {
-    *val = inb_p(addr);
+    int rc;
+
+    if ((rc = lpc_grant_access(ctx, addr, sizeof(*val))))
+        return rc;
+
+    *val = inb(addr);
+    lpc_delay(ctx);
 
     return 0;
 }
 
-int lpc_writeb(struct lpc *ctx __unused, size_t addr, uint8_t val)
+int lpc_writeb(struct lpc *ctx, size_t addr, uint8_t val)
 {
-    outb_p(val, addr);
+    int rc;
+
+    if ((rc = lpc_grant_access(ctx, addr, sizeof(val))))
+        return rc;
+
+    outb(val, addr);
+    lpc_delay(ctx);
 
     return 0;
 }
 
-int lpc_readw(struct lpc *ctx __unused, size_t addr, uint16_t *val)
+int lpc_readw(struct lpc *ctx, size_t addr, uint16_t *val)
 {
-    *val = inw_p(addr);
+    int rc;
+
+    if ((rc = lpc_grant_access(ctx, addr, sizeof(*val))))
+        return rc;
+
+    *val = inw(addr);
+    lpc_delay(ctx);
 
     return 0;
 }
 
-int lpc_writew(struct lpc *ctx __unused, size_t addr, uint16_t val)
+int lpc_writew(struct lpc *ctx, size_t addr, uint16_t val)
 {
-    outw_p(val, addr);
+    int rc;
+
+    if ((rc = lpc_grant_access(ctx, addr, sizeof(val))))
+        return rc;
+
+    outw(val, addr);
+    lpc_delay(ctx);
 
     return 0;
 }
 
-int lpc_readl(struct lpc *ctx __unused, size_t addr, uint32_t *val)
+int lpc_readl(struct lpc *ctx, size_t addr, uint32_t *val)
 {
-    *val = inl_p(addr);
+    int rc;
+
+    if ((rc = lpc_grant_access(ctx, addr, sizeof(*val))))
+        return rc;
+
+    *val = inl(addr);
+    lpc_delay(ctx);
 
     return 0;
 }
 
-int lpc_writel(struct lpc *ctx __unused, size_t addr, uint32_t val)
+int lpc_writel(struct lpc *ctx, size_t addr, uint32_t val)
 {
-    outl_p(val, addr);
+    int rc;
+
+    if ((rc = lpc_grant_access(ctx, addr, sizeof(val))))
+        return rc;
+
+    outl(val, addr);
+    lpc_delay(ctx);
 
     return 0;
 }
 
-int lpc_read(struct lpc *ctx __unused, size_t addr __unused, void *val __unused,
-             size_t size __unused)
+/* Transfers are truncated at the end of the window, as with a short read(2) */
+int lpc_read(struct lpc *ctx, size_t addr, void *val, size_t size)
 {
-    return -ENOTSUP;
+    if (!ctx->map)
+        return -ENOTSUP;
+
+    if (addr >= ctx->len)
+        return -ERANGE;
+
+    if (size > ctx->len - addr)
+        size = ctx->len - addr;
+
+    if (size > INT_MAX)
+        size = INT_MAX & ~(LPC_FW_WIDTH - 1);
+
+    mmio_read(val, (uint8_t *)ctx->map + addr, size, LPC_FW_WIDTH);
+
+    return size;
 }
 
-int lpc_write(struct lpc *ctx __unused, size_t addr __unused,
-              const void *val __unused, size_t size __unused)
+int lpc_write(struct lpc *ctx, size_t addr, const void *val, size_t size)
 {
-    return -ENOTSUP;
+    if (!ctx->map)
+        return -ENOTSUP;
+
+    if (addr >= ctx->len)
+        return -ERANGE;
+
+    if (size > ctx->len - addr)
+        size = ctx->len - addr;
+
+    if (size > INT_MAX)
+        size = INT_MAX & ~(LPC_FW_WIDTH - 1);
+
+    mmio_write((uint8_t *)ctx->map + addr, val, size, LPC_FW_WIDTH);
+
+    return size;
+}
+
+/*
+ * Port I/O doesn't enter the kernel, so there's nothing to gain from queueing
+ * the ops. I/O space ops are issued a byte at a time, as with the SuperIO.
+ */
+int lpc_submit(struct lpc *ctx, struct lpc_op *ops, size_t n)
+{
+    size_t i, j;
+    int rc;
+
+    for (i = 0; i < n; i++) {
+        struct lpc_op *op = &ops[i];
+
+        if (ctx->map) {
+            if (op->type == lpc_op_read)
+                rc = lpc_read(ctx, op->addr, op->buf, op->len);
+            else
+                rc = lpc_write(ctx, op->addr, op->src, op->len);
+
+            if (rc < 0)
+                return rc;
+
+            if ((size_t)rc != op->len)
+                return -EIO;
+
+            continue;
+        }
+
+        for (j = 0; j < op->len; j++) {
+            if (op->type == lpc_op_read)
+                rc = lpc_readb(ctx, op->addr + j, (uint8_t *)op->buf + j);
+            else
+                rc = lpc_writeb(ctx, op->addr + j, ((const uint8_t *)op->src)[j]);
+
+            if (rc)
+                return rc;
+        }
+    }
+
+    return 0;
 }
@@ -17,16 +17,37 @@ struct bridge_driver {
 	int (*reinit)(struct ahb *ahb);
 	void (*destroy)(struct ahb *ahb);
 
+	/*
+	 * Optional: hold whatever the bridge acquires for each access across a
+	 * sequence of accesses instead. Sessions may nest.
+	 */
+	int (*begin)(struct ahb *ahb);
+	void (*end)(struct ahb *ahb);
+
 	/*
 	 * Whether or not this driver is for running culvert on the BMC itself
 	 * (i.e. devmem)
 	 */
 	bool local;
 
+	/*
+	 * Whether each access is a slow round trip, making it cheaper to read
+	 * a span of registers at once than each of them alone
+	 */
+	bool high_latency;
+
 	/* Set if this driver has been explicitly disabled */
 	bool disabled;
+
+	/*
+	 * Host resources used by the bridge. Bridges sharing a resource must
+	 * not be driven concurrently.
+	 */
+	unsigned int resources;
 };
 
+#define BRIDGE_RES_SUPERIO	(1 << 0)
+
 AUTODATA_TYPE(bridge_drivers, struct bridge_driver);
 #define REGISTER_BRIDGE_DRIVER(bd) AUTODATA_SYM(bridge_drivers, bd)
 
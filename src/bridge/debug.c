@@ -2,21 +2,28 @@
 // Copyright (C) 2018,2019 IBM Corp.
 
 #define _GNU_SOURCE
+#include "array.h"
 #include "ast.h"
 #include "bridge.h"
 #include "console.h"
 #include "debug.h"
+#include "hex.h"
 #include "log.h"
 #include "prompt.h"
+#include "rev.h"
 #include "ts16.h"
 #include "tty.h"
 
+#include "ccan/build_assert/build_assert.h"
 #include "ccan/container_of/container_of.h"
 
 #include <assert.h>
+#include <endian.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,6 +47,428 @@ static inline int streq(const char *a, const char *b)
     return !strcmp(a, b);
 }
 
+#define DEBUG_SCU                       0x1e6e2000
+#define   DEBUG_SCU_PROT_KEY            0x000
+#define     DEBUG_SCU_PASSWORD          0x1688a8a8
+#define   DEBUG_SCU_MISC                0x02c
+/*
+ * Selects the 24MHz/13 clock for every UART on the AST2400 and AST2500, not
+ * just the debug UART. Clearing it multiplies the rate of the other UARTs by 13
+ * until it's set again, as only the debug UART's divisor is adjusted.
+ */
+#define     DEBUG_SCU_MISC_UART_DIV13   (1 << 12)
+#define   DEBUG_SCU_STRAP               0x070
+#define     DEBUG_SCU_STRAP_DBG_SEL     (1 << 29)
+#define   DEBUG_SCU_REV                 0x07c
+
+#define DEBUG_UART1                     0x1e783000
+#define DEBUG_UART5                     0x1e784000
+#define   DEBUG_UART_DLL                0x00
+#define   DEBUG_UART_LCR                0x0c
+#define     DEBUG_UART_LCR_DLAB         (1 << 7)
+
+/* The rate the debug shell is entered at, with the 24MHz/13 UART clock */
+#define DEBUG_BAUD_BASE         115200
+#define DEBUG_BAUD_TIMEOUT_MS   500
+#define DEBUG_BAUD_QUIET_MS     50
+#define DEBUG_BAUD_CHECKS       8
+
+/*
+ * Rates available from the undivided 24MHz UART clock, fastest first. Each is
+ * reached through the rate its divisor gives with the 24MHz/13 clock, which
+ * for 3 is 38461 baud, close enough to 38400 for the host.
+ */
+static const struct debug_rate {
+    int baud;
+    unsigned int div;
+} debug_rates[] = {
+    { 1500000, 1 },
+    { 500000, 3 },
+};
+
+/* Raising the rate retimes the BMC's other UARTs, so only do it on request */
+static int debug_max_baud = DEBUG_BAUD_BASE;
+
+/* The instance running the debug UART above DEBUG_BAUD_BASE, if any */
+static struct debug *debug_raised;
+/* A terminating signal received while raised, delivered once it's restored */
+static volatile sig_atomic_t debug_raised_signo;
+
+int debug_set_max_baud(int baud)
+{
+    if (baud < DEBUG_BAUD_BASE)
+        return -EINVAL;
+
+    debug_max_baud = baud;
+
+    return 0;
+}
+
+/*
+ * Write val to phys with the `w` command. If baud is zero, wait for the
+ * prompt. Otherwise the write changes the rate of the BMC UART, so switch the
+ * console to baud and discard the response, which straddles the change.
+ */
+static int debug_poke(struct debug *ctx, uint32_t phys, uint32_t val, int baud)
+{
+    char command[sizeof("w 12345678 12345678")];
+    char response[64];
+    int rc;
+
+    snprintf(command, sizeof(command), "w %" PRIx32 " %" PRIx32, phys, val);
+
+    rc = prompt_run(&ctx->prompt, command);
+    if (rc < 0)
+        return rc;
+
+    if (!baud)
+        return prompt_read_until_timeout(&ctx->prompt, "$ ", response,
+                                         sizeof(response),
+                                         DEBUG_BAUD_TIMEOUT_MS);
+
+    if ((rc = console_set_baud(ctx->console, baud)) < 0)
+        return rc;
+
+    return prompt_drain(&ctx->prompt, DEBUG_BAUD_QUIET_MS);
+}
+
+/* Read a register, failing rather than waiting on a garbled response */
+static int debug_peek(struct debug *ctx, uint32_t phys, uint32_t *val)
+{
+    char command[sizeof("r 12345678")];
+    char response[64];
+    const char *cursor;
+    unsigned long parsed;
+    char *end;
+    int rc;
+
+    snprintf(command, sizeof(command), "r %" PRIx32, phys);
+
+    rc = prompt_run(&ctx->prompt, command);
+    if (rc < 0)
+        return rc;
+
+    rc = prompt_read_until_timeout(&ctx->prompt, "$ ", response,
+                                   sizeof(response), DEBUG_BAUD_TIMEOUT_MS);
+    if (rc < 0)
+        return rc;
+
+    /* The response is the echoed command followed by the value */
+    cursor = response + strspn(response, "\r\n");
+    if (strncmp(cursor, command, strlen(command)))
+        return -EBADE;
+
+    cursor += strlen(command);
+    if (*cursor != '\r' && *cursor != '\n')
+        return -EBADE;
+
+    errno = 0;
+    parsed = strtoul(cursor, &end, 16);
+    if (errno || end == cursor || (*end != '\r' && *end != '\n') ||
+            parsed > UINT32_MAX)
+        return -EBADE;
+
+    *val = parsed;
+
+    return 0;
+}
+
+/* Repeatedly read the silicon revision, which must match the expected value */
+static int debug_check_baud(struct debug *ctx, uint32_t rev)
+{
+    uint32_t val;
+    int i, rc;
+
+    for (i = 0; i < DEBUG_BAUD_CHECKS; i++) {
+        if ((rc = debug_peek(ctx, DEBUG_SCU | DEBUG_SCU_REV, &val)) < 0)
+            return rc;
+
+        if (val != rev)
+            return -EBADE;
+    }
+
+    return 0;
+}
+
+static int debug_scu_unlock(struct debug *ctx, int baud)
+{
+    if (!ctx->scu_locked)
+        return 0;
+
+    return debug_poke(ctx, DEBUG_SCU | DEBUG_SCU_PROT_KEY, DEBUG_SCU_PASSWORD,
+                      baud);
+}
+
+static int debug_scu_lock(struct debug *ctx)
+{
+    if (!ctx->scu_locked)
+        return 0;
+
+    return debug_poke(ctx, DEBUG_SCU | DEBUG_SCU_PROT_KEY, ~DEBUG_SCU_PASSWORD,
+                      0);
+}
+
+static int debug_set_rate(struct debug *ctx, const struct debug_rate *rate)
+{
+    int rc;
+
+    if (rate->div > 1) {
+        rc = debug_poke(ctx, ctx->uart | DEBUG_UART_LCR,
+                        ctx->lcr | DEBUG_UART_LCR_DLAB, 0);
+        if (rc < 0)
+            return rc;
+
+        rc = debug_poke(ctx, ctx->uart | DEBUG_UART_DLL, rate->div,
+                        DEBUG_BAUD_BASE / rate->div);
+        if (rc < 0)
+            return rc;
+
+        rc = debug_poke(ctx, ctx->uart | DEBUG_UART_LCR, ctx->lcr, 0);
+        if (rc < 0)
+            return rc;
+    }
+
+    if ((rc = debug_scu_unlock(ctx, 0)) < 0)
+        return rc;
+
+    rc = debug_poke(ctx, DEBUG_SCU | DEBUG_SCU_MISC,
+                    ctx->misc & ~DEBUG_SCU_MISC_UART_DIV13, rate->baud);
+    if (rc < 0)
+        return rc;
+
+    return debug_scu_lock(ctx);
+}
+
+/*
+ * Return the BMC UART to 115200 baud from baud. The link may be unreliable at
+ * baud, so the commands issued there don't wait for a response.
+ */
+static int debug_reset_rate(struct debug *ctx, int baud, unsigned int div)
+{
+    int rc;
+
+    if ((rc = debug_scu_unlock(ctx, baud)) < 0)
+        return rc;
+
+    rc = debug_poke(ctx, DEBUG_SCU | DEBUG_SCU_MISC, ctx->misc,
+                    DEBUG_BAUD_BASE / div);
+    if (rc < 0)
+        return rc;
+
+    if (div > 1) {
+        rc = debug_poke(ctx, ctx->uart | DEBUG_UART_LCR,
+                        ctx->lcr | DEBUG_UART_LCR_DLAB, 0);
+        if (rc < 0)
+            return rc;
+
+        rc = debug_poke(ctx, ctx->uart | DEBUG_UART_DLL, 1, DEBUG_BAUD_BASE);
+        if (rc < 0)
+            return rc;
+
+        rc = debug_poke(ctx, ctx->uart | DEBUG_UART_LCR, ctx->lcr, 0);
+        if (rc < 0)
+            return rc;
+    }
+
+    return debug_scu_lock(ctx);
+}
+
+static int debug_restore_baud(struct debug *ctx)
+{
+    int rc;
+
+    if (!ctx->baud)
+        return 0;
+
+    logi("Returning the debug UART to %d baud\n", DEBUG_BAUD_BASE);
+
+    if (debug_raised == ctx)
+        debug_raised = NULL;
+
+    rc = debug_reset_rate(ctx, ctx->baud, ctx->div);
+    ctx->baud = 0;
+
+    return rc;
+}
+
+/*
+ * Don't leave the BMC UARTs at the raised rate if we exit or are interrupted
+ * with the debug UART raised. Restoring the rate needs the console, which
+ * isn't safe from a signal handler and may be mid-command, so the handler
+ * only records the signal. It's delivered by debug_raised_deliver() before
+ * the next access through the bridge, or the rate is restored at exit.
+ */
+static void debug_raised_cleanup(void)
+{
+    struct debug *ctx = debug_raised;
+
+    if (!ctx)
+        return;
+
+    /* Discard the remains of any command the signal interrupted */
+    prompt_drain(&ctx->prompt, DEBUG_BAUD_QUIET_MS);
+
+    debug_restore_baud(ctx);
+}
+
+static void debug_raised_signal(int signo)
+{
+    debug_raised_signo = signo;
+}
+
+static void debug_raised_deliver(void)
+{
+    int signo = debug_raised_signo;
+
+    if (!signo)
+        return;
+
+    debug_raised_cleanup();
+
+    signal(signo, SIG_DFL);
+    raise(signo);
+}
+
+static void debug_raised_track(struct debug *ctx)
+{
+    static const int signals[] = { SIGINT, SIGTERM, SIGHUP };
+    static bool registered;
+    struct sigaction sa = { 0 };
+    struct sigaction old;
+    size_t i;
+
+    debug_raised = ctx;
+
+    if (registered)
+        return;
+
+    atexit(debug_raised_cleanup);
+
+    /* Without SA_RESTART, so a blocked read of the console returns early */
+    sa.sa_handler = debug_raised_signal;
+    sigemptyset(&sa.sa_mask);
+
+    /* Leave signals that are ignored or already handled alone */
+    for (i = 0; i < ARRAY_SIZE(signals); i++) {
+        if (sigaction(signals[i], NULL, &old) < 0 || old.sa_handler != SIG_DFL)
+            continue;
+
+        if (sigaction(signals[i], &sa, NULL) < 0)
+            logd("Failed to catch signal %d: %d\n", signals[i], -errno);
+    }
+
+    registered = true;
+}
+
+/* Check the console can run at baud without disturbing the BMC */
+static bool debug_console_supports(struct debug *ctx, int baud)
+{
+    int rc;
+
+    rc = console_set_baud(ctx->console, baud);
+
+    if (console_set_baud(ctx->console, DEBUG_BAUD_BASE) < 0)
+        return false;
+
+    return !rc;
+}
+
+/*
+ * Raise the BMC UART to the fastest rate in debug_rates that the console also
+ * supports, falling back to slower rates if the link can't be verified.
+ *
+ * The AST2400 and AST2500 clock all UARTs from 24MHz/13 unless
+ * DEBUG_SCU_MISC_UART_DIV13 is cleared, so while the debug UART is raised any
+ * other UART in use on the BMC runs 13 times faster than configured. Entering
+ * the debug shell at 115200 baud implies that it's set and that the divisor is
+ * 1. The AST2600 selects the UART clock differently, so the debug UART is left
+ * alone there.
+ */
+static int debug_raise_baud(struct debug *ctx)
+{
+    const struct debug_rate *rate;
+    uint32_t strap, key, rev;
+    size_t i;
+    int rc;
+
+    if (debug_max_baud <= DEBUG_BAUD_BASE)
+        return 0;
+
+    rc = debug_readl(debug_as_ahb(ctx), DEBUG_SCU | DEBUG_SCU_REV, &rev);
+    if (rc < 0)
+        return rc;
+
+    if (!rev_is_supported(rev) || rev_is_generation(rev, ast_g6)) {
+        logd("Leaving the debug UART at %d baud\n", DEBUG_BAUD_BASE);
+        return 0;
+    }
+
+    rc = debug_readl(debug_as_ahb(ctx), DEBUG_SCU | DEBUG_SCU_MISC, &ctx->misc);
+    if (rc < 0)
+        return rc;
+
+    if (!(ctx->misc & DEBUG_SCU_MISC_UART_DIV13)) {
+        logd("UART clock is undivided, leaving the debug UART alone\n");
+        return 0;
+    }
+
+    rc = debug_readl(debug_as_ahb(ctx), DEBUG_SCU | DEBUG_SCU_STRAP, &strap);
+    if (rc < 0)
+        return rc;
+
+    ctx->uart = (strap & DEBUG_SCU_STRAP_DBG_SEL) ? DEBUG_UART5 : DEBUG_UART1;
+
+    rc = debug_readl(debug_as_ahb(ctx), ctx->uart | DEBUG_UART_LCR, &ctx->lcr);
+    if (rc < 0)
+        return rc;
+
+    /* The key register reads as 1 while the SCU is unlocked */
+    rc = debug_readl(debug_as_ahb(ctx), DEBUG_SCU | DEBUG_SCU_PROT_KEY, &key);
+    if (rc < 0)
+        return rc;
+
+    ctx->scu_locked = !key;
+
+    for (i = 0; i < ARRAY_SIZE(debug_rates); i++) {
+        rate = &debug_rates[i];
+
+        if (rate->baud > debug_max_baud)
+            continue;
+
+        if (!debug_console_supports(ctx, rate->baud) ||
+                !debug_console_supports(ctx, DEBUG_BAUD_BASE / rate->div)) {
+            logd("Console doesn't support %d baud\n", rate->baud);
+            continue;
+        }
+
+        rc = debug_set_rate(ctx, rate);
+        if (!rc)
+            rc = debug_check_baud(ctx, rev);
+
+        if (!rc) {
+            logi("Running the debug UART at %d baud\n", rate->baud);
+            ctx->baud = rate->baud;
+            ctx->div = rate->div;
+            debug_raised_track(ctx);
+            return 0;
+        }
+
+        logi("Failed to run the debug UART at %d baud: %d\n", rate->baud, rc);
+
+        rc = debug_reset_rate(ctx, rate->baud, rate->div);
+        if (!rc)
+            rc = debug_check_baud(ctx, rev);
+
+        if (rc < 0) {
+            loge("Failed to return the debug UART to %d baud: %d\n",
+                 DEBUG_BAUD_BASE, rc);
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
 int debug_enter(struct debug *ctx)
 {
     int rc;
@@ -76,6 +505,12 @@ int debug_exit(struct debug *ctx)
 {
     int rc;
 
+    if ((rc = debug_restore_baud(ctx)) < 0)
+        loge("Failed to restore the debug UART rate: %d\n", rc);
+
+    /* Don't swallow a signal that arrived while the rate was raised */
+    debug_raised_deliver();
+
     logi("Exiting debug mode\n");
     rc = prompt_run(&ctx->prompt, "q");
     if (rc < 0)
@@ -101,46 +536,51 @@ int debug_probe(struct debug *ctx)
     return debug_exit(ctx);
 }
 
-static ssize_t debug_parse_d(char *line, char *buf)
+/* `d` prints a line of up to four words per 16 bytes of memory */
+#define DEBUG_D_LINE_WORDS 4
+
+/*
+ * Parse a line of `d` output, "AAAAAAAA:WWWWWWWW WWWWWWWW ...", where it was
+ * received. The line must be for phys and carry at most max words, which are
+ * stored to buf in the BMC's byte order.
+ *
+ * @return The number of bytes stored, or -EBADE if the line is malformed
+ */
+static ssize_t debug_parse_d(const char *line, uint32_t phys, size_t max,
+                             void *buf)
 {
-    char *eoa, *words, *token, *stream;
-    char *saveptr;
-    char *cursor;
-    ssize_t rc;
+    uint32_t words[DEBUG_D_LINE_WORDS];
+    size_t len, count, i;
+    uint32_t addr;
 
-    /* Strip leading address */
-    eoa = strchr(line, ':');
-    if (!eoa)
+    len = strcspn(line, "\r\n");
+    while (len && line[len - 1] == ' ')
+        len--;
+
+    /* The address, and at least one word */
+    if (len < HEX_WORD_STRIDE + HEX_WORD_LEN || line[HEX_WORD_LEN] != ':')
         return -EBADE;
 
-    /* Extract 4-byte values */
-    words = eoa + 1;
-    cursor = buf;
-    stream = strdup(words);
-    while ((token = strtok_r(words, " ", &saveptr))) {
-        rc = sscanf(token, "%02hhx%02hhx%02hhx%02hhx",
-                    &cursor[3], &cursor[2], &cursor[1], &cursor[0]);
-        if (rc < 0) {
-            rc = -errno;
-            goto done;
-        }
+    if (hex_decode_words(line, 1, &addr) || addr != phys)
+        return -EBADE;
 
-        if (rc < 4) {
-            loge("Wanted 4 but extracted %zd bytes from token '%s' in words '%s' from line '%s'\n",
-                 rc, token, words, line);
-            rc = -EBADE;
-            goto done;
-        }
+    len -= HEX_WORD_STRIDE;
+    if ((len + 1) % HEX_WORD_STRIDE)
+        return -EBADE;
 
-        cursor += rc;
-        words = NULL;
-    }
+    count = (len + 1) / HEX_WORD_STRIDE;
+    if (count > max || count > DEBUG_D_LINE_WORDS)
+        return -EBADE;
 
-    rc = cursor - buf;
+    if (hex_decode_words(line + HEX_WORD_STRIDE, count, words))
+        return -EBADE;
 
-done:
-    free(stream);
-    return rc;
+    for (i = 0; i < count; i++)
+        words[i] = htole32(words[i]);
+
+    memcpy(buf, words, count * sizeof(words[0]));
+
+    return count * sizeof(words[0]);
 }
 
 static int debug_read_fixed(struct debug *ctx, char mode, uint32_t phys,
@@ -184,36 +624,40 @@ static int debug_read_fixed(struct debug *ctx, char mode, uint32_t phys,
 }
 
 #define DEBUG_D_MAX_LEN (128 * 1024)
+#define DEBUG_D_RETRIES 3
+#define DEBUG_D_LINE_LEN sizeof("20002ba0:31e01002 20433002 30813003 e1a06002\r\n")
 
-ssize_t debug_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+static ssize_t debug_read_bytes(struct debug *ctx, uint32_t phys, uint8_t *buf,
+                                size_t len)
 {
-    char line[2 * sizeof("20002ba0:31e01002 20433002 30813003 e1a06002\r\n")];
-    struct debug *ctx = to_debug(ahb);
-    size_t remaining = len;
-    size_t ingress;
-    char *command;
-    char *cursor;
-    ssize_t rc;
+    uint32_t val = 0;
+    size_t i;
+    int rc;
 
-    if (len < 4) {
-        uint32_t val = 0;
+    for (i = 0; i < len; i++) {
+        rc = debug_read_fixed(ctx, 'i', phys + i, &val);
+        if (rc < 0)
+            return rc;
 
-        cursor = buf;
-        while (remaining) {
-            rc = debug_read_fixed(ctx, 'i', phys, &val);
-            if (rc < 0)
-                return rc;
+        buf[i] = val & 0xff;
+    }
 
-            *cursor++ = val & 0xff;
-            remaining--;
-            phys++;
-        }
+    return len;
+}
 
-        return len;
-    }
+/* Read a whole number of words starting at the word-aligned phys using `d` */
+static ssize_t debug_read_words(struct debug *ctx, uint32_t phys, uint8_t *buf,
+                                size_t len)
+{
+    char line[2 * DEBUG_D_LINE_LEN];
+    unsigned int retries = 0;
+    size_t remaining = len;
+    uint8_t *cursor = buf;
+    size_t ingress;
+    char *command;
+    ssize_t rc;
 
-    cursor = buf;
-    do {
+    while (remaining) {
         size_t consumed;
         int found;
 
@@ -242,7 +686,9 @@ retry:
             if (found < 0)
                 return found;
 
-            rc = debug_parse_d(line, cursor);
+            rc = debug_parse_d(line, phys + consumed,
+                               (ingress - consumed) / sizeof(uint32_t),
+                               cursor + consumed);
             if (rc < 0) {
                 rc = prompt_run(&ctx->prompt, "");
                 if (rc < 0)
@@ -251,11 +697,12 @@ retry:
                 if (rc < 0)
                     return rc;
                 loge("Failed to parse line '%s'\n", line);
+                if (++retries > DEBUG_D_RETRIES)
+                    return -EBADE;
                 loge("Retrying from address 0x%"PRIx32"\n", phys);
                 goto retry;
             }
 
-            cursor += rc;
             consumed += rc;
         } while (consumed < ingress);
 
@@ -265,80 +712,529 @@ retry:
          */
 
         phys += ingress;
+        cursor += ingress;
         remaining -= ingress;
-    } while(remaining);
+    }
 
     return len;
 }
 
-#define DEBUG_CMD_U_MAX 128
+/*
+ * The largest `u` chunk the shell takes without dropping data is found once
+ * by debug_upload_probe(), by uploading decreasing sizes from DEBUG_CMD_U_MAX
+ * to scratch SRAM. Without scratch space the upstream size of
+ * DEBUG_CMD_U_DEFAULT is assumed.
+ */
+#define DEBUG_CMD_U_MIN 16
+#define DEBUG_CMD_U_DEFAULT 128
+#define DEBUG_CMD_U_MAX 4096
+#define DEBUG_CMD_U_PAD 16
+
+#define DEBUG_SRAM_G4                   0x1e720000
+#define DEBUG_SRAM_G6                   0x10000000
 
-ssize_t debug_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
+/* How long to wait for the prompt once len bytes are queued on the console */
+static int debug_console_timeout(struct debug *ctx, size_t len)
 {
-    struct debug *ctx = to_debug(ahb);
-    const void *cursor;
-    size_t remaining;
+    int baud = ctx->baud ? ctx->baud : DEBUG_BAUD_BASE;
+
+    return DEBUG_BAUD_TIMEOUT_MS + (len * 10 * 1000) / baud;
+}
+
+/*
+ * The shell waits for all of the announced data, so if any was dropped, pad
+ * the upload until the prompt appears. The line left behind by any excess
+ * padding is then flushed out as a bogus command. The padding lands in the
+ * upload's destination, so this returns the shell to the prompt but not the
+ * memory to a known state.
+ */
+static int debug_upload_recover(struct debug *ctx, size_t len)
+{
+    static const char pad[DEBUG_CMD_U_PAD];
+    size_t padded;
+    int rc;
+
+    for (padded = 0; padded < len; padded += sizeof(pad)) {
+        rc = prompt_write(&ctx->prompt, pad, sizeof(pad));
+        if (rc < 0)
+            return rc;
+
+        rc = prompt_read_until_timeout(&ctx->prompt, "$ ", NULL, 0,
+                                       debug_console_timeout(ctx, sizeof(pad)));
+        if (!rc)
+            break;
+
+        if (rc != -ETIMEDOUT)
+            return rc;
+    }
+
+    if (padded >= len)
+        return -EIO;
+
+    if ((rc = prompt_run(&ctx->prompt, "")) < 0)
+        return rc;
+
+    return prompt_drain(&ctx->prompt, DEBUG_BAUD_TIMEOUT_MS);
+}
+
+/*
+ * Upload len bytes to phys with a single `u`, returning -ETIMEDOUT with the
+ * shell back at its prompt if any of the data was dropped.
+ *
+ * The prompt is only taken after the echoed command, as debug_read_words() can
+ * leave the prompt of an earlier command in the stream.
+ */
+static int debug_upload_chunk(struct debug *ctx, uint32_t phys,
+                              const uint8_t *buf, size_t len)
+{
+    char command[sizeof("u 12345678 ") + 2 * sizeof(size_t)];
+    int timeout;
+    int rc;
+
+    snprintf(command, sizeof(command), "u %" PRIx32 " %zx", phys, len);
+
+    rc = prompt_run(&ctx->prompt, command);
+    if (rc < 0)
+        return rc;
+
+    rc = prompt_write(&ctx->prompt, (const char *)buf, len);
+    if (rc < 0)
+        return rc;
+
+    timeout = debug_console_timeout(ctx, len);
+
+    rc = prompt_read_until_timeout(&ctx->prompt, command, NULL, 0, timeout);
+    if (!rc)
+        rc = prompt_read_until_timeout(&ctx->prompt, "$ ", NULL, 0, timeout);
+    if (rc != -ETIMEDOUT)
+        return rc;
+
+    if ((rc = debug_upload_recover(ctx, len)) < 0)
+        return rc;
+
+    return -ETIMEDOUT;
+}
+
+/*
+ * A chunk that times out isn't retried: the shell stores what it received and
+ * the recovery padding at the destination, and re-sending could repeat side
+ * effects of the writes, such as flash page programs.
+ */
+static ssize_t debug_upload(struct debug *ctx, uint32_t phys, const void *buf,
+                            size_t len)
+{
+    const uint8_t *cursor = buf;
+    size_t remaining = len;
     size_t egress;
-    char *command;
-    char mode;
     int rc;
 
-    if (len <= 4) {
-        size_t remaining;
+    do {
+        egress = remaining > ctx->upload ? ctx->upload : remaining;
 
-        remaining = len;
-        cursor = buf;
-        while (remaining) {
-            rc = asprintf(&command, "o %x %hhx", phys, *(const uint8_t *)cursor);
-            if (rc < 0)
-                return -errno;
+        rc = debug_upload_chunk(ctx, phys, cursor, egress);
+        if (rc == -ETIMEDOUT) {
+            loge("Debug UART dropped data uploading to 0x%" PRIx32 "\n", phys);
+            return -EIO;
+        }
+
+        if (rc < 0)
+            return rc;
 
-            rc = prompt_run(&ctx->prompt, command);
+        phys += egress;
+        cursor += egress;
+        remaining -= egress;
+    } while (remaining);
+
+    return len;
+}
+
+static int debug_write_words(struct debug *ctx, uint32_t phys,
+                             const uint8_t *buf, size_t len);
+
+/*
+ * Find the largest `u` chunk that arrives intact by uploading to scratch SRAM,
+ * whose contents are saved beforehand and restored afterwards. Uploads are
+ * disabled if none does.
+ */
+static int debug_upload_probe(struct debug *ctx)
+{
+    uint8_t saved[DEBUG_CMD_U_MAX], pattern[DEBUG_CMD_U_MAX];
+    uint8_t readback[DEBUG_CMD_U_MAX];
+    uint32_t rev, scratch;
+    size_t size, i;
+    int rc, cleanup;
+
+    rc = debug_readl(debug_as_ahb(ctx), DEBUG_SCU | DEBUG_SCU_REV, &rev);
+    if (rc < 0)
+        return rc;
+
+    if (!rev_is_supported(rev)) {
+        ctx->upload = DEBUG_CMD_U_DEFAULT;
+        return 0;
+    }
+
+    scratch = rev_is_generation(rev, ast_g6) ? DEBUG_SRAM_G6 : DEBUG_SRAM_G4;
+
+    rc = debug_read_words(ctx, scratch, saved, sizeof(saved));
+    if (rc < 0)
+        return rc;
+
+    for (size = DEBUG_CMD_U_MAX; size >= DEBUG_CMD_U_MIN; size /= 2) {
+        for (i = 0; i < size; i++)
+            pattern[i] = ~saved[i] ^ (i * 0x5b);
+
+        rc = debug_upload_chunk(ctx, scratch, pattern, size);
+        if (rc == -ETIMEDOUT)
+            continue;
+
+        if (rc < 0)
+            goto restore;
+
+        rc = debug_read_words(ctx, scratch, readback, size);
+        if (rc < 0)
+            goto restore;
+
+        if (!memcmp(pattern, readback, size))
+            break;
+    }
+
+    ctx->upload = size >= DEBUG_CMD_U_MIN ? size : 0;
+    if (ctx->upload)
+        logd("Uploading in %zu byte chunks over the debug UART\n", ctx->upload);
+    else
+        logi("Debug UART uploads are unreliable, writing words instead\n");
+
+    rc = 0;
+
+restore:
+    if (ctx->upload)
+        cleanup = debug_upload(ctx, scratch, saved, sizeof(saved));
+    else
+        cleanup = debug_write_words(ctx, scratch, saved, sizeof(saved));
+
+    if (cleanup < 0)
+        loge("Failed to restore the SRAM at 0x%" PRIx32 ": %d\n", scratch,
+             cleanup);
+
+    return rc < 0 ? rc : (cleanup < 0 ? cleanup : 0);
+}
+
+/* Pipelined bulk transfers use smaller reads so that there's more to overlap */
+#define DEBUG_D_PIPE_LEN 4096
+/* The receive FIFO of the BMC UART, which holds the queued commands */
+#define DEBUG_UART_FIFO 16
+
+static unsigned int debug_depth = 1;
+
+int debug_set_depth(unsigned int depth)
+{
+    /* The commands queued behind the one executing must fit in the FIFO */
+    BUILD_ASSERT((DEBUG_DEPTH_MAX - 1) * sizeof("d 12345678 1000") <=
+                 DEBUG_UART_FIFO);
+    BUILD_ASSERT(DEBUG_D_PIPE_LEN <= 0xffff);
+
+    if (!depth || depth > DEBUG_DEPTH_MAX)
+        return -EINVAL;
+
+    debug_depth = depth;
+
+    return 0;
+}
+
+static int debug_send_dump(struct debug *ctx, uint32_t phys, size_t len)
+{
+    char command[sizeof("d 12345678 ") + 2 * sizeof(size_t)];
+
+    snprintf(command, sizeof(command), "d %" PRIx32 " %zx", phys, len);
+
+    return prompt_run(&ctx->prompt, command);
+}
+
+/* Extract the address from the echoed command that starts a response */
+static int debug_parse_echo(const char *response, uint32_t *phys)
+{
+    const char *cursor = response;
+    unsigned long val;
+    char *end;
+
+    /* Skip any blank lines and prompts left by earlier commands */
+    for (;;) {
+        cursor += strspn(cursor, "\r\n ");
+        if (*cursor != '$')
+            break;
+        cursor++;
+    }
+
+    if (cursor[0] != 'd' || cursor[1] != ' ')
+        return -EBADE;
+
+    errno = 0;
+    val = strtoul(cursor + 2, &end, 16);
+    if (errno || end == cursor + 2 || val > UINT32_MAX)
+        return -EBADE;
+
+    *phys = val;
+
+    return 0;
+}
+
+/* Parse the `d` output that follows the echoed command in a response */
+static int debug_parse_dump(const char *response, uint32_t phys, uint8_t *buf,
+                            size_t len)
+{
+    const char *line = strchr(response, '\n');
+    size_t consumed = 0;
+    ssize_t rc;
+
+    while (line && consumed < len) {
+        line++;
+
+        if (*line != '\r' && *line != '\n') {
+            rc = debug_parse_d(line, phys + consumed,
+                               (len - consumed) / sizeof(uint32_t),
+                               buf + consumed);
             if (rc < 0)
                 return rc;
 
-            rc = prompt_expect(&ctx->prompt, "$ ");
+            consumed += rc;
+        }
+
+        line = strchr(line, '\n');
+    }
+
+    return consumed == len ? 0 : -EBADE;
+}
+
+/*
+ * Split a read into `d` commands of chunk bytes and keep up to debug_depth of
+ * them in flight. The BMC executes the commands in order and each response
+ * ends with the prompt, so responses are matched to commands by the address
+ * they echo. A command whose response is missing or malformed is replayed
+ * alone once the others have completed.
+ *
+ * Only reads are pipelined: the commands are short, but `u` data arriving
+ * while the shell is still busy with an earlier command overruns the 16-byte
+ * receive FIFO of the UART.
+ */
+static ssize_t debug_pipeline(struct debug *ctx, uint32_t phys, uint8_t *dst,
+                              size_t len, size_t chunk)
+{
+    size_t n = (len + chunk - 1) / chunk;
+    size_t response_len;
+    size_t issued, k, j;
+    char *response;
+    uint32_t echoed;
+    bool *failed;
+    ssize_t rc;
+
+    /* Room for the echo and the dump */
+    response_len = (chunk / 16 + 4) * DEBUG_D_LINE_LEN;
+
+    response = malloc(response_len);
+    failed = calloc(n, sizeof(*failed));
+    if (!response || !failed) {
+        rc = -ENOMEM;
+        goto done;
+    }
+
+    issued = 0;
+    for (k = 0; k < n; k++) {
+        size_t offset;
+
+        for (; issued < n && issued - k < debug_depth; issued++) {
+            offset = issued * chunk;
+            rc = debug_send_dump(ctx, phys + offset,
+                                 len - offset > chunk ? chunk : len - offset);
             if (rc < 0)
-                return rc;
-            if (rc == 0)
-                return -EINVAL;
+                goto done;
+        }
 
-            cursor++;
-            phys++;
-            remaining--;
+        /*
+         * The response follows those of the commands ahead of it. Skip any
+         * prompt left behind by an earlier command, which isn't a response.
+         */
+        do {
+            rc = prompt_read_until_timeout(&ctx->prompt, "$ ", response,
+                                           response_len,
+                                           debug_console_timeout(ctx,
+                                                                 response_len));
+        } while (!rc && !response[strspn(response, "\r\n ")]);
+
+        if (rc == -ETIMEDOUT) {
+            /* Let any stragglers arrive before replaying what's left alone */
+            logi("Timed out waiting for pipelined 'd' commands\n");
+            for (; k < n; k++)
+                failed[k] = true;
+
+            if ((rc = prompt_drain(&ctx->prompt, DEBUG_BAUD_TIMEOUT_MS)) < 0)
+                goto done;
+
+            break;
         }
+        if (rc < 0)
+            goto done;
 
-        return len;
+        if (debug_parse_echo(response, &echoed) < 0) {
+            failed[k] = true;
+            continue;
+        }
+
+        /* A response for a later command means the ones before it were lost */
+        if (echoed != phys + k * chunk) {
+            j = (echoed - phys) / chunk;
+            if ((echoed - phys) % chunk || j <= k || j >= issued) {
+                failed[k] = true;
+                continue;
+            }
+
+            for (; k < j; k++)
+                failed[k] = true;
+        }
+
+        offset = k * chunk;
+        if (debug_parse_dump(response, phys + offset, dst + offset,
+                             len - offset > chunk ? chunk : len - offset))
+            failed[k] = true;
     }
 
-    mode = 'u';
+    for (k = 0; k < n; k++) {
+        size_t offset = k * chunk;
+        size_t remaining = len - offset > chunk ? chunk : len - offset;
 
-    remaining = len;
-    cursor = buf;
-    do {
-        egress = remaining > DEBUG_CMD_U_MAX ? DEBUG_CMD_U_MAX : remaining;
+        if (!failed[k])
+            continue;
 
-        rc = asprintf(&command, "%c %x %zx", mode, phys, egress);
+        logi("Replaying 'd' command for 0x%08" PRIx32 "\n",
+             (uint32_t)(phys + offset));
+
+        rc = debug_read_words(ctx, phys + offset, dst + offset, remaining);
         if (rc < 0)
-            return -errno;
+            goto done;
+    }
+
+    rc = len;
+
+done:
+    free(failed);
+    free(response);
+
+    return rc;
+}
+
+/* `d` only dumps whole words, so read any unaligned head and tail bytewise */
+ssize_t debug_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct debug *ctx = to_debug(ahb);
+    uint8_t *cursor = buf;
+    size_t head, body;
+    ssize_t rc;
+
+    debug_raised_deliver();
+
+    head = -phys & (sizeof(uint32_t) - 1);
+    if (head > len)
+        head = len;
+
+    body = (len - head) & ~(sizeof(uint32_t) - 1);
+
+    if ((rc = debug_read_bytes(ctx, phys, cursor, head)) < 0)
+        return rc;
+
+    if (debug_depth > 1 && body > DEBUG_D_PIPE_LEN)
+        rc = debug_pipeline(ctx, phys + head, cursor + head, body,
+                            DEBUG_D_PIPE_LEN);
+    else
+        rc = debug_read_words(ctx, phys + head, cursor + head, body);
+    if (rc < 0)
+        return rc;
+
+    rc = debug_read_bytes(ctx, phys + head + body, cursor + head + body,
+                          len - head - body);
+    if (rc < 0)
+        return rc;
+
+    return len;
+}
+
+static int debug_write_bytes(struct debug *ctx, uint32_t phys,
+                             const uint8_t *buf, size_t len)
+{
+    char command[sizeof("o 12345678 12")];
+    size_t i;
+    int rc;
+
+    for (i = 0; i < len; i++) {
+        snprintf(command, sizeof(command), "o %" PRIx32 " %" PRIx8,
+                 (uint32_t)(phys + i), buf[i]);
 
         rc = prompt_run(&ctx->prompt, command);
-        free(command);
         if (rc < 0)
             return rc;
 
-        rc = prompt_write(&ctx->prompt, (const char *)cursor, egress);
+        rc = prompt_expect(&ctx->prompt, "$ ");
         if (rc < 0)
             return rc;
+        if (rc == 0)
+            return -EINVAL;
+    }
 
-        rc = prompt_expect(&ctx->prompt, "$ ");
+    return 0;
+}
+
+static int debug_write_words(struct debug *ctx, uint32_t phys,
+                             const uint8_t *buf, size_t len)
+{
+    uint32_t word;
+    size_t i;
+    int rc;
+
+    for (i = 0; i < len; i += sizeof(word)) {
+        memcpy(&word, buf + i, sizeof(word));
+
+        rc = debug_writel(debug_as_ahb(ctx), phys + i, le32toh(word));
         if (rc < 0)
             return rc;
+    }
 
-        phys += egress;
-        cursor += egress;
-        remaining -= egress;
-    } while (remaining);
+    return 0;
+}
+
+/* Writes up to this size are issued as `w` and `o` rather than uploaded */
+#define DEBUG_CMD_W_MAX 8
+
+/*
+ * Small writes use `w` for the aligned words and `o` for the bytes either side
+ * of them, as each command costs a round trip. Anything larger is uploaded,
+ * as `u` takes any alignment, unless debug_upload_probe() found `u` unusable.
+ */
+ssize_t debug_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
+{
+    struct debug *ctx = to_debug(ahb);
+    const uint8_t *cursor = buf;
+    size_t head, body, tail;
+    int rc;
+
+    debug_raised_deliver();
+
+    if (len > DEBUG_CMD_W_MAX && ctx->upload)
+        return debug_upload(ctx, phys, buf, len);
+
+    head = (sizeof(uint32_t) - (phys & (sizeof(uint32_t) - 1))) &
+           (sizeof(uint32_t) - 1);
+    if (head > len)
+        head = len;
+    body = (len - head) & ~(sizeof(uint32_t) - 1);
+    tail = len - head - body;
+
+    if ((rc = debug_write_bytes(ctx, phys, cursor, head)) < 0)
+        return rc;
+
+    if ((rc = debug_write_words(ctx, phys + head, cursor + head, body)) < 0)
+        return rc;
+
+    rc = debug_write_bytes(ctx, phys + head + body, cursor + head + body, tail);
+    if (rc < 0)
+        return rc;
 
     return len;
 }
@@ -346,6 +1242,9 @@ ssize_t debug_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
 int debug_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
 {
     struct debug *ctx = to_debug(ahb);
+
+    debug_raised_deliver();
+
     return debug_read_fixed(ctx, 'r', phys, val);
 }
 
@@ -355,6 +1254,8 @@ int debug_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
     char *command;
     int rc;
 
+    debug_raised_deliver();
+
     rc = asprintf(&command, "w %x %x", phys, val);
     if (rc < 0)
         return -errno;
@@ -460,6 +1361,7 @@ static struct bridge_driver debug_driver = {
     .destroy = debug_driver_destroy,
     .release = debug_driver_release,
     .reinit = debug_driver_reinit,
+    .high_latency = true,
 };
 REGISTER_BRIDGE_DRIVER(debug_driver);
 
@@ -489,6 +1391,9 @@ int debug_init_v(struct debug *ctx, va_list args)
 
     ahb_init_ops(&ctx->ahb, &debug_driver, &debug_ahb_ops);
 
+    ctx->baud = 0;
+    ctx->upload = DEBUG_CMD_U_DEFAULT;
+
     return 0;
 
 cleanup_ts16:
@@ -542,8 +1447,21 @@ static struct ahb *debug_driver_probe(int argc, char *argv[])
         goto destroy_ctx;
     }
 
+    if ((rc = debug_raise_baud(ctx)) < 0) {
+        loge("Failed to raise the debug UART rate: %d\n", rc);
+        goto exit_ctx;
+    }
+
+    if ((rc = debug_upload_probe(ctx)) < 0) {
+        loge("Failed to probe the debug UART upload size: %d\n", rc);
+        goto exit_ctx;
+    }
+
     return debug_as_ahb(ctx);
 
+exit_ctx:
+    debug_exit(ctx);
+
 destroy_ctx:
     debug_destroy(ctx);
 
@@ -579,6 +1497,13 @@ static int debug_driver_release(struct ahb *ahb)
 static int debug_driver_reinit(struct ahb *ahb)
 {
     struct debug *ctx = to_debug(ahb);
+    int rc;
+
+    if ((rc = debug_enter(ctx)) < 0)
+        return rc;
+
+    if ((rc = debug_raise_baud(ctx)) < 0)
+        return rc;
 
-    return debug_enter(ctx);
+    return debug_upload_probe(ctx);
 }
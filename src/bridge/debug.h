@@ -10,6 +10,7 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -18,8 +19,38 @@ struct debug {
     struct console *console;
     struct prompt prompt;
     int port;
+    /* The BMC UART state to restore if it has been run faster than 115200 */
+    int baud;
+    unsigned int div;
+    uint32_t uart;
+    uint32_t lcr;
+    uint32_t misc;
+    bool scu_locked;
+    /* The `u` chunk size for uploads, or 0 if `u` drops data at any size */
+    size_t upload;
 };
 
+/*
+ * The most commands that may be kept in flight, see debug_set_depth(). While
+ * the shell prints a dump it doesn't read the UART, so the commands behind it
+ * wait in the 16-byte receive FIFO. A pipelined `d` command is 16 bytes, so
+ * only one fits, and any more would be overrun and dropped or spliced
+ * together.
+ */
+#define DEBUG_DEPTH_MAX 2
+
+/*
+ * Keep up to depth commands in flight for bulk transfers, rather than waiting
+ * for each to complete before issuing the next. 1, the default, disables this.
+ */
+int debug_set_depth(unsigned int depth);
+
+/*
+ * Limit the rate the debug UART is raised to once the debug shell is entered.
+ * 115200 leaves it at the rate the BMC came up with.
+ */
+int debug_set_max_baud(int baud);
+
 int debug_init(struct debug *ctx, ...);
 int debug_init_v(struct debug *ctx, va_list args);
 int debug_destroy(struct debug *ctx);
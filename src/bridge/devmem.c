@@ -27,6 +27,13 @@
 #define AST_SOC_IO	0x1e600000
 #define AST_SOC_IO_LEN	0x00200000
 
+/*
+ * Memory regions tolerate the 64-bit accesses the cores can issue, but
+ * peripheral registers must be accessed 32 bits at a time.
+ */
+#define DEVMEM_MEM_WIDTH	8
+#define DEVMEM_IO_WIDTH		4
+
 #define to_devmem(ahb) container_of(ahb, struct devmem, ahb)
 
 int devmem_probe(struct devmem *ctx)
@@ -78,6 +85,14 @@ cleanup:
     return -errno;
 }
 
+static size_t devmem_width(uint32_t phys, size_t len)
+{
+    if (phys < (AST_SOC_IO + AST_SOC_IO_LEN) && (phys + len) > AST_SOC_IO)
+        return DEVMEM_IO_WIDTH;
+
+    return DEVMEM_MEM_WIDTH;
+}
+
 ssize_t devmem_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
 {
     struct devmem *ctx = to_devmem(ahb);
@@ -87,7 +102,7 @@ ssize_t devmem_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
     if (woff < 0)
         return woff;
 
-    mmio_memcpy(buf, ctx->win + woff, len);
+    mmio_read(buf, ctx->win + woff, len, devmem_width(phys, len));
 
     return len;
 }
@@ -101,7 +116,7 @@ ssize_t devmem_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len
     if (woff < 0)
         return woff;
 
-    mmio_memcpy(ctx->win + woff, buf, len);
+    mmio_write(ctx->win + woff, buf, len, devmem_width(phys, len));
 
     return len;
 }
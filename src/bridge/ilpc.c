@@ -18,6 +18,9 @@
 
 #define LPC_HICRB_ILPCB_RO (1 << 6)
 
+#define ILPCB_SIZE_1    0
+#define ILPCB_SIZE_4    2
+
 #define to_ilpcb(ahb) container_of(ahb, struct ilpcb, ahb)
 
 int ilpcb_probe(struct ilpcb *ctx)
@@ -46,266 +49,444 @@ int ilpcb_mode(struct ilpcb *ctx)
     return !!(hicrb & LPC_HICRB_ILPCB_RO); /* Maps to enum ilpcb_mode */
 }
 
-ssize_t ilpcb_read(struct ahb *ahb, uint32_t addr, void *buf, size_t len)
+/*
+ * There's one SuperIO, shared by every iLPC2AHB user including the L2A bridge,
+ * so a session holds it unlocked with iLPC2AHB selected on behalf of them all.
+ */
+static struct {
+    unsigned int depth;
+    /* The last instance to program the registers during the session */
+    struct ilpcb *user;
+    bool cleanup;
+} ilpcb_session;
+
+/* Unlock the SuperIO and enable the iLPC2AHB device for a sequence of accesses */
+static int ilpcb_enter(struct ilpcb *ctx)
 {
-    struct ilpcb *ctx = to_ilpcb(ahb);
     struct sio *sio = &ctx->sio;
-    size_t remaining;
-    uint8_t data;
-    int locked;
-    ssize_t rc;
+    int rc;
 
-    if (len > SSIZE_MAX)
-        return -EINVAL;
+    if (ilpcb_session.depth) {
+        /* Our shadows are stale if another instance has used the registers */
+        if (ilpcb_session.user != ctx) {
+            ctx->shadowed = false;
+            ilpcb_session.user = ctx;
+        }
+
+        return 0;
+    }
 
     rc = sio_unlock(sio);
     if (rc)
-        goto done;
+        return rc;
 
     /* Select iLPC2AHB */
     rc = sio_select(sio, sio_ilpc);
     if (rc)
-        goto done;
+        return rc;
+
+    /* Another SuperIO user may have changed the registers since we last held it */
+    ctx->shadowed = false;
 
     /* Enable iLPC2AHB */
-    rc = sio_writeb(sio, 0x30, 0x01);
-    if (rc)
-        goto done;
+    return sio_writeb(sio, 0x30, 0x01);
+}
 
-    /* 1-byte access */
-    rc = sio_writeb(sio, 0xf8, 0);
-    if (rc)
-        goto done;
+/*
+ * Each SuperIO register access is two port I/Os across the LPC bus, so only
+ * write the access size and the address bytes that differ from the values
+ * already programmed. Sequential accesses then usually rewrite just 0xf3.
+ */
+static void ilpcb_set_size(struct ilpcb *ctx, struct sio_batch *batch,
+                           uint8_t size)
+{
+    if (ctx->shadowed && ctx->size == size)
+        return;
+
+    sio_batch_writeb(batch, 0xf8, size);
+    ctx->size = size;
+}
+
+static void ilpcb_set_addr(struct ilpcb *ctx, struct sio_batch *batch,
+                           uint32_t addr)
+{
+    uint32_t diff = ctx->shadowed ? ctx->addr ^ addr : UINT32_MAX;
+
+    if (diff & 0xff000000)
+        sio_batch_writeb(batch, 0xf0, addr >> 24);
+    if (diff & 0x00ff0000)
+        sio_batch_writeb(batch, 0xf1, addr >> 16);
+    if (diff & 0x0000ff00)
+        sio_batch_writeb(batch, 0xf2, addr >>  8);
+    if (diff & 0x000000ff)
+        sio_batch_writeb(batch, 0xf3, addr      );
+
+    ctx->addr = addr;
+}
+
+/*
+ * Both registers are queued together so the shadows are valid as a pair. They
+ * describe the registers once the batch is submitted, see ilpcb_submit_batch().
+ */
+static void ilpcb_setup(struct ilpcb *ctx, struct sio_batch *batch,
+                        uint32_t addr, uint8_t size)
+{
+    ilpcb_set_size(ctx, batch, size);
+    ilpcb_set_addr(ctx, batch, addr);
+    ctx->shadowed = true;
+}
+
+/*
+ * The register sequence for each access is submitted as one batch, which the
+ * LPC backend may issue in a single system call.
+ */
+static int ilpcb_submit_batch(struct ilpcb *ctx, struct sio_batch *batch)
+{
+    int rc;
+
+    if ((rc = sio_batch_submit(batch)))
+        ctx->shadowed = false;
+
+    return rc;
+}
+
+static void ilpcb_exit(struct ilpcb *ctx)
+{
+    int locked;
+
+    if (ilpcb_session.depth)
+        return;
+
+    locked = sio_lock(&ctx->sio);
+    if (locked) {
+        errno = -locked;
+        perror("Failed to lock SuperIO device");
+    }
+}
+
+static int __ilpcb_readb(struct ilpcb *ctx, uint32_t addr, uint8_t *val)
+{
+    struct sio_batch batch;
+    uint8_t data;
+
+    sio_batch_init(&batch, &ctx->sio);
+    ilpcb_setup(ctx, &batch, addr, ILPCB_SIZE_1);
+
+    /* Trigger */
+    sio_batch_readb(&batch, 0xfe, &data);
+
+    sio_batch_readb(&batch, 0xf7, val);
+
+    return ilpcb_submit_batch(ctx, &batch);
+}
+
+static int __ilpcb_writeb(struct ilpcb *ctx, uint32_t addr, uint8_t val)
+{
+    struct sio_batch batch;
+
+    sio_batch_init(&batch, &ctx->sio);
+    ilpcb_setup(ctx, &batch, addr, ILPCB_SIZE_1);
+
+    sio_batch_writeb(&batch, 0xf7, val);
+
+    /* Trigger */
+    sio_batch_writeb(&batch, 0xfe, 0xcf);
+
+    return ilpcb_submit_batch(ctx, &batch);
+}
+
+/* Little-endian */
+static int __ilpcb_readl(struct ilpcb *ctx, uint32_t addr, uint32_t *val)
+{
+    struct sio_batch batch;
+    uint8_t data[4];
+    uint8_t trigger;
+    int rc;
+
+    sio_batch_init(&batch, &ctx->sio);
+
+    /* 4-byte access */
+    ilpcb_setup(ctx, &batch, addr, ILPCB_SIZE_4);
+
+    /* Trigger */
+    sio_batch_readb(&batch, 0xfe, &trigger);
+
+    /* Value */
+    sio_batch_readb(&batch, 0xf4, &data[0]);
+    sio_batch_readb(&batch, 0xf5, &data[1]);
+    sio_batch_readb(&batch, 0xf6, &data[2]);
+    sio_batch_readb(&batch, 0xf7, &data[3]);
+
+    if ((rc = ilpcb_submit_batch(ctx, &batch)))
+        return rc;
+
+    *val = ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) |
+           data[3];
+
+    return 0;
+}
+
+/* Little-endian */
+static int __ilpcb_writel(struct ilpcb *ctx, uint32_t addr, uint32_t val)
+{
+    struct sio_batch batch;
+
+    sio_batch_init(&batch, &ctx->sio);
+
+    /* 4-byte access */
+    ilpcb_setup(ctx, &batch, addr, ILPCB_SIZE_4);
+
+    /* Value */
+    sio_batch_writeb(&batch, 0xf4, val >> 24);
+    sio_batch_writeb(&batch, 0xf5, val >> 16);
+    sio_batch_writeb(&batch, 0xf6, val >>  8);
+    sio_batch_writeb(&batch, 0xf7, val >>  0);
+
+    /* Trigger */
+    sio_batch_writeb(&batch, 0xfe, 0xcf);
+
+    return ilpcb_submit_batch(ctx, &batch);
+}
+
+/*
+ * Transfer the aligned span of the buffer with 4-byte accesses, which cost
+ * little more in port I/O than a single byte access, and the unaligned head
+ * and tail a byte at a time.
+ */
+static ssize_t __ilpcb_read(struct ilpcb *ctx, uint32_t addr, void *buf, size_t len)
+{
+    uint8_t *cursor = buf;
+    size_t remaining;
+    uint32_t val;
+    int rc;
 
-    /* XXX: Think about optimising this */
     remaining = len;
     while (remaining) {
-        /* Address */
-        rc |= sio_writeb(sio, 0xf0, addr >> 24);
-        rc |= sio_writeb(sio, 0xf1, addr >> 16);
-        rc |= sio_writeb(sio, 0xf2, addr >>  8);
-        rc |= sio_writeb(sio, 0xf3, addr      );
-        if (rc)
-            goto done;
-
-        /* Trigger */
-        rc = sio_readb(sio, 0xfe, &data);
-        if (rc)
-            goto done;
-
-        rc = sio_readb(sio, 0xf7, (uint8_t *)buf);
-        if (rc)
-            goto done;
-
-        buf++;
+        if (!(addr & 3) && remaining >= 4) {
+            if ((rc = __ilpcb_readl(ctx, addr, &val)))
+                return rc;
+
+            cursor[0] = val;
+            cursor[1] = val >> 8;
+            cursor[2] = val >> 16;
+            cursor[3] = val >> 24;
+
+            cursor += 4;
+            addr += 4;
+            remaining -= 4;
+            continue;
+        }
+
+        if ((rc = __ilpcb_readb(ctx, addr, cursor)))
+            return rc;
+
+        cursor++;
         addr++;
         remaining--;
     }
 
-done:
-    locked = sio_lock(sio);
-    if (locked) {
-        errno = -locked;
-        perror("sio_lock");
+    return len;
+}
+
+static ssize_t
+__ilpcb_write(struct ilpcb *ctx, uint32_t addr, const void *buf, size_t len)
+{
+    const uint8_t *cursor = buf;
+    size_t remaining;
+    uint32_t val;
+    int rc;
+
+    remaining = len;
+    while (remaining) {
+        if (!(addr & 3) && remaining >= 4) {
+            val = cursor[0] | (cursor[1] << 8) | (cursor[2] << 16) |
+                  ((uint32_t)cursor[3] << 24);
+
+            if ((rc = __ilpcb_writel(ctx, addr, val)))
+                return rc;
+
+            cursor += 4;
+            addr += 4;
+            remaining -= 4;
+            continue;
+        }
+
+        if ((rc = __ilpcb_writeb(ctx, addr, *cursor)))
+            return rc;
+
+        cursor++;
+        addr++;
+        remaining--;
     }
 
-    return rc ? rc : (ssize_t)len;
+    return len;
 }
 
-ssize_t ilpcb_write(struct ahb *ahb, uint32_t addr, const void *buf, size_t len)
+ssize_t ilpcb_read(struct ahb *ahb, uint32_t addr, void *buf, size_t len)
 {
     struct ilpcb *ctx = to_ilpcb(ahb);
-    struct sio *sio = &ctx->sio;
-    size_t remaining;
-    int locked;
     ssize_t rc;
 
     if (len > SSIZE_MAX)
         return -EINVAL;
 
-    rc = sio_unlock(sio);
-    if (rc)
-        goto done;
+    if (!(rc = ilpcb_enter(ctx)))
+        rc = __ilpcb_read(ctx, addr, buf, len);
 
-    /* Select iLPC2AHB */
-    rc = sio_select(sio, sio_ilpc);
-    if (rc)
-        goto done;
+    ilpcb_exit(ctx);
 
-    /* Enable iLPC2AHB */
-    rc = sio_writeb(sio, 0x30, 0x01);
-    if (rc)
-        goto done;
+    return rc;
+}
 
-    /* 1-byte access */
-    rc = sio_writeb(sio, 0xf8, 0);
-    if (rc)
-        goto done;
+ssize_t ilpcb_write(struct ahb *ahb, uint32_t addr, const void *buf, size_t len)
+{
+    struct ilpcb *ctx = to_ilpcb(ahb);
+    ssize_t rc;
 
-    /* XXX: Think about optimising this */
-    remaining = len;
-    while (remaining) {
-        /* Address */
-        rc |= sio_writeb(sio, 0xf0, addr >> 24);
-        rc |= sio_writeb(sio, 0xf1, addr >> 16);
-        rc |= sio_writeb(sio, 0xf2, addr >>  8);
-        rc |= sio_writeb(sio, 0xf3, addr      );
-        if (rc)
-            goto done;
-
-        rc = sio_writeb(sio, 0xf7, *(uint8_t *)buf);
-        if (rc)
-            goto done;
-
-        /* Trigger */
-        rc = sio_writeb(sio, 0xfe, 0xcf);
-        if (rc)
-            goto done;
-
-        buf++;
-        remaining--;
-    }
+    if (len > SSIZE_MAX)
+        return -EINVAL;
 
-done:
-    locked = sio_lock(sio);
-    if (locked) {
-        errno = -locked;
-        perror("sio_lock");
-    }
+    if (!(rc = ilpcb_enter(ctx)))
+        rc = __ilpcb_write(ctx, addr, buf, len);
+
+    ilpcb_exit(ctx);
 
-    return rc ? rc : (ssize_t)len;
+    return rc;
 }
 
-/* Little-endian */
 int ilpcb_readl(struct ahb *ahb, uint32_t addr, uint32_t *val)
 {
     struct ilpcb *ctx = to_ilpcb(ahb);
-    struct sio *sio = &ctx->sio;
-    uint32_t extracted;
-    uint8_t data;
-    int locked;
     int rc;
 
-    rc = sio_unlock(sio);
-    if (rc)
-        goto done;
+    if (!(rc = ilpcb_enter(ctx)))
+        rc = __ilpcb_readl(ctx, addr, val);
 
-    /* Select iLPC2AHB */
-    rc = sio_select(sio, sio_ilpc);
-    if (rc)
-        goto done;
+    ilpcb_exit(ctx);
 
-    /* Enable iLPC2AHB */
-    rc = sio_writeb(sio, 0x30, 0x01);
-    if (rc)
-        goto done;
+    return rc;
+}
 
-    /* 4-byte access */
-    rc = sio_writeb(sio, 0xf8, 2);
-    if (rc)
-        goto done;
+int ilpcb_writel(struct ahb *ahb, uint32_t addr, uint32_t val)
+{
+    struct ilpcb *ctx = to_ilpcb(ahb);
+    int rc;
 
-    /* Address */
-    rc |= sio_writeb(sio, 0xf0, addr >> 24);
-    rc |= sio_writeb(sio, 0xf1, addr >> 16);
-    rc |= sio_writeb(sio, 0xf2, addr >>  8);
-    rc |= sio_writeb(sio, 0xf3, addr      );
-    if (rc)
-        goto done;
+    if (!(rc = ilpcb_enter(ctx)))
+        rc = __ilpcb_writel(ctx, addr, val);
 
-    /* Trigger */
-    rc = sio_readb(sio, 0xfe, &data);
-    if (rc)
-        goto done;
+    ilpcb_exit(ctx);
 
-    /* Value */
-    extracted = 0;
-    rc |= sio_readb(sio, 0xf4, &data);
-    extracted = (extracted << 8) | data;
-    rc |= sio_readb(sio, 0xf5, &data);
-    extracted = (extracted << 8) | data;
-    rc |= sio_readb(sio, 0xf6, &data);
-    extracted = (extracted << 8) | data;
-    rc |= sio_readb(sio, 0xf7, &data);
-    extracted = (extracted << 8) | data;
-    if (rc)
-        goto done;
+    return rc;
+}
 
-    *val = extracted;
+/* Accessors for use with the SuperIO already unlocked, see ilpcb_submit() */
+static ssize_t ilpcb_held_read(struct ahb *ahb, uint32_t addr, void *buf,
+                               size_t len)
+{
+    return __ilpcb_read(to_ilpcb(ahb), addr, buf, len);
+}
 
-done:
-    locked = sio_lock(sio);
-    if (locked) {
-        errno = -locked;
-        perror("sio_lock");
-    }
+static ssize_t ilpcb_held_write(struct ahb *ahb, uint32_t addr,
+                                const void *buf, size_t len)
+{
+    return __ilpcb_write(to_ilpcb(ahb), addr, buf, len);
+}
 
-    return rc;
+static int ilpcb_held_readl(struct ahb *ahb, uint32_t addr, uint32_t *val)
+{
+    return __ilpcb_readl(to_ilpcb(ahb), addr, val);
 }
 
-/* Little-endian */
-int ilpcb_writel(struct ahb *ahb, uint32_t addr, uint32_t val)
+static int ilpcb_held_writel(struct ahb *ahb, uint32_t addr, uint32_t val)
+{
+    return __ilpcb_writel(to_ilpcb(ahb), addr, val);
+}
+
+static const struct ahb_ops ilpcb_held_ops = {
+    .read = ilpcb_held_read,
+    .write = ilpcb_held_write,
+    .readl = ilpcb_held_readl,
+    .writel = ilpcb_held_writel,
+};
+
+/* Execute the batch with the SuperIO unlocked and iLPC2AHB selected throughout */
+int ilpcb_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
 {
     struct ilpcb *ctx = to_ilpcb(ahb);
-    struct sio *sio = &ctx->sio;
-    int locked;
+    size_t i;
     int rc;
 
-    rc = sio_unlock(sio);
-    if (rc)
-        goto done;
+    for (i = 0; i < n; i++)
+        ops[i].rc = -ECANCELED;
 
-    /* Select iLPC2AHB */
-    rc = sio_select(sio, sio_ilpc);
-    if (rc)
+    if ((rc = ilpcb_enter(ctx)))
         goto done;
 
-    /* Enable iLPC2AHB */
-    rc = sio_writeb(sio, 0x30, 0x01);
-    if (rc)
-        goto done;
+    for (i = 0; i < n; i++) {
+        if ((rc = ops[i].rc = ahb_op_call(ahb, &ilpcb_held_ops, &ops[i])))
+            break;
+    }
 
-    /* 4-byte access */
-    rc = sio_writeb(sio, 0xf8, 2);
-    if (rc)
-        goto done;
+done:
+    ilpcb_exit(ctx);
 
-    /* Address */
-    rc |= sio_writeb(sio, 0xf0, addr >> 24);
-    rc |= sio_writeb(sio, 0xf1, addr >> 16);
-    rc |= sio_writeb(sio, 0xf2, addr >>  8);
-    rc |= sio_writeb(sio, 0xf3, addr >>  0);
-    if (rc)
-        goto done;
+    return rc;
+}
 
-    /* Value */
-    rc |= sio_writeb(sio, 0xf4, val >> 24);
-    rc |= sio_writeb(sio, 0xf5, val >> 16);
-    rc |= sio_writeb(sio, 0xf6, val >>  8);
-    rc |= sio_writeb(sio, 0xf7, val >>  0);
-    if (rc)
-        goto done;
+/* Don't leave the SuperIO unlocked if we exit with a session open */
+static void ilpcb_session_cleanup(void)
+{
+    struct ilpcb *user = ilpcb_session.user;
 
-    /* Trigger */
-    rc = sio_writeb(sio, 0xfe, 0xcf);
-    if (rc)
-        goto done;
+    if (!ilpcb_session.depth)
+        return;
 
-done:
-    locked = sio_lock(sio);
-    if (locked) {
-        errno = -locked;
-        perror("Failed to lock SuperIO device");
+    ilpcb_session.depth = 0;
+    ilpcb_exit(user);
+}
+
+int ilpcb_begin(struct ahb *ahb)
+{
+    struct ilpcb *ctx = to_ilpcb(ahb);
+    int rc;
+
+    if (ilpcb_session.depth) {
+        ilpcb_session.depth++;
+        return 0;
     }
 
-    return rc;
+    if ((rc = ilpcb_enter(ctx))) {
+        ilpcb_exit(ctx);
+        return rc;
+    }
+
+    if (!ilpcb_session.cleanup) {
+        atexit(ilpcb_session_cleanup);
+        ilpcb_session.cleanup = true;
+    }
+
+    ilpcb_session.user = ctx;
+    ilpcb_session.depth = 1;
+
+    return 0;
+}
+
+void ilpcb_end(struct ahb *ahb __unused)
+{
+    /* The session may have been closed early by ilpcb_destroy() */
+    if (!ilpcb_session.depth || --ilpcb_session.depth)
+        return;
+
+    ilpcb_exit(ilpcb_session.user);
 }
 
 static const struct ahb_ops ilpcb_ops = {
     .read = ilpcb_read,
     .write = ilpcb_write,
     .readl = ilpcb_readl,
-    .writel = ilpcb_writel
+    .writel = ilpcb_writel,
+    .submit = ilpcb_submit,
 };
 
 static struct ahb *ilpcb_driver_probe(int argc, char *argv[]);
@@ -315,18 +496,26 @@ static struct bridge_driver ilpcb_driver = {
     .name = "ilpc",
     .probe = ilpcb_driver_probe,
     .destroy = ilpcb_driver_destroy,
+    .begin = ilpcb_begin,
+    .end = ilpcb_end,
+    .resources = BRIDGE_RES_SUPERIO,
 };
 REGISTER_BRIDGE_DRIVER(ilpcb_driver);
 
 int ilpcb_init(struct ilpcb *ctx)
 {
     ahb_init_ops(&ctx->ahb, &ilpcb_driver, &ilpcb_ops);
+    ctx->shadowed = false;
 
     return sio_init(&ctx->sio);
 }
 
 int ilpcb_destroy(struct ilpcb *ctx)
 {
+    /* Relock the SuperIO through an instance that remains valid */
+    if (ilpcb_session.user == ctx)
+        ilpcb_session_cleanup();
+
     return sio_destroy(&ctx->sio);
 }
 
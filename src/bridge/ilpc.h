@@ -7,6 +7,7 @@
 #include "ahb.h"
 #include "sio.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -15,6 +16,10 @@ struct ilpcb
 {
     struct ahb ahb;
     struct sio sio;
+    /* Shadows of the address and access size registers, valid once entered */
+    bool shadowed;
+    uint32_t addr;
+    uint8_t size;
 };
 
 int ilpcb_init(struct ilpcb *ctx);
@@ -33,4 +38,10 @@ ssize_t ilpcb_write(struct ahb *ahb, uint32_t addr, const void *buf, size_t len)
 int ilpcb_readl(struct ahb *ahb, uint32_t addr, uint32_t *val);
 int ilpcb_writel(struct ahb *ahb, uint32_t addr, uint32_t val);
 
+int ilpcb_submit(struct ahb *ahb, struct ahb_op *ops, size_t n);
+
+/* Keep the SuperIO unlocked and iLPC2AHB selected across a sequence of accesses */
+int ilpcb_begin(struct ahb *ahb);
+void ilpcb_end(struct ahb *ahb);
+
 #endif
@@ -5,65 +5,123 @@
 #include "compiler.h"
 #include "l2a.h"
 #include "log.h"
+#include "stats.h"
 
 #include "ccan/container_of/container_of.h"
 
+#include <endian.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #define LPC_HICR7               0x1e789088
 #define LPC_HICR8               0x1e78908c
+#define L2AB_WINDOW_MIN         (1 << 16)
 #define L2AB_WINDOW_SIZE        (1 << 27)
 
 #define to_l2ab(ahb) container_of(ahb, struct l2ab, ahb)
 
-/* @return The LPC FW offset mapped to phys */
-int64_t l2ab_map(struct l2ab *ctx, uint32_t phys, size_t len)
+/*
+ * LPC FW space beyond the window belongs to the host firmware (hiomapd,
+ * skiboot), and the host may only be able to reach part of it. The window
+ * must also be aligned to its size in LPC FW space.
+ */
+static inline size_t l2ab_window_max(struct l2ab *ctx)
+{
+    size_t max = L2AB_WINDOW_SIZE;
+
+    if (ctx->fw.len && ctx->fw.len < max)
+        max = (size_t)1 << (63 - __builtin_clzll(ctx->fw.len));
+
+    if (ctx->fw.base && (ctx->fw.base & -ctx->fw.base) < max)
+        max = ctx->fw.base & -ctx->fw.base;
+
+    return max;
+}
+
+static inline bool l2ab_mapped(struct l2ab *ctx, uint32_t phys)
+{
+    return ctx->len && phys >= ctx->phys && phys - ctx->phys < ctx->len;
+}
+
+/*
+ * Due to the structure of HICR8 a window is a power of 2 of at least 2^16
+ * bytes, and we keep it naturally aligned. Moving it costs two iLPC2AHB writes,
+ * so a sequential stream gets the largest window containing phys. Otherwise
+ * the window is the smallest that contains the whole access where one can.
+ */
+static uint32_t l2ab_plan(struct l2ab *ctx, uint32_t phys, size_t len,
+                          size_t *size)
+{
+    uint64_t end = (uint64_t)phys + len;
+    size_t max = l2ab_window_max(ctx);
+    size_t window;
+
+    if (phys == ctx->next) {
+        window = max;
+    } else {
+        window = L2AB_WINDOW_MIN;
+        while (window < max &&
+                (phys & ~(uint32_t)(window - 1)) + (uint64_t)window < end)
+            window <<= 1;
+    }
+
+    *size = window;
+
+    return phys & ~(uint32_t)(window - 1);
+}
+
+/*
+ * Map the window over phys, reusing the current mapping where it contains phys.
+ * len is reduced to the length that can be accessed through the window, so an
+ * access straddling the end of the window only moves it for the remainder.
+ *
+ * @return The LPC FW offset mapped to phys
+ */
+int64_t l2ab_map(struct l2ab *ctx, uint32_t phys, size_t *len)
 {
     struct ilpcb *ilpcb = &ctx->ilpcb;
-    uint32_t aligned = phys & ~0xffff;
     uint32_t hicr7, hicr8;
+    uint32_t window;
+    uint64_t avail;
+    size_t size;
     int rc;
 
-    /* Check if the requested phys/len fit inside the current mapping */
-    if (phys >= ctx->phys && (phys + len) <= (ctx->phys + ctx->len))
-        return phys - ctx->phys;
+    ctx->maps++;
 
-    /* Check if we'd intersect hiomapd/skiboot territory */
-    if (len > L2AB_WINDOW_SIZE)
-        return -EINVAL;
+    if (!l2ab_mapped(ctx, phys)) {
+        window = l2ab_plan(ctx, phys, *len, &size);
+        /* Map the window to the start of the LPC FW space we can reach */
+        hicr7 = window | (ctx->fw.base >> 16);
+        hicr8 = (~(size - 1)) | ((size - 1) >> 16);
 
-    /* Expand length to account for alignment */
-    if (len < (phys + len - aligned))
-        len = phys + len - aligned;
+        /* The shadow is unknown until both registers are written */
+        ctx->len = 0;
 
-    /*
-     * Open a window sized to the nearest power of 2 greater than len that is
-     * at least 2^16 bytes, due to the structure of HICR8.
-     */
-    if (len < (1 << 16))
-        len = (1 << 16);
+        rc = ilpcb_writel(ilpcb_as_ahb(ilpcb), LPC_HICR7, hicr7);
+        if (rc)
+            return rc;
 
-    if (__builtin_popcount(len) != 1)
-        len = 1 << (31 - __builtin_clz(len));
+        rc = ilpcb_writel(ilpcb_as_ahb(ilpcb), LPC_HICR8, hicr8);
+        if (rc)
+            return rc;
 
-    hicr7 = (phys & ~(0xffff));
-    hicr8 = (~(len - 1)) | ((len - 1) >> 16);
+        ctx->phys = window;
+        ctx->len = size;
+        ctx->remaps++;
+        stats_count(stats_l2a_remap);
+    }
 
-    rc = ilpcb_writel(ilpcb_as_ahb(ilpcb), LPC_HICR7, hicr7);
-    if (rc)
-        return rc;
+    avail = (uint64_t)ctx->phys + ctx->len - phys;
+    if (*len > avail)
+        *len = avail;
 
-    rc = ilpcb_writel(ilpcb_as_ahb(ilpcb), LPC_HICR8, hicr8);
-    if (rc)
-        return rc;
-
-    ctx->phys = hicr7; /* This is correct as we're mapping to 0 in LPC FW */
-    ctx->len = len;
+    ctx->next = phys + *len;
 
-    return phys & 0xffff;
+    return phys - ctx->phys;
 }
 
 ssize_t l2ab_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
@@ -72,15 +130,16 @@ ssize_t l2ab_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
     size_t remaining = len;
     ssize_t ingress;
     int64_t offset;
+    size_t chunk;
 
     do {
-        ingress = remaining > L2AB_WINDOW_SIZE ? L2AB_WINDOW_SIZE : remaining;
+        chunk = remaining;
 
-        offset = l2ab_map(ctx, phys, ingress);
+        offset = l2ab_map(ctx, phys, &chunk);
         if (offset < 0)
             return offset;
 
-        ingress = lpc_read(&ctx->fw, offset, buf, ingress);
+        ingress = lpc_read(&ctx->fw, offset, buf, chunk);
         if (ingress < 0)
             return ingress;
 
@@ -98,15 +157,16 @@ ssize_t l2ab_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
     size_t remaining = len;
     ssize_t egress;
     int64_t offset;
+    size_t chunk;
 
     do {
-        egress = remaining > L2AB_WINDOW_SIZE ? L2AB_WINDOW_SIZE : remaining;
+        chunk = remaining;
 
-        offset = l2ab_map(ctx, phys, egress);
+        offset = l2ab_map(ctx, phys, &chunk);
         if (offset < 0)
             return offset;
 
-        egress = lpc_write(&ctx->fw, offset, buf, egress);
+        egress = lpc_write(&ctx->fw, offset, buf, chunk);
         if (egress < 0)
             return egress;
 
@@ -130,11 +190,48 @@ int l2ab_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
     return ilpcb_writel(ilpcb_as_ahb(&ctx->ilpcb), phys, val);
 }
 
+/*
+ * Register accesses go via the iLPC bridge, so hand runs of them over in one
+ * go to avoid cycling the SuperIO lock for each access.
+ */
+int l2ab_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
+{
+    struct l2ab *ctx = to_l2ab(ahb);
+    size_t i, j;
+    int rc;
+
+    for (i = 0; i < n; i = j) {
+        for (j = i; j < n; j++) {
+            if (ops[j].type != ahb_op_readl && ops[j].type != ahb_op_writel)
+                break;
+        }
+
+        if (j > i) {
+            rc = ilpcb_submit(ilpcb_as_ahb(&ctx->ilpcb), &ops[i], j - i);
+        } else {
+            rc = ahb_submit_fallback(ahb, &ops[i], 1);
+            j = i + 1;
+        }
+
+        if (rc)
+            goto cancel;
+    }
+
+    return 0;
+
+cancel:
+    for (; j < n; j++)
+        ops[j].rc = -ECANCELED;
+
+    return rc;
+}
+
 static const struct ahb_ops l2ab_ahb_ops = {
     .read = l2ab_read,
     .write = l2ab_write,
     .readl = l2ab_readl,
     .writel = l2ab_writel,
+    .submit = l2ab_submit,
 };
 
 static int l2ab_save_hicr78(struct l2ab *ctx)
@@ -154,6 +251,9 @@ static int l2ab_restore_hicr78(struct l2ab *ctx)
     struct ilpcb *ilpcb = &ctx->ilpcb;
     int rc;
 
+    /* The window is no longer ours */
+    ctx->len = 0;
+
     rc = ilpcb_writel(ilpcb_as_ahb(ilpcb), LPC_HICR8, ctx->restore8);
     if (rc)
         return rc;
@@ -161,10 +261,40 @@ static int l2ab_restore_hicr78(struct l2ab *ctx)
     return ilpcb_writel(ilpcb_as_ahb(ilpcb), LPC_HICR7, ctx->restore7);
 }
 
+/*
+ * Nothing guarantees that the LPC FW space we can reach is that of the BMC, so
+ * compare a register read through the window with the same register read over
+ * iLPC2AHB. HICR7 is used as the value read depends on the window itself.
+ */
+static int l2ab_check_window(struct l2ab *ctx)
+{
+    uint32_t direct, windowed;
+    ssize_t rc;
+
+    rc = l2ab_read(l2ab_as_ahb(ctx), LPC_HICR7, &windowed, sizeof(windowed));
+    if (rc < 0)
+        return rc;
+
+    rc = ilpcb_readl(ilpcb_as_ahb(&ctx->ilpcb), LPC_HICR7, &direct);
+    if (rc)
+        return rc;
+
+    windowed = le32toh(windowed);
+    if (windowed != direct) {
+        loge("l2a: Read 0x%08" PRIx32 " from HICR7 through LPC FW space but 0x%08" PRIx32 " over iLPC2AHB, is the LPC FW window correct?\n",
+             windowed, direct);
+        return -ENODEV;
+    }
+
+    return 0;
+}
+
 static struct ahb *l2ab_driver_probe(int argc, char *argv[]);
 static void l2ab_driver_destroy(struct ahb *ahb);
 static int l2ab_driver_release(struct ahb *ahb);
 static int l2ab_driver_reinit(struct ahb *ahb);
+static int l2ab_driver_begin(struct ahb *ahb);
+static void l2ab_driver_end(struct ahb *ahb);
 
 static struct bridge_driver l2ab_driver = {
     .name = "l2a",
@@ -172,6 +302,9 @@ static struct bridge_driver l2ab_driver = {
     .destroy = l2ab_driver_destroy,
     .reinit = l2ab_driver_reinit,
     .release = l2ab_driver_release,
+    .begin = l2ab_driver_begin,
+    .end = l2ab_driver_end,
+    .resources = BRIDGE_RES_SUPERIO,
 };
 REGISTER_BRIDGE_DRIVER(l2ab_driver);
 
@@ -196,10 +329,22 @@ int l2ab_init(struct l2ab *ctx)
     if (rc)
         goto cleanup;
 
+    ctx->len = 0;
+    ctx->next = 0;
+    ctx->maps = 0;
+    ctx->remaps = 0;
+
     ahb_init_ops(&ctx->ahb, &l2ab_driver, &l2ab_ahb_ops);
 
+    rc = l2ab_check_window(ctx);
+    if (rc)
+        goto cleanup_hicr78;
+
     return 0;
 
+cleanup_hicr78:
+    l2ab_restore_hicr78(ctx);
+
 cleanup:
     ilpcb_destroy(ilpcb);
     lpc_destroy(&ctx->fw);
@@ -211,6 +356,9 @@ int l2ab_destroy(struct l2ab *ctx)
 {
     int rc;
 
+    logd("l2a: Moved the window %lu times for %lu transfers\n", ctx->remaps,
+         ctx->maps);
+
     rc = l2ab_restore_hicr78(ctx);
     if (rc)
         return rc;
@@ -272,3 +420,14 @@ static int l2ab_driver_reinit(struct ahb *ahb)
 {
     return l2ab_save_hicr78(to_l2ab(ahb));
 }
+
+/* Window moves are made through iLPC2AHB */
+static int l2ab_driver_begin(struct ahb *ahb)
+{
+    return ilpcb_begin(ilpcb_as_ahb(&to_l2ab(ahb)->ilpcb));
+}
+
+static void l2ab_driver_end(struct ahb *ahb)
+{
+    ilpcb_end(ilpcb_as_ahb(&to_l2ab(ahb)->ilpcb));
+}
@@ -15,8 +15,13 @@ struct l2ab {
     struct ahb ahb;
     struct lpc fw;
     struct ilpcb ilpcb;
+    /* The current window, if len is non-zero */
     uint32_t phys;
     size_t len;
+    /* Where a sequential access would start */
+    uint32_t next;
+    unsigned long maps;
+    unsigned long remaps;
     uint32_t restore7;
     uint32_t restore8;
 };
@@ -24,7 +29,7 @@ struct l2ab {
 int l2ab_init(struct l2ab *ctx);
 int l2ab_destroy(struct l2ab *ctx);
 
-int64_t l2ab_map(struct l2ab *ctx, uint32_t phys, size_t len);
+int64_t l2ab_map(struct l2ab *ctx, uint32_t phys, size_t *len);
 
 static inline struct ahb *l2ab_as_ahb(struct l2ab *ctx)
 {
@@ -37,4 +42,6 @@ ssize_t l2ab_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len);
 int l2ab_readl(struct ahb *ahb, uint32_t phys, uint32_t *val);
 int l2ab_writel(struct ahb *ahb, uint32_t phys, uint32_t val);
 
+int l2ab_submit(struct ahb *ahb, struct ahb_op *ops, size_t n);
+
 #endif
@@ -3,6 +3,7 @@
 // Copyright (C) 2021, Oracle and/or its affiliates.
 
 #include "ahb.h"
+#include "array.h"
 #include "bridge.h"
 #include "compiler.h"
 #include "log.h"
@@ -11,6 +12,7 @@
 #include "p2a.h"
 #include "pci.h"
 #include "rev.h"
+#include "stats.h"
 
 #include "ccan/container_of/container_of.h"
 
@@ -18,7 +20,9 @@
 #include <endian.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -31,6 +35,22 @@
 #define P2AB_WINDOW_BASE        0x10000
 #define P2AB_WINDOW_LEN         0x10000
 
+/* Writes are posted, so wider writes gain little and are left at 32 bits */
+#define P2AB_WRITE_WIDTH        4
+
+#define P2AB_WIDTH_PROBE_LEN    64
+
+/*
+ * Memory that reads without side-effects and is unlikely to change while we
+ * probe, in order of preference: the start of SRAM, then of DRAM. Unlike the
+ * flash window, reads don't depend on the state of the flash controller.
+ */
+static const uint32_t p2ab_width_probes[][2] = {
+    [ast_g4] = { 0x1e720000, 0x40000000 },
+    [ast_g5] = { 0x1e720000, 0x80000000 },
+    [ast_g6] = { 0x10000000, 0x80000000 },
+};
+
 #define to_p2ab(ahb) container_of(ahb, struct p2ab, ahb)
 
 static int __p2ab_readl(struct p2ab *ctx, size_t addr, uint32_t *val)
@@ -75,6 +95,72 @@ static inline int p2ab_lock(struct p2ab *ctx)
     return rc;
 }
 
+/* Data where a wide read returning the wrong words would be noticed */
+static bool p2ab_width_probe_usable(const uint8_t *data, size_t len)
+{
+    size_t i;
+
+    for (i = 4; i < len; i += 4) {
+        if (memcmp(data, data + i, 4))
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Each MMIO read is a PCIe round-trip, so bulk reads are much faster with
+ * wider accesses. Not every bridge revision is known to handle them, so only
+ * use widths that return the same data as 32-bit reads, from memory whose
+ * words differ so that dropped or repeated words are detected.
+ */
+static void p2ab_probe_width(struct p2ab *ctx, uint32_t rev)
+{
+    const uint32_t *probes = p2ab_width_probes[rev_generation(rev)];
+    uint8_t before[P2AB_WIDTH_PROBE_LEN];
+    uint8_t after[P2AB_WIDTH_PROBE_LEN];
+    uint8_t wide[P2AB_WIDTH_PROBE_LEN];
+    volatile void *win = NULL;
+    size_t width;
+    int64_t rc;
+    size_t i;
+
+    ctx->width = 4;
+
+    for (i = 0; i < ARRAY_SIZE(p2ab_width_probes[0]); i++) {
+        if ((rc = p2ab_map(ctx, probes[i], sizeof(wide))) < 0)
+            return;
+
+        win = ctx->mmio + P2AB_WINDOW_BASE + rc;
+        mmio_read(before, win, sizeof(before), 4);
+
+        if (p2ab_width_probe_usable(before, sizeof(before)))
+            break;
+
+        win = NULL;
+    }
+
+    if (!win) {
+        logd("%s: No suitable data to probe MMIO read widths\n",
+             ctx->ahb.drv->name);
+        return;
+    }
+
+    for (width = 8; width <= mmio_cpu_width(); width <<= 1) {
+        mmio_read(wide, win, sizeof(wide), width);
+        mmio_read(after, win, sizeof(after), 4);
+
+        if (memcmp(before, after, sizeof(before)) ||
+                memcmp(before, wide, sizeof(wide)))
+            break;
+
+        ctx->width = width;
+    }
+
+    logd("%s: Using MMIO reads of up to %zu bytes\n", ctx->ahb.drv->name,
+         ctx->width);
+}
+
 int p2ab_probe(struct p2ab *ctx)
 {
     int64_t rc;
@@ -85,7 +171,9 @@ int p2ab_probe(struct p2ab *ctx)
     if (rc < 0)
         return rc;
 
-    return rc < 0 ? rc : 1;
+    p2ab_probe_width(ctx, rc);
+
+    return 1;
 }
 
 int64_t p2ab_map(struct p2ab *ctx, uint32_t phys, size_t len __unused)
@@ -106,6 +194,7 @@ int64_t p2ab_map(struct p2ab *ctx, uint32_t phys, size_t len __unused)
         return rc;
 
     ctx->rbar = rbar;
+    stats_count(stats_p2a_remap);
 
     return offset;
 }
@@ -124,7 +213,7 @@ ssize_t p2ab_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
         if (rc < 0)
             return rc;
 
-        mmio_memcpy(buf, (ctx->mmio + P2AB_WINDOW_BASE + rc), ingress);
+        mmio_read(buf, (ctx->mmio + P2AB_WINDOW_BASE + rc), ingress, ctx->width);
         phys += ingress;
         buf += ingress;
         remaining -= ingress;
@@ -147,7 +236,8 @@ ssize_t p2ab_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
         if (rc < 0)
             return rc;
 
-        mmio_memcpy((ctx->mmio + P2AB_WINDOW_BASE + rc), buf, egress);
+        mmio_write((ctx->mmio + P2AB_WINDOW_BASE + rc), buf, egress,
+                   P2AB_WRITE_WIDTH);
         phys += egress;
         buf += egress;
         remaining -= egress;
@@ -197,8 +287,47 @@ static const struct ahb_ops p2ab_ahb_ops = {
     .write = p2ab_write,
     .readl = p2ab_readl,
     .writel = p2ab_writel,
+    .submit = p2ab_submit,
 };
 
+/*
+ * Each access outside the current window costs an RBAR write, so execute the
+ * batch in the order that moves the window the least.
+ */
+int p2ab_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
+{
+    struct p2ab *ctx = to_p2ab(ahb);
+    struct ahb_op *inline_order[AHB_BATCH_MAX];
+    struct ahb_op **order = inline_order;
+    unsigned int moves;
+    size_t i;
+    int rc = 0;
+
+    if (n > AHB_BATCH_MAX && !(order = malloc(n * sizeof(*order))))
+        return ahb_submit_fallback(ahb, ops, n);
+
+    moves = ahb_schedule_windowed(ops, n, P2AB_RBAR_REMAP_MASK, ctx->rbar,
+                                  order);
+    logt("p2a: Executing %zu ops with %u window moves\n", n, moves);
+
+    for (i = 0; i < n; i++)
+        ops[i].rc = -ECANCELED;
+
+    for (i = 0; i < n; i++) {
+        if ((rc = ahb_op_call(ahb, &p2ab_ahb_ops, order[i])) < 0) {
+            order[i]->rc = rc;
+            break;
+        }
+
+        order[i]->rc = 0;
+    }
+
+    if (order != inline_order)
+        free(order);
+
+    return rc;
+}
+
 static struct ahb *p2ab_driver_probe(int argc, char *argv[]);
 static int p2ab_driver_reinit(struct ahb *ahb);
 static void p2ab_driver_destroy(struct ahb *ahb);
@@ -227,6 +356,8 @@ int p2ab_init(struct p2ab *ctx, uint16_t vid, uint16_t did)
         goto cleanup_pci;
     }
 
+    ctx->width = 4;
+
     /* ensure the HW and SW rbar values are in sync */
     ctx->rbar = 0;
     __p2ab_writel(ctx, P2AB_RBAR, ctx->rbar);
@@ -18,6 +18,8 @@ struct p2ab {
     int res;
     void *mmio;
     uint32_t rbar;
+    /* Widest MMIO read the bridge is known to handle */
+    size_t width;
 };
 
 int p2ab_init(struct p2ab *p2ab, uint16_t vid, uint16_t did);
@@ -37,4 +39,6 @@ ssize_t p2ab_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len);
 int p2ab_readl(struct ahb *ahb, uint32_t phys, uint32_t *val);
 int p2ab_writel(struct ahb *ahb, uint32_t phys, uint32_t val);
 
+int p2ab_submit(struct ahb *ahb, struct ahb_op *ops, size_t n);
+
 #endif
@@ -0,0 +1,314 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ahb.h"
+#include "bridge.h"
+#include "delay.h"
+#include "log.h"
+#include "record.h"
+#include "replay.h"
+
+#include "ccan/container_of/container_of.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define to_replay(ahb) container_of(ahb, struct replay, ahb)
+
+static const char *replay_op_names[] = {
+    [ahb_op_read] = "read",
+    [ahb_op_write] = "write",
+    [ahb_op_readl] = "readl",
+    [ahb_op_writel] = "writel",
+};
+
+/*
+ * Consume the next entry of the log, which must describe the same access as
+ * the one being made. On success, returns the recorded result and points data
+ * at the recorded data.
+ */
+static int replay_next(struct replay *ctx, enum ahb_op_type type,
+                       uint32_t phys, size_t len, const void **data)
+{
+    struct record_entry entry;
+    size_t data_len;
+    uint64_t ns;
+
+    if (ctx->cursor + sizeof(entry) > ctx->len) {
+        loge("replay: Log exhausted after %lu accesses, at %s of 0x%08" PRIx32 "\n",
+             ctx->index, replay_op_names[type], phys);
+        return -EIO;
+    }
+
+    memcpy(&entry, ctx->map + ctx->cursor, sizeof(entry));
+
+    data_len = le32toh(entry.len);
+    if (entry.type == ahb_op_read && (int32_t)le32toh(entry.rc) < 0)
+        data_len = 0;
+
+    if (entry.type != type || le32toh(entry.phys) != phys ||
+            le32toh(entry.len) != len) {
+        loge("replay: Access %lu diverged from the log: expected %s of %" PRIu32 " bytes at 0x%08" PRIx32 ", found %s of %zu bytes at 0x%08" PRIx32 "\n",
+             ctx->index,
+             entry.type <= ahb_op_writel ? replay_op_names[entry.type] : "?",
+             le32toh(entry.len), le32toh(entry.phys), replay_op_names[type],
+             len, phys);
+        return -EIO;
+    }
+
+    if (ctx->cursor + sizeof(entry) + data_len > ctx->len) {
+        loge("replay: Log truncated at access %lu\n", ctx->index);
+        return -EIO;
+    }
+
+    *data = ctx->map + ctx->cursor + sizeof(entry);
+    ctx->cursor += sizeof(entry) + data_len;
+    ctx->index++;
+
+    if (ctx->fixed)
+        ns = ctx->op_ns + len * ctx->byte_ns;
+    else
+        ns = le32toh(entry.dur_ns) * ctx->scale;
+
+    delay_ns(ns);
+
+    return (int32_t)le32toh(entry.rc);
+}
+
+/* Writes don't affect replay, but differing data suggests it may go astray */
+static void replay_check_write(struct replay *ctx, const void *expected,
+                               const void *actual, size_t len)
+{
+    if (ctx->diverged || !memcmp(expected, actual, len))
+        return;
+
+    logi("replay: Written data differs from the log from access %lu\n",
+         ctx->index - 1);
+    ctx->diverged = true;
+}
+
+static ssize_t replay_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct replay *ctx = to_replay(ahb);
+    const void *data;
+    int rc;
+
+    pthread_mutex_lock(&ctx->lock);
+    rc = replay_next(ctx, ahb_op_read, phys, len, &data);
+    if (rc >= 0)
+        memcpy(buf, data, len);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+static ssize_t replay_write(struct ahb *ahb, uint32_t phys, const void *buf,
+                            size_t len)
+{
+    struct replay *ctx = to_replay(ahb);
+    const void *data = NULL;
+    int rc;
+
+    pthread_mutex_lock(&ctx->lock);
+    rc = replay_next(ctx, ahb_op_write, phys, len, &data);
+    if (data)
+        replay_check_write(ctx, data, buf, len);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+static int replay_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
+{
+    struct replay *ctx = to_replay(ahb);
+    const void *data;
+    uint32_t le;
+    int rc;
+
+    pthread_mutex_lock(&ctx->lock);
+    rc = replay_next(ctx, ahb_op_readl, phys, sizeof(le), &data);
+    if (!rc) {
+        memcpy(&le, data, sizeof(le));
+        *val = le32toh(le);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+static int replay_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
+{
+    struct replay *ctx = to_replay(ahb);
+    uint32_t le = htole32(val);
+    const void *data = NULL;
+    int rc;
+
+    pthread_mutex_lock(&ctx->lock);
+    rc = replay_next(ctx, ahb_op_writel, phys, sizeof(le), &data);
+    if (data)
+        replay_check_write(ctx, data, &le, sizeof(le));
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+static const struct ahb_ops replay_ahb_ops = {
+    .read = replay_read,
+    .write = replay_write,
+    .readl = replay_readl,
+    .writel = replay_writel,
+};
+
+static struct ahb *replay_driver_probe(int argc, char *argv[]);
+static void replay_driver_destroy(struct ahb *ahb);
+
+static struct bridge_driver replay_driver = {
+    .name = "replay",
+    .probe = replay_driver_probe,
+    .destroy = replay_driver_destroy,
+};
+REGISTER_BRIDGE_DRIVER(replay_driver);
+
+/* Either a factor to scale the recorded durations by, or OP_NS:BYTE_NS */
+static int replay_parse_timing(struct replay *ctx, const char *timing)
+{
+    unsigned long long op_ns, byte_ns;
+    char *end;
+
+    ctx->fixed = false;
+    ctx->scale = 1.0;
+
+    if (!timing)
+        return 0;
+
+    if (sscanf(timing, "%llu:%llu", &op_ns, &byte_ns) == 2) {
+        ctx->fixed = true;
+        ctx->op_ns = op_ns;
+        ctx->byte_ns = byte_ns;
+        return 0;
+    }
+
+    errno = 0;
+    ctx->scale = strtod(timing, &end);
+    if (errno || *end || end == timing || ctx->scale < 0)
+        return -EINVAL;
+
+    return 0;
+}
+
+int replay_init(struct replay *ctx, const char *path, const char *timing)
+{
+    struct stat st;
+    int rc;
+
+    memset(ctx, 0, sizeof(*ctx));
+
+    if ((rc = replay_parse_timing(ctx, timing)) < 0) {
+        loge("replay: Invalid timing '%s'\n", timing);
+        return rc;
+    }
+
+    ctx->fd = open(path, O_RDONLY);
+    if (ctx->fd < 0)
+        return -errno;
+
+    if (fstat(ctx->fd, &st) < 0) {
+        rc = -errno;
+        goto cleanup_fd;
+    }
+
+    ctx->len = st.st_size;
+    if (ctx->len < strlen(RECORD_MAGIC)) {
+        rc = -EINVAL;
+        goto cleanup_fd;
+    }
+
+    ctx->map = mmap(NULL, ctx->len, PROT_READ, MAP_PRIVATE, ctx->fd, 0);
+    if (ctx->map == MAP_FAILED) {
+        rc = -errno;
+        goto cleanup_fd;
+    }
+
+    if (memcmp(ctx->map, RECORD_MAGIC, strlen(RECORD_MAGIC))) {
+        loge("replay: %s is not an AHB access log\n", path);
+        rc = -EINVAL;
+        goto cleanup_map;
+    }
+
+    ctx->cursor = strlen(RECORD_MAGIC);
+    pthread_mutex_init(&ctx->lock, NULL);
+
+    ahb_init_ops(&ctx->ahb, &replay_driver, &replay_ahb_ops);
+
+    return 0;
+
+cleanup_map:
+    munmap(ctx->map, ctx->len);
+
+cleanup_fd:
+    close(ctx->fd);
+
+    return rc;
+}
+
+int replay_destroy(struct replay *ctx)
+{
+    int rc;
+
+    if (ctx->cursor < ctx->len)
+        logi("replay: %zu bytes of the log were not replayed\n",
+             ctx->len - ctx->cursor);
+
+    pthread_mutex_destroy(&ctx->lock);
+
+    if (munmap(ctx->map, ctx->len) < 0) {
+        rc = -errno;
+        close(ctx->fd);
+        return rc;
+    }
+
+    if (close(ctx->fd) < 0)
+        return -errno;
+
+    return 0;
+}
+
+static struct ahb *replay_driver_probe(int argc, char *argv[])
+{
+    struct replay *ctx;
+    int rc;
+
+    /* replay FILE [TIMING] */
+    if (argc < 2 || argc > 3 || strcmp(argv[0], "replay"))
+        return NULL;
+
+    ctx = malloc(sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+
+    if ((rc = replay_init(ctx, argv[1], argc == 3 ? argv[2] : NULL)) < 0) {
+        loge("Failed to initialise replay bridge: %d\n", rc);
+        free(ctx);
+        return NULL;
+    }
+
+    return replay_as_ahb(ctx);
+}
+
+static void replay_driver_destroy(struct ahb *ahb)
+{
+    struct replay *ctx = to_replay(ahb);
+    int rc;
+
+    if ((rc = replay_destroy(ctx)) < 0)
+        loge("Failed to destroy replay bridge: %d\n", rc);
+
+    free(ctx);
+}
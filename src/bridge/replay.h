@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _BRIDGE_REPLAY_H
+#define _BRIDGE_REPLAY_H
+
+#include "ahb.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct replay {
+    struct ahb ahb;
+    pthread_mutex_t lock;
+    int fd;
+    uint8_t *map;
+    size_t len;
+    size_t cursor;
+    unsigned long index;
+    /* Either scale the recorded durations, or charge a fixed cost per access */
+    double scale;
+    bool fixed;
+    uint64_t op_ns;
+    uint64_t byte_ns;
+    bool diverged;
+};
+
+int replay_init(struct replay *ctx, const char *path, const char *timing);
+int replay_destroy(struct replay *ctx);
+
+static inline struct ahb *replay_as_ahb(struct replay *ctx)
+{
+    return &ctx->ahb;
+}
+
+#endif
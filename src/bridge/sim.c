@@ -0,0 +1,793 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ahb.h"
+#include "array.h"
+#include "bridge.h"
+#include "compiler.h"
+#include "delay.h"
+#include "flash.h"
+#include "log.h"
+#include "sim.h"
+#include "soc/sfc.h"
+
+#include "ccan/container_of/container_of.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_MAGIC               "culvsim1"
+#define SIM_STATE_LEN           4096
+
+#define SIM_IO                  0x1e600000
+#define SIM_IO_LEN              0x00200000
+#define SIM_SRAM_LEN            (64 * 1024)
+#define SIM_FLASH               0x20000000
+#define SIM_FLASH_WIN_LEN       0x10000000
+#define SIM_FLASH_LEN           (32 << 20)
+
+/* Register offsets within the IO region */
+#define SIM_AHBC_CSR            0x00040
+#define   SIM_AHBC_CSR_POLL_EN  (1 << 0)
+#define   SIM_AHBC_CSR_POLL_MODE (1 << 1)
+#define SIM_AHBC_BUF            0x00044
+#define   SIM_AHBC_BUF_WRAP     (1 << 0)
+#define SIM_AHBC_ADDR           0x00048
+#define SIM_AHBC_MERGE          0x0005c
+#define SIM_FMC_CE0_CTRL        0x20010
+#define SIM_SDMC_PROT_KEY       0xe0000
+#define   SIM_SDMC_PASSWORD     0xfc600309
+#define SIM_SDMC_CONFIG         0xe0004
+#define SIM_SDMC_GMP            0xe0008
+#define SIM_SDMC_LEN            0x00200
+#define SIM_SCU_PROT_KEY        0xe2000
+#define   SIM_SCU_PASSWORD      0x1688a8a8
+#define SIM_SCU_RESET           0xe2004
+#define SIM_SCU_REV_G6          0xe2014
+#define SIM_SCU_STRAP           0xe2070
+#define SIM_SCU_REV             0xe207c
+
+/* The "EMULATED_FLASH" entry of the flash chip table */
+#define SIM_NOR_ID              0xaa55aa
+
+/* Typical datasheet timings for program and erase operations */
+#define SIM_NOR_PP_NS           (700 * 1000ULL)
+#define SIM_NOR_WRSR_NS         (5 * 1000 * 1000ULL)
+#define SIM_NOR_SE_NS           (45 * 1000 * 1000ULL)
+#define SIM_NOR_BE32K_NS        (150 * 1000 * 1000ULL)
+#define SIM_NOR_BE_NS           (300 * 1000 * 1000ULL)
+#define SIM_NOR_CE_NS           (20 * 1000 * 1000 * 1000ULL)
+
+#define SIM_NOR_WRDI            0x04
+
+#define to_sim(ahb) container_of(ahb, struct sim, ahb)
+
+struct sim_model {
+    const char *name;
+    uint32_t rev;
+    uint32_t scu_reset;
+    /* MCR04 as left by the bootloader: the smallest DRAM, 16MiB of VRAM */
+    uint32_t sdmc_config;
+    uint32_t dram;
+    uint32_t dram_len;
+    /* SRAM outside of the IO region, if any */
+    uint32_t sram;
+};
+
+static const struct sim_model sim_models[] = {
+    {
+        .name = "ast2400",
+        .rev = 0x02010303,
+        .scu_reset = 0xfc000000,
+        .sdmc_config = 0x00000004,
+        .dram = 0x40000000,
+        .dram_len = 64 << 20,
+    },
+    {
+        .name = "ast2500",
+        .rev = 0x04030303,
+        .scu_reset = 0xf4000000,
+        .sdmc_config = 0x00000004,
+        .dram = 0x80000000,
+        .dram_len = 128 << 20,
+    },
+    {
+        .name = "ast2600",
+        .rev = 0x05030303,
+        .sdmc_config = 0x00000004,
+        .dram = 0x80000000,
+        .dram_len = 256 << 20,
+        .sram = 0x10000000,
+    },
+};
+
+/* Rough per-access costs of the real bridges */
+static const struct sim_profile sim_profiles[] = {
+    { "none", 0, 0 },
+    { "devmem", 200, 1 },
+    { "p2a", 1500, 250 },
+    { "l2a", 5000, 700 },
+    { "ilpc", 40000, 10000 },
+    { "debug", 2000000, 180000 },
+};
+
+static inline bool sim_is_g6(struct sim *ctx)
+{
+    return (ctx->model->rev >> 24) == 0x05;
+}
+
+static uint64_t sim_now(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sim_delay(struct sim *ctx, size_t len)
+{
+    delay_ns(ctx->profile.op_ns + len * ctx->profile.byte_ns);
+}
+
+static inline uint32_t sim_io_readl(struct sim *ctx, uint32_t off)
+{
+    uint32_t val;
+
+    memcpy(&val, ctx->io + off, sizeof(val));
+
+    return le32toh(val);
+}
+
+static inline void sim_io_writel(struct sim *ctx, uint32_t off, uint32_t val)
+{
+    val = htole32(val);
+    memcpy(ctx->io + off, &val, sizeof(val));
+}
+
+static bool sim_nor_busy(struct sim *ctx)
+{
+    return sim_now(CLOCK_REALTIME) < ctx->state->nor.busy_until;
+}
+
+static uint32_t sim_nor_addr(struct sim_nor *nor)
+{
+    uint32_t addr = 0;
+    int i, n = nor->addr4 ? 4 : 3;
+
+    for (i = 0; i < n; i++)
+        addr = (addr << 8) | nor->buf[1 + i];
+
+    return addr % SIM_FLASH_LEN;
+}
+
+static void sim_nor_start(struct sim *ctx, uint64_t ns)
+{
+    struct sim_nor *nor = &ctx->state->nor;
+
+    nor->status &= ~STAT_WEN;
+    nor->busy_until = sim_now(CLOCK_REALTIME) + ns;
+}
+
+static void sim_nor_erase(struct sim *ctx, uint32_t size, uint64_t ns)
+{
+    struct sim_nor *nor = &ctx->state->nor;
+    uint32_t base;
+
+    base = sim_nor_addr(nor) & ~(size - 1);
+    memset(ctx->flash + base, 0xff, size);
+
+    sim_nor_start(ctx, ns);
+}
+
+/* Called when CE# is deasserted to perform the command clocked in */
+static void sim_nor_execute(struct sim *ctx)
+{
+    struct sim_nor *nor = &ctx->state->nor;
+    uint32_t alen = nor->addr4 ? 4 : 3;
+    uint32_t len = nor->len < SIM_NOR_BUF ? nor->len : SIM_NOR_BUF;
+
+    if (!len || sim_nor_busy(ctx))
+        return;
+
+    switch (nor->buf[0]) {
+    case CMD_WREN:
+        nor->status |= STAT_WEN;
+        return;
+    case SIM_NOR_WRDI:
+        nor->status &= ~STAT_WEN;
+        return;
+    case CMD_EN4B:
+        nor->addr4 = true;
+        return;
+    case CMD_EX4B:
+        nor->addr4 = false;
+        return;
+    }
+
+    /* Everything else modifies the chip and requires write-enable */
+    if (!(nor->status & STAT_WEN))
+        return;
+
+    switch (nor->buf[0]) {
+    case CMD_WRSR:
+        if (len > 1)
+            nor->status = nor->buf[1] & ~(STAT_WIP | STAT_WEN);
+        if (len > 2)
+            nor->config = nor->buf[2];
+        sim_nor_start(ctx, SIM_NOR_WRSR_NS);
+        break;
+    case CMD_PP:
+    {
+        uint32_t addr, i;
+
+        if (len <= 1 + alen)
+            break;
+
+        /* Programming wraps within the page and can only clear bits */
+        addr = sim_nor_addr(nor);
+        for (i = 0; i < len - 1 - alen; i++) {
+            uint32_t dst = (addr & ~0xffU) | ((addr + i) & 0xff);
+
+            ctx->flash[dst] &= nor->buf[1 + alen + i];
+        }
+
+        sim_nor_start(ctx, SIM_NOR_PP_NS);
+        break;
+    }
+    case CMD_SE:
+        sim_nor_erase(ctx, 4 << 10, SIM_NOR_SE_NS);
+        break;
+    case CMD_BE32K:
+        sim_nor_erase(ctx, 32 << 10, SIM_NOR_BE32K_NS);
+        break;
+    case CMD_BE:
+        sim_nor_erase(ctx, 64 << 10, SIM_NOR_BE_NS);
+        break;
+    case CMD_CE:
+    case CMD_MIC_BULK_ERASE:
+        memset(ctx->flash, 0xff, SIM_FLASH_LEN);
+        sim_nor_start(ctx, SIM_NOR_CE_NS);
+        break;
+    default:
+        logd("sim: Ignoring unsupported flash command 0x%02x\n", nor->buf[0]);
+        break;
+    }
+}
+
+static uint8_t sim_nor_out(struct sim *ctx)
+{
+    static const uint8_t id[] = {
+        (SIM_NOR_ID >> 16) & 0xff, (SIM_NOR_ID >> 8) & 0xff, SIM_NOR_ID & 0xff
+    };
+    struct sim_nor *nor = &ctx->state->nor;
+    bool busy = sim_nor_busy(ctx);
+    uint32_t out = nor->out++;
+    uint8_t cmd;
+
+    if (!nor->len)
+        return 0xff;
+
+    cmd = nor->buf[0];
+
+    /* Only the status can be read while an operation is in progress */
+    if (busy && cmd != CMD_RDSR && cmd != CMD_MIC_RDFLST)
+        return 0xff;
+
+    switch (cmd) {
+    case CMD_RDID:
+        return out < sizeof(id) ? id[out] : 0;
+    case CMD_RDSR:
+        return nor->status | (busy ? STAT_WIP : 0);
+    case CMD_RDCR:
+        return nor->config;
+    case CMD_MIC_RDFLST:
+        return busy ? 0x00 : 0x80;
+    case CMD_READ:
+        return ctx->flash[(sim_nor_addr(nor) + out) % SIM_FLASH_LEN];
+    default:
+        return 0xff;
+    }
+}
+
+/* Track CE# for user-mode command sequencing */
+static void sim_fmc_ctrl(struct sim *ctx, uint32_t val)
+{
+    struct sim_nor *nor = &ctx->state->nor;
+    bool active = ((val & 3) == 3) && !(val & 4);
+
+    if (active && !nor->selected) {
+        nor->selected = true;
+        nor->len = 0;
+        nor->out = 0;
+    } else if (!active && nor->selected) {
+        nor->selected = false;
+        sim_nor_execute(ctx);
+    }
+}
+
+static void sim_flash_window(struct sim *ctx, uint32_t off, void *buf,
+                             size_t len, bool write)
+{
+    struct sim_nor *nor = &ctx->state->nor;
+    uint8_t *data = buf;
+    size_t i;
+
+    /* In read mode the window maps the flash contents */
+    if ((sim_io_readl(ctx, SIM_FMC_CE0_CTRL) & 3) != 3) {
+        if (write)
+            return;
+
+        for (i = 0; i < len; i++)
+            data[i] = ctx->flash[(off + i) % SIM_FLASH_LEN];
+
+        return;
+    }
+
+    /* In user mode accesses clock bytes to and from the selected chip */
+    for (i = 0; i < len; i++) {
+        if (!nor->selected) {
+            if (!write)
+                data[i] = 0xff;
+        } else if (write) {
+            if (nor->len < SIM_NOR_BUF)
+                nor->buf[nor->len] = data[i];
+            nor->len++;
+        } else {
+            data[i] = sim_nor_out(ctx);
+        }
+    }
+}
+
+static uint32_t sim_reg_read(struct sim *ctx, uint32_t off)
+{
+    switch (off) {
+    case SIM_AHBC_MERGE:
+        return ctx->state->trace.merge;
+    case SIM_SDMC_CONFIG:
+        /* The DRAM size is strapped, the rest was set up by the bootloader */
+        return (sim_io_readl(ctx, off) & ~3) | (ctx->model->sdmc_config & 3);
+    default:
+        return sim_io_readl(ctx, off);
+    }
+}
+
+static void sim_reg_write(struct sim *ctx, uint32_t off, uint32_t val)
+{
+    bool g6 = sim_is_g6(ctx);
+
+    /* The SDMC ignores writes until unlocked, then reads back the lock state */
+    if (off >= SIM_SDMC_PROT_KEY && off < SIM_SDMC_PROT_KEY + SIM_SDMC_LEN) {
+        if (off == SIM_SDMC_PROT_KEY)
+            val = val == SIM_SDMC_PASSWORD;
+        else if (!sim_io_readl(ctx, SIM_SDMC_PROT_KEY))
+            return;
+    }
+
+    switch (off) {
+    case SIM_SCU_PROT_KEY:
+        sim_io_writel(ctx, off, val == SIM_SCU_PASSWORD);
+        return;
+    case SIM_SCU_STRAP:
+        /* Writes set strap bits on the AST2400 and AST2500 */
+        if (!g6)
+            val |= sim_io_readl(ctx, off);
+        break;
+    case SIM_SCU_REV:
+        /* ... and writes to the revision register clear them */
+        if (!g6) {
+            sim_io_writel(ctx, SIM_SCU_STRAP,
+                          sim_io_readl(ctx, SIM_SCU_STRAP) & ~val);
+            return;
+        }
+        break;
+    case SIM_FMC_CE0_CTRL:
+        sim_io_writel(ctx, off, val);
+        sim_fmc_ctrl(ctx, val);
+        return;
+    case SIM_AHBC_BUF:
+        ctx->state->trace.wrap = false;
+        val &= ~SIM_AHBC_BUF_WRAP;
+        break;
+    case SIM_AHBC_CSR:
+        if (!(sim_io_readl(ctx, off) & SIM_AHBC_CSR_POLL_EN) &&
+                (val & SIM_AHBC_CSR_POLL_EN)) {
+            ctx->state->trace.merge = 0;
+            ctx->state->trace.merge_len = 0;
+        }
+        break;
+    }
+
+    sim_io_writel(ctx, off, val);
+}
+
+static uint8_t *sim_memory(struct sim *ctx, uint32_t phys, size_t len)
+{
+    uint64_t end = (uint64_t)phys + len;
+
+    if (phys >= ctx->model->dram &&
+            end <= (uint64_t)ctx->model->dram + ctx->model->dram_len)
+        return ctx->dram + (phys - ctx->model->dram);
+
+    if (ctx->model->sram && phys >= ctx->model->sram &&
+            end <= (uint64_t)ctx->model->sram + SIM_SRAM_LEN)
+        return ctx->sram + (phys - ctx->model->sram);
+
+    if (phys >= SIM_IO && end <= (uint64_t)SIM_IO + SIM_IO_LEN)
+        return ctx->io + (phys - SIM_IO);
+
+    return NULL;
+}
+
+static int sim_access(struct sim *ctx, uint32_t phys, void *buf, size_t len,
+                      bool write)
+{
+    uint64_t end = (uint64_t)phys + len;
+    uint8_t *mem;
+
+    if (phys >= SIM_FLASH && end <= (uint64_t)SIM_FLASH + SIM_FLASH_WIN_LEN) {
+        sim_flash_window(ctx, phys - SIM_FLASH, buf, len, write);
+        return 0;
+    }
+
+    /* Word accesses to the IO region are register accesses */
+    if (phys >= SIM_IO && end <= (uint64_t)SIM_IO + SIM_IO_LEN &&
+            len == 4 && !(phys & 3)) {
+        uint32_t val;
+
+        if (write) {
+            memcpy(&val, buf, sizeof(val));
+            sim_reg_write(ctx, phys - SIM_IO, le32toh(val));
+        } else {
+            val = htole32(sim_reg_read(ctx, phys - SIM_IO));
+            memcpy(buf, &val, sizeof(val));
+        }
+
+        return 0;
+    }
+
+    if (!(mem = sim_memory(ctx, phys, len))) {
+        logd("sim: No device at 0x%08" PRIx32 " for %zu bytes\n", phys, len);
+        return -EFAULT;
+    }
+
+    if (write)
+        memcpy(mem, buf, len);
+    else
+        memcpy(buf, mem, len);
+
+    return 0;
+}
+
+/* Emulate the AHBC's capture of accesses to the watched word */
+static void sim_trace(struct sim *ctx, uint32_t phys, const void *buf,
+                      size_t len, bool write)
+{
+    static const uint8_t styles[][2] = {
+        { 1, 0 }, { 1, 1 }, { 1, 2 }, { 1, 3 }, { 2, 0 }, { 2, 2 }, { 4, 0 },
+    };
+    static const uint32_t sizes[] = {
+        4 << 10, 8 << 10, 16 << 10, 32 << 10,
+        128 << 10, 256 << 10, 512 << 10, 1024 << 10,
+    };
+    struct sim_trace *trace = &ctx->state->trace;
+    uint32_t csr, target, style, ptr, base, size;
+    const uint8_t *data;
+    unsigned int i;
+
+    csr = sim_io_readl(ctx, SIM_AHBC_CSR);
+    if (!(csr & SIM_AHBC_CSR_POLL_EN))
+        return;
+
+    if (!!(csr & SIM_AHBC_CSR_POLL_MODE) != write)
+        return;
+
+    target = sim_io_readl(ctx, SIM_AHBC_ADDR) & ~3;
+    if (target < phys || (uint64_t)target + 4 > (uint64_t)phys + len)
+        return;
+
+    style = (csr >> 4) & 7;
+    if (style >= ARRAY_SIZE(styles))
+        return;
+
+    data = (const uint8_t *)buf + (target - phys) + styles[style][1];
+
+    for (i = 0; i < styles[style][0]; i++) {
+        trace->merge |= (uint32_t)data[i] << (8 * trace->merge_len);
+        if (++trace->merge_len < 4)
+            continue;
+
+        /* A full word is pushed into the ring in SRAM */
+        size = sizes[(csr >> 8) & 7];
+        ptr = sim_io_readl(ctx, SIM_AHBC_BUF) & ~SIM_AHBC_BUF_WRAP;
+        base = ptr & ~(size - 1);
+
+        sim_access(ctx, ptr, &trace->merge, sizeof(trace->merge), true);
+
+        ptr += 4;
+        if (ptr == base + size) {
+            ptr = base;
+            trace->wrap = true;
+        }
+
+        sim_io_writel(ctx, SIM_AHBC_BUF,
+                      ptr | (trace->wrap ? SIM_AHBC_BUF_WRAP : 0));
+
+        trace->merge = 0;
+        trace->merge_len = 0;
+    }
+}
+
+static ssize_t sim_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct sim *ctx = to_sim(ahb);
+    int rc;
+
+    sim_delay(ctx, len);
+
+    if ((rc = sim_access(ctx, phys, buf, len, false)) < 0)
+        return rc;
+
+    sim_trace(ctx, phys, buf, len, false);
+
+    return len;
+}
+
+static ssize_t sim_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
+{
+    struct sim *ctx = to_sim(ahb);
+    int rc;
+
+    sim_delay(ctx, len);
+
+    if ((rc = sim_access(ctx, phys, (void *)buf, len, true)) < 0)
+        return rc;
+
+    sim_trace(ctx, phys, buf, len, true);
+
+    return len;
+}
+
+static int sim_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
+{
+    struct sim *ctx = to_sim(ahb);
+    uint32_t le;
+    int rc;
+
+    if (phys & 3)
+        return -EINVAL;
+
+    sim_delay(ctx, sizeof(*val));
+
+    if ((rc = sim_access(ctx, phys, &le, sizeof(le), false)) < 0)
+        return rc;
+
+    sim_trace(ctx, phys, &le, sizeof(le), false);
+
+    *val = le32toh(le);
+
+    return 0;
+}
+
+static int sim_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
+{
+    struct sim *ctx = to_sim(ahb);
+    uint32_t le = htole32(val);
+    int rc;
+
+    if (phys & 3)
+        return -EINVAL;
+
+    sim_delay(ctx, sizeof(val));
+
+    if ((rc = sim_access(ctx, phys, &le, sizeof(le), true)) < 0)
+        return rc;
+
+    sim_trace(ctx, phys, &le, sizeof(le), true);
+
+    return 0;
+}
+
+static const struct ahb_ops sim_ahb_ops = {
+    .read = sim_read,
+    .write = sim_write,
+    .readl = sim_readl,
+    .writel = sim_writel,
+};
+
+static struct ahb *sim_driver_probe(int argc, char *argv[]);
+static void sim_driver_destroy(struct ahb *ahb);
+
+static struct bridge_driver sim_driver = {
+    .name = "sim",
+    .probe = sim_driver_probe,
+    .destroy = sim_driver_destroy,
+};
+REGISTER_BRIDGE_DRIVER(sim_driver);
+
+static int sim_parse_profile(struct sim_profile *profile, const char *name)
+{
+    unsigned long long op_ns, byte_ns;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(sim_profiles); i++) {
+        if (!strcmp(sim_profiles[i].name, name)) {
+            *profile = sim_profiles[i];
+            return 0;
+        }
+    }
+
+    /* Otherwise a custom profile, OP_NS:BYTE_NS */
+    if (sscanf(name, "%llu:%llu", &op_ns, &byte_ns) != 2)
+        return -EINVAL;
+
+    profile->name = "custom";
+    profile->op_ns = op_ns;
+    profile->byte_ns = byte_ns;
+
+    return 0;
+}
+
+/* Power-on state of the simulated BMC */
+static void sim_reset(struct sim *ctx)
+{
+    const struct sim_model *model = ctx->model;
+
+    memset(ctx->state, 0, sizeof(*ctx->state));
+    memcpy(ctx->state->magic, SIM_MAGIC, sizeof(ctx->state->magic));
+    ctx->state->rev = model->rev;
+
+    memset(ctx->io, 0, SIM_IO_LEN);
+    memset(ctx->sram, 0, SIM_SRAM_LEN);
+    memset(ctx->flash, 0xff, SIM_FLASH_LEN);
+
+    if (sim_is_g6(ctx)) {
+        sim_io_writel(ctx, SIM_SCU_RESET, model->rev);
+        sim_io_writel(ctx, SIM_SCU_REV_G6, model->rev);
+    } else {
+        sim_io_writel(ctx, SIM_SCU_RESET, model->scu_reset);
+        sim_io_writel(ctx, SIM_SCU_REV, model->rev);
+    }
+
+    /* Bootloaders commonly leave the SDMC unlocked */
+    sim_io_writel(ctx, SIM_SDMC_PROT_KEY, 1);
+    sim_io_writel(ctx, SIM_SDMC_CONFIG, model->sdmc_config);
+}
+
+int sim_init(struct sim *ctx, const char *model, const char *path,
+             const char *profile)
+{
+    struct stat st;
+    size_t i;
+    int rc;
+
+    memset(ctx, 0, sizeof(*ctx));
+
+    for (i = 0; i < ARRAY_SIZE(sim_models); i++) {
+        if (!strcmp(sim_models[i].name, model))
+            ctx->model = &sim_models[i];
+    }
+
+    if (!ctx->model) {
+        loge("sim: Unknown model '%s'\n", model);
+        return -EINVAL;
+    }
+
+    if ((rc = sim_parse_profile(&ctx->profile, profile ? profile : "none")) < 0) {
+        loge("sim: Unknown latency profile '%s'\n", profile);
+        return rc;
+    }
+
+    ctx->len = SIM_STATE_LEN + SIM_IO_LEN + SIM_SRAM_LEN + SIM_FLASH_LEN +
+               ctx->model->dram_len;
+
+    ctx->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (ctx->fd < 0)
+        return -errno;
+
+    if (fstat(ctx->fd, &st) < 0) {
+        rc = -errno;
+        goto cleanup_fd;
+    }
+
+    /* The file is sparse, untouched DRAM doesn't consume space */
+    if ((size_t)st.st_size < ctx->len && ftruncate(ctx->fd, ctx->len) < 0) {
+        rc = -errno;
+        goto cleanup_fd;
+    }
+
+    ctx->map = mmap(NULL, ctx->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    ctx->fd, 0);
+    if (ctx->map == MAP_FAILED) {
+        rc = -errno;
+        goto cleanup_fd;
+    }
+
+    ctx->state = ctx->map;
+    ctx->io = (uint8_t *)ctx->map + SIM_STATE_LEN;
+    ctx->sram = ctx->io + SIM_IO_LEN;
+    ctx->flash = ctx->sram + SIM_SRAM_LEN;
+    ctx->dram = ctx->flash + SIM_FLASH_LEN;
+
+    if (memcmp(ctx->state->magic, SIM_MAGIC, sizeof(ctx->state->magic)) ||
+            ctx->state->rev != ctx->model->rev) {
+        logi("sim: Initialising %s state in %s\n", ctx->model->name, path);
+        sim_reset(ctx);
+    }
+
+    /*
+     * Operations are timed against the wall clock so they survive across
+     * invocations, but a busy time beyond the longest operation can only
+     * come from the clock being stepped backwards.
+     */
+    if (ctx->state->nor.busy_until > sim_now(CLOCK_REALTIME) + SIM_NOR_CE_NS)
+        ctx->state->nor.busy_until = 0;
+
+    ahb_init_ops(&ctx->ahb, &sim_driver, &sim_ahb_ops);
+
+    logd("sim: Simulating %s with the %s latency profile\n", ctx->model->name,
+         ctx->profile.name);
+
+    return 0;
+
+cleanup_fd:
+    close(ctx->fd);
+
+    return rc;
+}
+
+int sim_destroy(struct sim *ctx)
+{
+    int rc;
+
+    if (munmap(ctx->map, ctx->len) < 0) {
+        rc = -errno;
+        close(ctx->fd);
+        return rc;
+    }
+
+    if (close(ctx->fd) < 0)
+        return -errno;
+
+    return 0;
+}
+
+static struct ahb *sim_driver_probe(int argc, char *argv[])
+{
+    struct sim *ctx;
+    int rc;
+
+    /* sim MODEL FILE [PROFILE] */
+    if (argc < 3 || argc > 4 || strcmp(argv[0], "sim"))
+        return NULL;
+
+    ctx = malloc(sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+
+    if ((rc = sim_init(ctx, argv[1], argv[2], argc == 4 ? argv[3] : NULL)) < 0) {
+        loge("Failed to initialise simulated bridge: %d\n", rc);
+        free(ctx);
+        return NULL;
+    }
+
+    return sim_as_ahb(ctx);
+}
+
+static void sim_driver_destroy(struct ahb *ahb)
+{
+    struct sim *ctx = to_sim(ahb);
+    int rc;
+
+    if ((rc = sim_destroy(ctx)) < 0)
+        loge("Failed to destroy simulated bridge: %d\n", rc);
+
+    free(ctx);
+}
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _BRIDGE_SIM_H
+#define _BRIDGE_SIM_H
+
+#include "ahb.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Enough for a page program command with a 4-byte address */
+#define SIM_NOR_BUF     272
+
+/* State of the emulated SPI NOR attached to FMC CE0 */
+struct sim_nor {
+    uint8_t status;
+    uint8_t config;
+    bool addr4;
+    bool selected;
+    /* CLOCK_REALTIME time in ns at which the current operation completes */
+    uint64_t busy_until;
+    uint32_t len;
+    uint32_t out;
+    uint8_t buf[SIM_NOR_BUF];
+};
+
+/* Trace engine state that isn't visible in the AHBC registers */
+struct sim_trace {
+    uint32_t merge;
+    uint32_t merge_len;
+    bool wrap;
+};
+
+/*
+ * Lives at the start of the backing file so the simulated BMC persists
+ * across invocations, and so concurrent invocations (such as a trace and the
+ * accesses being traced) observe the same state.
+ */
+struct sim_state {
+    char magic[8];
+    uint32_t rev;
+    struct sim_nor nor;
+    struct sim_trace trace;
+};
+
+struct sim_model;
+
+struct sim_profile {
+    const char *name;
+    /* Cost of each access, and the additional cost per byte transferred */
+    uint64_t op_ns;
+    uint64_t byte_ns;
+};
+
+struct sim {
+    struct ahb ahb;
+    const struct sim_model *model;
+    struct sim_profile profile;
+    int fd;
+    void *map;
+    size_t len;
+    struct sim_state *state;
+    uint8_t *io;
+    uint8_t *sram;
+    uint8_t *flash;
+    uint8_t *dram;
+};
+
+int sim_init(struct sim *ctx, const char *model, const char *path,
+             const char *profile);
+int sim_destroy(struct sim *ctx);
+
+static inline struct ahb *sim_as_ahb(struct sim *ctx)
+{
+    return &ctx->ahb;
+}
+
+#endif
@@ -0,0 +1,358 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "cache.h"
+#include "log.h"
+
+#include "ccan/container_of/container_of.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Larger reads are streamed through without allocating to avoid thrashing */
+#define CACHE_ALLOC_MAX         ((CACHE_PAGES * CACHE_PAGE_SIZE) / 4)
+
+#define to_cache(ahb) container_of(ahb_layer_from_ahb(ahb), struct cache, layer)
+
+static inline uint32_t cache_page_base(uint32_t phys)
+{
+    return phys & ~(CACHE_PAGE_SIZE - 1);
+}
+
+static inline uint8_t *cache_page_data(struct cache *ctx, struct cache_page *page)
+{
+    return ctx->data + (page - &ctx->pages[0]) * CACHE_PAGE_SIZE;
+}
+
+static bool cache_page_cacheable(struct cache *ctx, uint32_t base)
+{
+    uint64_t end = (uint64_t)base + CACHE_PAGE_SIZE;
+    bool cacheable = false;
+    int i;
+
+    for (i = 0; i < CACHE_REGIONS; i++) {
+        struct cache_region *region = &ctx->regions[i];
+
+        if (!region->refs)
+            continue;
+
+        /* Any overlap with an uncacheable region disqualifies the page */
+        if (!region->cacheable) {
+            if (base < region->start + region->len && end > region->start)
+                return false;
+            continue;
+        }
+
+        if (base >= region->start && end <= region->start + region->len)
+            cacheable = true;
+    }
+
+    return cacheable;
+}
+
+static struct cache_page *cache_lookup(struct cache *ctx, uint32_t base)
+{
+    uint32_t pfn = base >> CACHE_PAGE_SHIFT;
+    struct cache_page *page = &ctx->pages[pfn % CACHE_PAGES];
+
+    return (page->valid && page->tag == pfn) ? page : NULL;
+}
+
+static struct cache_page *cache_fill(struct cache *ctx, uint32_t base)
+{
+    uint32_t pfn = base >> CACHE_PAGE_SHIFT;
+    struct cache_page *page = &ctx->pages[pfn % CACHE_PAGES];
+    ssize_t rc;
+
+    page->valid = false;
+
+    rc = ahb_read(ctx->layer.lower, base, cache_page_data(ctx, page), CACHE_PAGE_SIZE);
+    if (rc < 0) {
+        errno = -rc;
+        return NULL;
+    }
+
+    page->tag = pfn;
+    page->valid = true;
+    ctx->misses++;
+
+    return page;
+}
+
+/* Whether the page containing @phys will be served from the cache */
+static bool cache_serves(struct cache *ctx, uint32_t phys, bool allocate)
+{
+    uint32_t base = cache_page_base(phys);
+
+    if (!cache_page_cacheable(ctx, base))
+        return false;
+
+    return allocate || cache_lookup(ctx, base);
+}
+
+static ssize_t cache_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct cache *ctx = to_cache(ahb);
+    bool allocate = len <= CACHE_ALLOC_MAX;
+    size_t remaining = len;
+    ssize_t rc;
+
+    while (remaining) {
+        uint32_t base = cache_page_base(phys);
+        size_t chunk = CACHE_PAGE_SIZE - (phys - base);
+        struct cache_page *page;
+
+        if (chunk > remaining)
+            chunk = remaining;
+
+        if (cache_serves(ctx, phys, allocate)) {
+            if ((page = cache_lookup(ctx, base))) {
+                ctx->hits++;
+            } else if (!(page = cache_fill(ctx, base))) {
+                return -errno;
+            }
+
+            memcpy(buf, cache_page_data(ctx, page) + (phys - base), chunk);
+        } else {
+            /* Coalesce the run of pages we can't serve into one access */
+            while (chunk < remaining && !cache_serves(ctx, phys + chunk, allocate)) {
+                size_t next = remaining - chunk;
+
+                chunk += next > CACHE_PAGE_SIZE ? CACHE_PAGE_SIZE : next;
+            }
+
+            rc = ahb_read(ctx->layer.lower, phys, buf, chunk);
+            if (rc < 0)
+                return rc;
+        }
+
+        phys += chunk;
+        buf += chunk;
+        remaining -= chunk;
+    }
+
+    return len;
+}
+
+/* Write-through: Update any cached copies after the lower write succeeds */
+static void cache_update(struct cache *ctx, uint32_t phys, const void *buf, size_t len)
+{
+    while (len) {
+        uint32_t base = cache_page_base(phys);
+        size_t chunk = CACHE_PAGE_SIZE - (phys - base);
+        struct cache_page *page;
+
+        if (chunk > len)
+            chunk = len;
+
+        if ((page = cache_lookup(ctx, base)))
+            memcpy(cache_page_data(ctx, page) + (phys - base), buf, chunk);
+
+        phys += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+static ssize_t cache_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
+{
+    struct cache *ctx = to_cache(ahb);
+    ssize_t rc;
+
+    rc = ahb_write(ctx->layer.lower, phys, buf, len);
+    if (rc < 0) {
+        cache_invalidate_range(ctx, phys, len);
+        return rc;
+    }
+
+    cache_update(ctx, phys, buf, len);
+
+    return rc;
+}
+
+static int cache_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
+{
+    struct cache *ctx = to_cache(ahb);
+    struct cache_page *page;
+    uint32_t base;
+
+    /* Don't fill a whole page for a word, but use one if we have it */
+    base = cache_page_base(phys);
+    if (!(phys & 3) && cache_page_cacheable(ctx, base) &&
+            (page = cache_lookup(ctx, base))) {
+        memcpy(val, cache_page_data(ctx, page) + (phys - base), sizeof(*val));
+        *val = le32toh(*val);
+        ctx->hits++;
+        return 0;
+    }
+
+    return ahb_readl(ctx->layer.lower, phys, val);
+}
+
+static int cache_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
+{
+    struct cache *ctx = to_cache(ahb);
+    uint32_t le;
+    int rc;
+
+    rc = ahb_writel(ctx->layer.lower, phys, val);
+    if (rc < 0) {
+        cache_invalidate_range(ctx, phys, sizeof(val));
+        return rc;
+    }
+
+    le = htole32(val);
+    cache_update(ctx, phys, &le, sizeof(le));
+
+    return 0;
+}
+
+static bool cache_op_cacheable(struct cache *ctx, const struct ahb_op *op)
+{
+    uint64_t end, base;
+    size_t len;
+
+    len = (op->type == ahb_op_read || op->type == ahb_op_write) ? op->len : 4;
+    end = (uint64_t)op->phys + len;
+
+    for (base = cache_page_base(op->phys); base < end; base += CACHE_PAGE_SIZE) {
+        if (cache_page_cacheable(ctx, base))
+            return true;
+    }
+
+    return false;
+}
+
+static int cache_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
+{
+    struct cache *ctx = to_cache(ahb);
+    size_t i;
+
+    /* Preserve the lower interface's batching unless the cache is involved */
+    for (i = 0; i < n; i++) {
+        if (cache_op_cacheable(ctx, &ops[i]))
+            return ahb_submit_fallback(ahb, ops, n);
+    }
+
+    return ahb_submit(ctx->layer.lower, ops, n);
+}
+
+static const struct ahb_ops cache_ops = {
+    .read = cache_read,
+    .write = cache_write,
+    .readl = cache_readl,
+    .writel = cache_writel,
+    .submit = cache_submit,
+};
+
+static int cache_reinit(struct ahb *ahb)
+{
+    /* The BMC had free rein while we'd released the bridge */
+    cache_invalidate(to_cache(ahb));
+
+    return ahb_layer_reinit(ahb);
+}
+
+void cache_invalidate(struct cache *ctx)
+{
+    int i;
+
+    for (i = 0; i < CACHE_PAGES; i++)
+        ctx->pages[i].valid = false;
+}
+
+void cache_invalidate_range(struct cache *ctx, uint32_t start, uint64_t len)
+{
+    uint64_t end = (uint64_t)start + len;
+    int i;
+
+    for (i = 0; i < CACHE_PAGES; i++) {
+        struct cache_page *page = &ctx->pages[i];
+        uint64_t base = (uint64_t)page->tag << CACHE_PAGE_SHIFT;
+
+        if (page->valid && base < end && base + CACHE_PAGE_SIZE > start)
+            page->valid = false;
+    }
+}
+
+int cache_add_region(struct cache *ctx, uint32_t start, uint64_t len,
+                     bool cacheable)
+{
+    struct cache_region *region, *unused = NULL;
+    int i;
+
+    if (!len)
+        return -EINVAL;
+
+    cache_invalidate_range(ctx, start, len);
+
+    for (i = 0; i < CACHE_REGIONS; i++) {
+        region = &ctx->regions[i];
+
+        if (!region->refs) {
+            if (!unused)
+                unused = region;
+            continue;
+        }
+
+        if (region->start == start && region->len == len &&
+                region->cacheable == cacheable) {
+            region->refs++;
+            return 0;
+        }
+    }
+
+    if (!unused)
+        return -ENOSPC;
+
+    unused->start = start;
+    unused->len = len;
+    unused->cacheable = cacheable;
+    unused->refs = 1;
+
+    logd("cache: Marked [0x%08" PRIx32 " - 0x%08" PRIx64 ") as %s\n", start,
+         (uint64_t)start + len, cacheable ? "cacheable" : "uncacheable");
+
+    return 0;
+}
+
+void cache_remove_region(struct cache *ctx, uint32_t start, uint64_t len,
+                         bool cacheable)
+{
+    int i;
+
+    cache_invalidate_range(ctx, start, len);
+
+    for (i = 0; i < CACHE_REGIONS; i++) {
+        struct cache_region *region = &ctx->regions[i];
+
+        if (region->refs && region->start == start && region->len == len &&
+                region->cacheable == cacheable) {
+            region->refs--;
+            return;
+        }
+    }
+}
+
+int cache_init(struct cache *ctx, struct ahb *lower)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->data = malloc(CACHE_PAGES * CACHE_PAGE_SIZE);
+    if (!ctx->data)
+        return -ENOMEM;
+
+    ahb_layer_init(&ctx->layer, lower, &cache_ops);
+    ctx->layer.drv.reinit = cache_reinit;
+
+    return 0;
+}
+
+void cache_destroy(struct cache *ctx)
+{
+    logd("cache: %lu hits, %lu page fills\n", ctx->hits, ctx->misses);
+
+    free(ctx->data);
+}
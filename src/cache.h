@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "ahb.h"
+#include "layer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CACHE_PAGE_SHIFT        12
+#define CACHE_PAGE_SIZE         (1 << CACHE_PAGE_SHIFT)
+#define CACHE_PAGES             256
+#define CACHE_REGIONS           16
+
+struct cache_region {
+    uint32_t start;
+    uint64_t len;
+    bool cacheable;
+    unsigned int refs;
+};
+
+struct cache_page {
+    uint32_t tag;
+    bool valid;
+};
+
+/*
+ * A direct-mapped, write-through cache of memory-like regions of the AHB.
+ * Accesses outside of cacheable regions, or overlapping a region marked
+ * uncacheable, are passed straight through to the lower interface.
+ */
+struct cache {
+    struct ahb_layer layer;
+    struct cache_region regions[CACHE_REGIONS];
+    struct cache_page pages[CACHE_PAGES];
+    uint8_t *data;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+int cache_init(struct cache *ctx, struct ahb *lower);
+void cache_destroy(struct cache *ctx);
+
+static inline struct ahb *cache_as_ahb(struct cache *ctx)
+{
+    return ahb_layer_as_ahb(&ctx->layer);
+}
+
+/*
+ * Regions marked uncacheable take precedence over cacheable regions.
+ * Registrations are reference counted so callers can temporarily mark a
+ * region as uncacheable and later remove the mark.
+ */
+int cache_add_region(struct cache *ctx, uint32_t start, uint64_t len,
+                     bool cacheable);
+void cache_remove_region(struct cache *ctx, uint32_t start, uint64_t len,
+                         bool cacheable);
+
+void cache_invalidate(struct cache *ctx);
+void cache_invalidate_range(struct cache *ctx, uint32_t start, uint64_t len);
+
+#endif
@@ -0,0 +1,578 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ahb.h"
+#include "array.h"
+#include "compiler.h"
+#include "hex.h"
+#include "host.h"
+#include "log.h"
+#include "rev.h"
+#include "soc.h"
+#include "version.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_SAMPLES           256
+/* Upper bound on the scratch area, to limit the cost of saving and restoring it */
+#define BENCH_SCRATCH_MAX       (16 * 1024)
+#define BENCH_BULK_MAX          (64 * 1024)
+/* Far enough from the SRAM to force P2A and L2A to move their windows */
+#define BENCH_REMOTE_REG        0x1e6e2000
+/* Lines of debug UART `d` output for the decoder benchmark, 64KiB of memory */
+#define BENCH_HEX_LINES         4096
+#define BENCH_HEX_ROUNDS        64
+
+static const size_t bench_chunks[] = { 4, 64, 1024, 4096, 16384 };
+
+struct bench_latency {
+    double p50;
+    double p99;
+};
+
+struct bench_bulk {
+    size_t chunk;
+    double read;
+    double write;
+};
+
+struct bench_result {
+    const char *name;
+    int rc;
+    struct bench_latency readl;
+    struct bench_latency writel;
+    struct bench_latency remap;
+    struct bench_bulk bulk[ARRAY_SIZE(bench_chunks)];
+    size_t n_bulk;
+};
+
+static const struct soc_device_id sram_match[] = {
+    { .compatible = "mmio-sram" },
+    { },
+};
+
+static void cmd_bench_help(const char *name)
+{
+    static const char *bench_help =
+        "Usage:\n"
+        "%s bench [--json] [--samples N] [INTERFACE [IP PORT USERNAME PASSWORD]]\n"
+        "%s bench --hex\n"
+        "\n"
+        "Measures each available bridge using the BMC's SRAM as scratch space.\n"
+        "The SRAM contents are saved beforehand and restored afterwards.\n"
+        "\n"
+        "With --hex, measures decoding of the debug UART's dump output on the host\n"
+        "against the sscanf()-based parser it replaced, without using a BMC.\n";
+
+    printf(bench_help, name, name);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void bench_summarise(double *samples, size_t n, struct bench_latency *lat)
+{
+    qsort(samples, n, sizeof(*samples), bench_compare);
+
+    lat->p50 = samples[((n - 1) * 50) / 100];
+    lat->p99 = samples[((n - 1) * 99) / 100];
+}
+
+static int bench_latency(struct ahb *ahb, const struct soc_region *scratch,
+                         struct bench_result *result, size_t n)
+{
+    double *samples;
+    double start;
+    uint32_t val;
+    size_t i;
+    int rc;
+
+    if (!(samples = calloc(n, sizeof(*samples))))
+        return -ENOMEM;
+
+    for (i = 0; i < n; i++) {
+        start = bench_now();
+        if ((rc = ahb_readl(ahb, scratch->start, &val)) < 0)
+            goto cleanup_samples;
+        samples[i] = bench_now() - start;
+    }
+    bench_summarise(samples, n, &result->readl);
+
+    for (i = 0; i < n; i++) {
+        start = bench_now();
+        if ((rc = ahb_writel(ahb, scratch->start, i)) < 0)
+            goto cleanup_samples;
+        samples[i] = bench_now() - start;
+    }
+    bench_summarise(samples, n, &result->writel);
+
+    /* Alternate between distant addresses so each access must remap */
+    for (i = 0; i < n; i++) {
+        uint32_t phys = (i & 1) ? BENCH_REMOTE_REG : scratch->start;
+
+        start = bench_now();
+        if ((rc = ahb_readl(ahb, phys, &val)) < 0)
+            goto cleanup_samples;
+        samples[i] = bench_now() - start;
+    }
+    bench_summarise(samples, n, &result->remap);
+
+    rc = 0;
+
+cleanup_samples:
+    free(samples);
+
+    return rc;
+}
+
+static int bench_bulk(struct ahb *ahb, const struct soc_region *scratch,
+                      struct bench_result *result, size_t n)
+{
+    size_t i;
+    void *buf;
+    int rc;
+
+    if (!(buf = calloc(1, scratch->length)))
+        return -ENOMEM;
+
+    for (i = 0; i < ARRAY_SIZE(bench_chunks); i++) {
+        size_t chunk = bench_chunks[i];
+        struct bench_bulk *bulk;
+        size_t total, done;
+        double start;
+        ssize_t egress;
+
+        if (chunk > scratch->length)
+            break;
+
+        /* Bound the runtime on slow bridges */
+        total = chunk * n;
+        if (total > BENCH_BULK_MAX)
+            total = BENCH_BULK_MAX;
+
+        bulk = &result->bulk[result->n_bulk];
+        bulk->chunk = chunk;
+
+        start = bench_now();
+        for (done = 0; done < total; done += chunk) {
+            uint32_t phys = scratch->start + (done % scratch->length);
+
+            if ((egress = ahb_read(ahb, phys, buf, chunk)) < 0) {
+                rc = egress;
+                goto cleanup_buf;
+            }
+        }
+        bulk->read = total / (bench_now() - start);
+
+        start = bench_now();
+        for (done = 0; done < total; done += chunk) {
+            uint32_t phys = scratch->start + (done % scratch->length);
+
+            if ((egress = ahb_write(ahb, phys, buf, chunk)) < 0) {
+                rc = egress;
+                goto cleanup_buf;
+            }
+        }
+        bulk->write = total / (bench_now() - start);
+
+        result->n_bulk++;
+    }
+
+    rc = 0;
+
+cleanup_buf:
+    free(buf);
+
+    return rc;
+}
+
+static void bench_bridge(struct ahb *ahb, const struct soc_region *scratch,
+                         struct bench_result *result, size_t n)
+{
+    memset(result, 0, sizeof(*result));
+    result->name = ahb->drv->name;
+
+    logi("Benchmarking the %s bridge\n", result->name);
+
+    if ((result->rc = bench_latency(ahb, scratch, result, n)) < 0)
+        return;
+
+    result->rc = bench_bulk(ahb, scratch, result, n);
+}
+
+static void bench_print_latency(const char *label, const struct bench_latency *lat)
+{
+    printf("  %-7s p50 %10.2fus  p99 %10.2fus\n", label, lat->p50 * 1e6,
+           lat->p99 * 1e6);
+}
+
+static void bench_print(const struct bench_result *results, size_t n_results)
+{
+    size_t i, j;
+
+    for (i = 0; i < n_results; i++) {
+        const struct bench_result *result = &results[i];
+        double cost;
+
+        printf("%s:\n", result->name);
+
+        if (result->rc < 0) {
+            printf("  failed: %s\n", strerror(-result->rc));
+            continue;
+        }
+
+        bench_print_latency("readl", &result->readl);
+        bench_print_latency("writel", &result->writel);
+        bench_print_latency("remap", &result->remap);
+
+        cost = result->remap.p50 - result->readl.p50;
+        printf("  remap cost %.2fus\n", (cost > 0 ? cost : 0) * 1e6);
+
+        printf("  %8s %14s %14s\n", "chunk", "read KiB/s", "write KiB/s");
+        for (j = 0; j < result->n_bulk; j++) {
+            const struct bench_bulk *bulk = &result->bulk[j];
+
+            printf("  %8zu %14.1f %14.1f\n", bulk->chunk, bulk->read / 1024,
+                   bulk->write / 1024);
+        }
+    }
+}
+
+static void bench_print_json_latency(const char *label,
+                                     const struct bench_latency *lat)
+{
+    printf("\"%s\": {\"p50_us\": %.3f, \"p99_us\": %.3f}", label,
+           lat->p50 * 1e6, lat->p99 * 1e6);
+}
+
+static void bench_print_json(struct soc *soc, const struct soc_region *scratch,
+                             const struct bench_result *results,
+                             size_t n_results, size_t n)
+{
+    size_t i, j;
+
+    printf("{\"version\": \"%s\", \"soc\": \"%s\", \"samples\": %zu, ",
+           CULVERT_VERSION, rev_name(soc->rev), n);
+    printf("\"scratch\": {\"start\": %" PRIu32 ", \"length\": %" PRIu32 "}, ",
+           scratch->start, scratch->length);
+    printf("\"bridges\": [");
+
+    for (i = 0; i < n_results; i++) {
+        const struct bench_result *result = &results[i];
+        double cost;
+
+        printf("%s{\"name\": \"%s\", ", i ? ", " : "", result->name);
+
+        if (result->rc < 0) {
+            printf("\"error\": %d}", result->rc);
+            continue;
+        }
+
+        bench_print_json_latency("readl", &result->readl);
+        printf(", ");
+        bench_print_json_latency("writel", &result->writel);
+        printf(", ");
+        bench_print_json_latency("remap", &result->remap);
+
+        cost = result->remap.p50 - result->readl.p50;
+        printf(", \"remap_cost_us\": %.3f, \"bulk\": [",
+               (cost > 0 ? cost : 0) * 1e6);
+
+        for (j = 0; j < result->n_bulk; j++) {
+            const struct bench_bulk *bulk = &result->bulk[j];
+
+            printf("%s{\"chunk\": %zu, \"read_bps\": %.0f, \"write_bps\": %.0f}",
+                   j ? ", " : "", bulk->chunk, bulk->read, bulk->write);
+        }
+
+        printf("]}");
+    }
+
+    printf("]}\n");
+}
+
+/* The debug UART's original `d` line parser, as a reference for the decoder */
+static ssize_t bench_hex_sscanf(char *line, char *buf)
+{
+    char *eoa, *words, *token, *stream;
+    char *saveptr;
+    char *cursor;
+    ssize_t rc;
+
+    eoa = strchr(line, ':');
+    if (!eoa)
+        return -EBADE;
+
+    words = eoa + 1;
+    cursor = buf;
+    stream = strdup(words);
+    while ((token = strtok_r(words, " ", &saveptr))) {
+        rc = sscanf(token, "%02hhx%02hhx%02hhx%02hhx",
+                    &cursor[3], &cursor[2], &cursor[1], &cursor[0]);
+        if (rc < 4) {
+            rc = -EBADE;
+            goto done;
+        }
+
+        cursor += rc;
+        words = NULL;
+    }
+
+    rc = cursor - buf;
+
+done:
+    free(stream);
+    return rc;
+}
+
+static ssize_t bench_hex_decode(const char *line, char *buf)
+{
+    uint32_t words[4];
+    uint32_t addr;
+    size_t i;
+
+    if (line[HEX_WORD_LEN] != ':' || hex_decode_words(line, 1, &addr))
+        return -EBADE;
+
+    if (hex_decode_words(line + HEX_WORD_STRIDE, 4, words))
+        return -EBADE;
+
+    for (i = 0; i < 4; i++)
+        words[i] = htole32(words[i]);
+
+    memcpy(buf, words, sizeof(words));
+
+    return sizeof(words);
+}
+
+static int bench_hex(void)
+{
+    const size_t line_len = sizeof("20002ba0:31e01002 20433002 30813003 e1a06002\r\n");
+    char *lines, *scratch, *expected, *decoded;
+    double legacy, vector, start;
+    size_t i, round;
+    int rc = 0;
+
+    lines = malloc(BENCH_HEX_LINES * line_len);
+    scratch = malloc(line_len);
+    expected = malloc(BENCH_HEX_LINES * 16);
+    decoded = malloc(BENCH_HEX_LINES * 16);
+    if (!lines || !scratch || !expected || !decoded) {
+        rc = -ENOMEM;
+        goto done;
+    }
+
+    srand(0);
+    for (i = 0; i < BENCH_HEX_LINES; i++) {
+        snprintf(&lines[i * line_len], line_len, "%08zx:%08x %08x %08x %08x\r\n",
+                 0x20000000 + i * 16, rand(), rand(), rand(), rand());
+    }
+
+    /* The reference parser tokenises in place, so give it a copy of each line */
+    start = bench_now();
+    for (round = 0; round < BENCH_HEX_ROUNDS; round++) {
+        for (i = 0; i < BENCH_HEX_LINES; i++) {
+            memcpy(scratch, &lines[i * line_len], line_len);
+            if (bench_hex_sscanf(scratch, &expected[i * 16]) != 16) {
+                rc = -EBADE;
+                goto done;
+            }
+        }
+    }
+    legacy = (bench_now() - start) / BENCH_HEX_ROUNDS;
+
+    start = bench_now();
+    for (round = 0; round < BENCH_HEX_ROUNDS; round++) {
+        for (i = 0; i < BENCH_HEX_LINES; i++) {
+            memcpy(scratch, &lines[i * line_len], line_len);
+            if (bench_hex_decode(scratch, &decoded[i * 16]) != 16) {
+                rc = -EBADE;
+                goto done;
+            }
+        }
+    }
+    vector = (bench_now() - start) / BENCH_HEX_ROUNDS;
+
+    if (memcmp(expected, decoded, BENCH_HEX_LINES * 16)) {
+        loge("Decoded dump differs from the reference parser\n");
+        rc = -EIO;
+        goto done;
+    }
+
+    printf("%-10s %12s %12s\n", "PARSER", "NS/LINE", "MB/S");
+    printf("%-10s %12.1f %12.1f\n", "sscanf", legacy * 1e9 / BENCH_HEX_LINES,
+           BENCH_HEX_LINES * 16 / legacy / 1e6);
+    printf("%-10s %12.1f %12.1f\n", "decoder", vector * 1e9 / BENCH_HEX_LINES,
+           BENCH_HEX_LINES * 16 / vector / 1e6);
+
+done:
+    if (rc == -EBADE)
+        loge("Failed to parse the generated dump\n");
+
+    free(decoded);
+    free(expected);
+    free(scratch);
+    free(lines);
+
+    return rc;
+}
+
+int cmd_bench(const char *name, int argc, char *argv[])
+{
+    struct host _host, *host = &_host;
+    struct soc _soc, *soc = &_soc;
+    struct bench_result *results;
+    struct soc_device_node dn;
+    struct soc_region scratch;
+    size_t n = BENCH_SAMPLES;
+    size_t n_results = 0;
+    bool json = false;
+    void *saved;
+    struct ahb *ahb;
+    int cleanup;
+    int rc;
+
+    while (1) {
+        int option_index = 0;
+        int c;
+
+        static struct option long_options[] = {
+            { "help", no_argument, NULL, 'h' },
+            { "hex", no_argument, NULL, 'x' },
+            { "json", no_argument, NULL, 'j' },
+            { "samples", required_argument, NULL, 'n' },
+            { },
+        };
+
+        c = getopt_long(argc, argv, "hjn:x", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'h':
+                cmd_bench_help(name);
+                exit(EXIT_SUCCESS);
+            case 'j':
+                json = true;
+                break;
+            case 'n':
+                n = strtoul(optarg, NULL, 0);
+                if (!n) {
+                    loge("Invalid sample count: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'x':
+                exit(bench_hex() ? EXIT_FAILURE : EXIT_SUCCESS);
+            case '?':
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((rc = host_init(host, argc - optind, &argv[optind])) < 0) {
+        loge("Failed to initialise host interfaces: %d\n", rc);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!(ahb = host_get_bridge(host, 0))) {
+        loge("Failed to acquire AHB interface, exiting\n");
+        rc = -ENODEV;
+        goto cleanup_host;
+    }
+
+    if ((rc = soc_probe(soc, ahb)) < 0)
+        goto cleanup_host;
+
+    dn.fdt = &soc->fdt;
+    if ((rc = soc_device_match_node(soc, sram_match, &dn)) < 0) {
+        loge("Failed to find the SRAM for scratch space: %d\n", rc);
+        goto cleanup_soc;
+    }
+
+    if ((rc = soc_device_get_memory(soc, &dn, &scratch)) < 0)
+        goto cleanup_soc;
+
+    if (scratch.length > BENCH_SCRATCH_MAX)
+        scratch.length = BENCH_SCRATCH_MAX;
+
+    if (!(results = calloc(1, sizeof(*results)))) {
+        rc = -ENOMEM;
+        goto cleanup_soc;
+    }
+
+    if (!(saved = malloc(scratch.length))) {
+        rc = -ENOMEM;
+        goto cleanup_results;
+    }
+
+    logi("Saving scratch region 0x%08" PRIx32 "-0x%08" PRIx32 "\n",
+         scratch.start, scratch.start + scratch.length - 1);
+    if ((rc = ahb_read(ahb, scratch.start, saved, scratch.length)) < 0) {
+        loge("Failed to save the scratch region: %d\n", rc);
+        goto cleanup_saved;
+    }
+
+    while ((ahb = host_get_bridge(host, n_results))) {
+        struct bench_result *grown;
+
+        grown = realloc(results, (n_results + 1) * sizeof(*results));
+        if (!grown) {
+            rc = -ENOMEM;
+            break;
+        }
+        results = grown;
+
+        bench_bridge(ahb, &scratch, &results[n_results++], n);
+    }
+
+    logi("Restoring scratch region\n");
+    if ((cleanup = ahb_write(host_get_bridge(host, 0), scratch.start, saved,
+                             scratch.length)) < 0) {
+        loge("Failed to restore the scratch region: %d\n", cleanup);
+        rc = cleanup;
+    }
+
+    if (rc >= 0) {
+        if (json)
+            bench_print_json(soc, &scratch, results, n_results, n);
+        else
+            bench_print(results, n_results);
+    }
+
+cleanup_saved:
+    free(saved);
+
+cleanup_results:
+    free(results);
+
+cleanup_soc:
+    soc_destroy(soc);
+
+cleanup_host:
+    host_destroy(host);
+
+    if (rc < 0)
+        exit(EXIT_FAILURE);
+
+    return 0;
+}
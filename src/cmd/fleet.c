@@ -0,0 +1,319 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "array.h"
+#include "bridge/p2a.h"
+#include "compiler.h"
+#include "log.h"
+#include "pci.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FLEET_MAX_TARGETS       64
+
+/*
+ * Each target is driven by a separate culvert process, as the bridge and SoC
+ * state is global to the process. A worker thread per target starts its
+ * process and waits for it, so the slowest target bounds the total time.
+ */
+struct fleet_target {
+    char bdf[PCI_BDF_LEN];
+    char out[PATH_MAX];
+    char log[PATH_MAX];
+    const char *input;
+    char **argv;
+    pthread_t thread;
+    bool started;
+    /* The exit status of the process, or negative if it couldn't be run */
+    int status;
+    double elapsed;
+};
+
+/* The global options to run each target's process with */
+static char **fleet_options;
+static int fleet_n_options;
+
+void fleet_set_options(int argc, char *argv[])
+{
+    fleet_options = argv;
+    fleet_n_options = argc;
+}
+
+static void cmd_fleet_help(const char *name)
+{
+    static const char *fleet_help =
+        "Usage:\n"
+        "%s fleet [--input FILE] [--output DIR] TARGETS -- COMMAND [ARGS...]\n"
+        "\n"
+        "Runs COMMAND concurrently against each BMC in TARGETS, which is either\n"
+        "a comma-separated list of PCIe addresses or 'all' for every ASPEED VGA\n"
+        "device. Only the P2A bridge is used. Each target's standard output and\n"
+        "log are written to BDF.out and BDF.log in DIR, and its standard input\n"
+        "is read from FILE. Global options other than --device, --record and\n"
+        "--timeline are passed on to each target, e.g:\n"
+        "\n"
+        "%s fleet -i image.bin all -- write firmware\n";
+
+    printf(fleet_help, name, name);
+}
+
+static double fleet_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *fleet_worker(void *arg)
+{
+    struct fleet_target *target = arg;
+    double start = fleet_now();
+    int status;
+    pid_t pid;
+
+    pid = fork();
+    if (pid < 0) {
+        target->status = -errno;
+        return NULL;
+    }
+
+    if (!pid) {
+        int in, out, log;
+
+        in = open(target->input ? target->input : "/dev/null", O_RDONLY);
+        out = open(target->out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        log = open(target->log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (in < 0 || out < 0 || log < 0)
+            _exit(126);
+
+        if (dup2(in, STDIN_FILENO) < 0 || dup2(out, STDOUT_FILENO) < 0 ||
+                dup2(log, STDERR_FILENO) < 0)
+            _exit(126);
+
+        execv("/proc/self/exe", target->argv);
+        _exit(127);
+    }
+
+    if (waitpid(pid, &status, 0) < 0) {
+        target->status = -errno;
+        return NULL;
+    }
+
+    target->elapsed = fleet_now() - start;
+    target->status = status;
+
+    return NULL;
+}
+
+static int fleet_parse_targets(char *spec, struct fleet_target *targets,
+                               size_t len)
+{
+    char bdfs[FLEET_MAX_TARGETS][PCI_BDF_LEN];
+    char *bdf, *save;
+    size_t n = 0;
+    int rc;
+
+    if (!strcmp(spec, "all")) {
+        rc = pci_list(AST_PCI_VID, AST_PCI_DID_VGA, bdfs, ARRAY_SIZE(bdfs));
+        if (rc < 0)
+            return rc;
+
+        if ((size_t)rc > len)
+            return -E2BIG;
+
+        for (n = 0; n < (size_t)rc; n++)
+            strcpy(targets[n].bdf, bdfs[n]);
+
+        return n;
+    }
+
+    for (bdf = strtok_r(spec, ",", &save); bdf; bdf = strtok_r(NULL, ",", &save)) {
+        if (n == len)
+            return -E2BIG;
+
+        /* Normalise the address so the output files are named consistently */
+        if ((rc = pci_parse_bdf(bdf, targets[n].bdf)) < 0) {
+            loge("Invalid PCIe address: %s\n", bdf);
+            return -EINVAL;
+        }
+
+        n++;
+    }
+
+    return n;
+}
+
+static void fleet_report(struct fleet_target *targets, size_t n, double elapsed)
+{
+    double sequential = 0;
+    size_t ok = 0;
+    size_t i;
+
+    printf("%-14s %-14s %10s  %s\n", "TARGET", "RESULT", "TIME", "OUTPUT");
+
+    for (i = 0; i < n; i++) {
+        struct fleet_target *target = &targets[i];
+        char result[32];
+
+        if (target->status < 0) {
+            snprintf(result, sizeof(result), "error (%d)", target->status);
+        } else if (WIFSIGNALED(target->status)) {
+            snprintf(result, sizeof(result), "signal %d",
+                     WTERMSIG(target->status));
+        } else if (WEXITSTATUS(target->status)) {
+            snprintf(result, sizeof(result), "failed (%d)",
+                     WEXITSTATUS(target->status));
+        } else {
+            snprintf(result, sizeof(result), "ok");
+            ok++;
+        }
+
+        printf("%-14s %-14s %9.1fs  %s\n", target->bdf, result,
+               target->elapsed, target->out);
+
+        sequential += target->elapsed;
+    }
+
+    printf("\n%zu of %zu targets succeeded in %.1fs (%.1fs if run sequentially)\n",
+           ok, n, elapsed, sequential);
+}
+
+int cmd_fleet(const char *name, int argc, char *argv[])
+{
+    struct fleet_target *targets;
+    const char *output = ".";
+    const char *input = NULL;
+    double start;
+    size_t cmd_argc;
+    size_t failed;
+    size_t i, n;
+    int rc;
+
+    while (1) {
+        int option_index = 0;
+        int c;
+
+        static struct option long_options[] = {
+            { "help", no_argument, NULL, 'h' },
+            { "input", required_argument, NULL, 'i' },
+            { "output", required_argument, NULL, 'o' },
+            { },
+        };
+
+        c = getopt_long(argc, argv, "+hi:o:", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'h':
+                cmd_fleet_help(name);
+                exit(EXIT_SUCCESS);
+            case 'i':
+                input = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case '?':
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind < 3 || strcmp(argv[optind + 1], "--")) {
+        cmd_fleet_help(name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!(targets = calloc(FLEET_MAX_TARGETS, sizeof(*targets)))) {
+        loge("Failed to allocate fleet targets\n");
+        exit(EXIT_FAILURE);
+    }
+
+    rc = fleet_parse_targets(argv[optind], targets, FLEET_MAX_TARGETS);
+    if (rc <= 0) {
+        loge("No targets to run against: %d\n", rc);
+        free(targets);
+        exit(EXIT_FAILURE);
+    }
+    n = rc;
+
+    /*
+     * The command for each target:
+     * culvert [OPTIONS...] --device BDF COMMAND [ARGS...]
+     */
+    cmd_argc = argc - (optind + 2);
+    for (i = 0; i < n; i++) {
+        struct fleet_target *target = &targets[i];
+
+        target->input = input;
+        snprintf(target->out, sizeof(target->out), "%s/%s.out", output,
+                 target->bdf);
+        snprintf(target->log, sizeof(target->log), "%s/%s.log", output,
+                 target->bdf);
+
+        target->argv = calloc(fleet_n_options + cmd_argc + 4,
+                              sizeof(*target->argv));
+        if (!target->argv) {
+            loge("Failed to allocate arguments for %s\n", target->bdf);
+            n = i;
+            rc = -ENOMEM;
+            goto cleanup_targets;
+        }
+
+        target->argv[0] = (char *)name;
+        memcpy(&target->argv[1], fleet_options,
+               fleet_n_options * sizeof(*target->argv));
+        target->argv[fleet_n_options + 1] = "--device";
+        target->argv[fleet_n_options + 2] = target->bdf;
+        memcpy(&target->argv[fleet_n_options + 3], &argv[optind + 2],
+               cmd_argc * sizeof(*target->argv));
+    }
+
+    logi("Running '%s' against %zu targets\n", argv[optind + 2], n);
+
+    start = fleet_now();
+
+    for (i = 0; i < n; i++) {
+        if ((rc = pthread_create(&targets[i].thread, NULL, fleet_worker,
+                                 &targets[i]))) {
+            loge("Failed to start worker for %s: %s\n", targets[i].bdf,
+                 strerror(rc));
+            targets[i].status = -rc;
+            continue;
+        }
+
+        targets[i].started = true;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (targets[i].started)
+            pthread_join(targets[i].thread, NULL);
+    }
+
+    fleet_report(targets, n, fleet_now() - start);
+
+    rc = 0;
+
+cleanup_targets:
+    failed = 0;
+    for (i = 0; i < n; i++) {
+        if (targets[i].status)
+            failed++;
+        free(targets[i].argv);
+    }
+    free(targets);
+
+    return (rc || failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
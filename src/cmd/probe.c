@@ -96,9 +96,15 @@ int cmd_probe(const char *name, int argc, char *argv[])
         goto cleanup_host;
     }
 
+    /* Probing is a long sequence of register accesses */
+    if ((rc = ahb_begin_session(ahb)) < 0) {
+        loge("Failed to begin AHB session: %d\n", rc);
+        goto cleanup_host;
+    }
+
     if ((rc = soc_probe(soc, ahb)) < 0) {
         loge("Failed to probe SoC, exiting: %d\n", rc);
-        goto cleanup_host;
+        goto end_session;
     }
 
     if (opt_list_ifaces) {
@@ -117,6 +123,9 @@ int cmd_probe(const char *name, int argc, char *argv[])
 cleanup_soc:
     soc_destroy(soc);
 
+end_session:
+    ahb_end_session(ahb);
+
 cleanup_host:
     host_destroy(host);
 
@@ -0,0 +1,295 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "combine.h"
+#include "log.h"
+
+#include "ccan/container_of/container_of.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#define COMBINE_SPAN            (COMBINE_WORDS * sizeof(uint32_t))
+
+#define to_combine(ahb) container_of(ahb_layer_from_ahb(ahb), struct combine, layer)
+
+static uint64_t combine_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const struct combine_region *combine_find(struct combine *ctx,
+                                                 uint32_t phys)
+{
+    size_t i;
+
+    if (phys & 3)
+        return NULL;
+
+    for (i = 0; i < ctx->n_regions; i++) {
+        const struct combine_region *region = &ctx->regions[i];
+
+        if (phys >= region->start &&
+                (uint64_t)phys + sizeof(uint32_t) <= region->start + region->len)
+            return region;
+    }
+
+    return NULL;
+}
+
+static void combine_drop(struct combine *ctx)
+{
+    ctx->pending = 0;
+    ctx->have_last = false;
+}
+
+/* Read the registers in [start, end), which must lie within one region */
+static int combine_fetch(struct combine *ctx, uint32_t start, uint32_t end,
+                         uint32_t *words)
+{
+    size_t n = (end - start) / sizeof(uint32_t);
+    ssize_t rc;
+    size_t i;
+
+    rc = ahb_read(ctx->layer.lower, start, words, n * sizeof(uint32_t));
+    if (rc < 0)
+        return rc;
+
+    for (i = 0; i < n; i++)
+        words[i] = le32toh(words[i]);
+
+    ctx->fetches++;
+
+    return 0;
+}
+
+static ssize_t combine_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct combine *ctx = to_combine(ahb);
+
+    combine_drop(ctx);
+
+    return ahb_read(ctx->layer.lower, phys, buf, len);
+}
+
+static ssize_t combine_write(struct ahb *ahb, uint32_t phys, const void *buf,
+                             size_t len)
+{
+    struct combine *ctx = to_combine(ahb);
+
+    combine_drop(ctx);
+
+    return ahb_write(ctx->layer.lower, phys, buf, len);
+}
+
+static int combine_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
+{
+    struct combine *ctx = to_combine(ahb);
+    const struct combine_region *region;
+    uint32_t idx, end;
+    bool run;
+    int rc;
+
+    if (ctx->pending && combine_now() - ctx->fetched_ns > COMBINE_AGE_NS)
+        ctx->pending = 0;
+
+    idx = (phys - ctx->base) / sizeof(uint32_t);
+    if (phys >= ctx->base && !(phys & 3) && idx < COMBINE_WORDS &&
+            (ctx->pending & (1u << idx))) {
+        ctx->pending &= ~(1u << idx);
+        ctx->last = phys;
+        ctx->served++;
+        *val = ctx->words[idx];
+        return 0;
+    }
+
+    /* The values fetched so far are now older than this read */
+    ctx->pending = 0;
+
+    region = combine_find(ctx, phys);
+    run = region && ctx->have_last && phys > ctx->last &&
+          phys - ctx->last < COMBINE_SPAN && combine_find(ctx, ctx->last) == region;
+
+    ctx->last = phys;
+    ctx->have_last = !!region;
+
+    if (!run)
+        return ahb_readl(ctx->layer.lower, phys, val);
+
+    end = region->start + region->len - phys < COMBINE_SPAN ?
+          region->start + region->len : phys + COMBINE_SPAN;
+
+    if ((rc = combine_fetch(ctx, phys, end, ctx->words)) < 0)
+        return rc;
+
+    ctx->base = phys;
+    ctx->fetched_ns = combine_now();
+    ctx->pending = ((1u << ((end - phys) / sizeof(uint32_t))) - 1) & ~1u;
+    *val = ctx->words[0];
+
+    return 0;
+}
+
+static int combine_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
+{
+    struct combine *ctx = to_combine(ahb);
+
+    combine_drop(ctx);
+
+    return ahb_writel(ctx->layer.lower, phys, val);
+}
+
+/*
+ * Find the run of readl ops from ops[i] that lie within one region and span at
+ * most COMBINE_SPAN bytes. Returns the index of the op following the run.
+ */
+static size_t combine_run(struct combine *ctx, struct ahb_op *ops, size_t i,
+                          size_t n, uint32_t *start, uint32_t *end)
+{
+    const struct combine_region *region;
+    uint32_t lo, hi;
+    size_t j;
+
+    if (ops[i].type != ahb_op_readl || !(region = combine_find(ctx, ops[i].phys)))
+        return i + 1;
+
+    lo = ops[i].phys;
+    hi = lo + sizeof(uint32_t);
+
+    for (j = i + 1; j < n; j++) {
+        uint32_t phys = ops[j].phys;
+        uint32_t next_lo = phys < lo ? phys : lo;
+        uint32_t next_hi = phys + sizeof(uint32_t) > hi ? phys + sizeof(uint32_t) : hi;
+
+        if (ops[j].type != ahb_op_readl || combine_find(ctx, phys) != region ||
+                next_hi - next_lo > COMBINE_SPAN)
+            break;
+
+        lo = next_lo;
+        hi = next_hi;
+    }
+
+    *start = lo;
+    *end = hi;
+
+    return j;
+}
+
+static void combine_cancel(struct ahb_op *ops, size_t i, size_t n)
+{
+    for (; i < n; i++)
+        ops[i].rc = -ECANCELED;
+}
+
+static int combine_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
+{
+    struct combine *ctx = to_combine(ahb);
+    uint32_t words[COMBINE_WORDS];
+    uint32_t start, end;
+    size_t i, j, k, seg;
+    int rc;
+
+    combine_drop(ctx);
+
+    /* Forward the ops between runs as batches to keep the lower batching */
+    for (i = seg = 0; i < n; i = j) {
+        j = combine_run(ctx, ops, i, n, &start, &end);
+        if (j - i < 2)
+            continue;
+
+        if ((rc = ahb_submit(ctx->layer.lower, &ops[seg], i - seg)) < 0) {
+            combine_cancel(ops, i, n);
+            return rc;
+        }
+
+        if ((rc = combine_fetch(ctx, start, end, words)) < 0) {
+            ops[i].rc = rc;
+            combine_cancel(ops, i + 1, n);
+            return rc;
+        }
+
+        for (k = i; k < j; k++) {
+            *ops[k].valp = words[(ops[k].phys - start) / sizeof(uint32_t)];
+            ops[k].rc = 0;
+        }
+
+        ctx->served += j - i - 1;
+        seg = j;
+    }
+
+    return ahb_submit(ctx->layer.lower, &ops[seg], n - seg);
+}
+
+static const struct ahb_ops combine_ops = {
+    .read = combine_read,
+    .write = combine_write,
+    .readl = combine_readl,
+    .writel = combine_writel,
+    .submit = combine_submit,
+};
+
+static int combine_reinit(struct ahb *ahb)
+{
+    /* The BMC had free rein while we'd released the bridge */
+    combine_drop(to_combine(ahb));
+
+    return ahb_layer_reinit(ahb);
+}
+
+static int combine_begin(struct ahb *ahb)
+{
+    combine_drop(to_combine(ahb));
+
+    return ahb_layer_begin(ahb);
+}
+
+static void combine_end(struct ahb *ahb)
+{
+    combine_drop(to_combine(ahb));
+
+    ahb_layer_end(ahb);
+}
+
+int combine_add_region(struct combine *ctx, uint32_t start, uint64_t len)
+{
+    struct combine_region *region;
+
+    if (!len)
+        return -EINVAL;
+
+    if (ctx->n_regions == COMBINE_REGIONS)
+        return -ENOSPC;
+
+    region = &ctx->regions[ctx->n_regions++];
+    region->start = start;
+    region->len = len;
+
+    logd("combine: Combining reads of [0x%08" PRIx32 " - 0x%08" PRIx64 ")\n",
+         start, (uint64_t)start + len);
+
+    return 0;
+}
+
+int combine_init(struct combine *ctx, struct ahb *lower)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    ahb_layer_init(&ctx->layer, lower, &combine_ops);
+    ctx->layer.drv.reinit = combine_reinit;
+    ctx->layer.drv.begin = combine_begin;
+    ctx->layer.drv.end = combine_end;
+
+    return 0;
+}
+
+void combine_destroy(struct combine *ctx)
+{
+    logd("combine: Served %lu register reads from %lu combined reads\n",
+         ctx->served, ctx->fetches);
+}
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _COMBINE_H
+#define _COMBINE_H
+
+#include "ahb.h"
+#include "layer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define COMBINE_REGIONS         16
+/* The most registers fetched by one combined read */
+#define COMBINE_WORDS           16
+/* How long fetched values may be served after the combined read */
+#define COMBINE_AGE_NS          (10 * 1000 * 1000)
+
+struct combine_region {
+    uint32_t start;
+    uint64_t len;
+};
+
+/*
+ * Combines register reads over a high-latency bridge into single reads of the
+ * span of registers involved. Only regions whose registers can be read in any
+ * order and width without side effects are combined.
+ *
+ * Runs of readl ops within a batch are combined directly. Otherwise, a readl
+ * just above the previous one fetches the registers from there onwards, and
+ * later readls of them are served from the fetched values. Each value is
+ * served at most once, and any other access drops them, so polling a register
+ * still reaches the BMC each time. They're also dropped once COMBINE_AGE_NS
+ * has passed since the combined read, and at session boundaries.
+ */
+struct combine {
+    struct ahb_layer layer;
+    struct combine_region regions[COMBINE_REGIONS];
+    size_t n_regions;
+    uint32_t last;
+    bool have_last;
+    uint32_t base;
+    uint32_t words[COMBINE_WORDS];
+    uint64_t fetched_ns;
+    /* A bitmap of the fetched words yet to be served */
+    uint32_t pending;
+    unsigned long served;
+    unsigned long fetches;
+};
+
+int combine_init(struct combine *ctx, struct ahb *lower);
+void combine_destroy(struct combine *ctx);
+
+int combine_add_region(struct combine *ctx, uint32_t start, uint64_t len);
+
+static inline struct ahb *combine_as_ahb(struct combine *ctx)
+{
+    return ahb_layer_as_ahb(&ctx->layer);
+}
+
+#endif
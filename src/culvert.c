@@ -7,6 +7,7 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,7 +18,12 @@
 #include "log.h"
 #include "version.h"
 #include "ahb.h"
+#include "bridge/debug.h"
 #include "host.h"
+#include "lpc.h"
+#include "pci.h"
+#include "soc.h"
+#include "stats.h"
 
 int cmd_ilpc(const char *name, int argc, char *argv[]);
 int cmd_p2a(const char *name, int argc, char *argv[]);
@@ -32,7 +38,10 @@ int cmd_reset(const char *name, int argc, char *argv[]);
 int cmd_sfc(const char *name, int argc, char *argv[]);
 int cmd_otp(const char *name, int argc, char *argv[]);
 int cmd_trace(const char *name, int argc, char *argv[]);
+void fleet_set_options(int argc, char *argv[]);
 int cmd_coprocessor(const char *name, int argc, char *argv[]);
+int cmd_bench(const char *name, int argc, char *argv[]);
+int cmd_fleet(const char *name, int argc, char *argv[]);
 
 static void print_version(const char *name)
 {
@@ -68,6 +77,76 @@ static void print_help(const char *name)
     printf("%s otp write conf WORD BIT [INTERFACE [IP PORT USERNAME PASSWORD]]\n", name);
     printf("%s trace ADDRESS WIDTH MODE [INTERFACE [IP PORT USERNAME PASSWORD]]\n", name);
     printf("%s coprocessor run ADDRESS LENGTH [INTERFACE [IP PORT USERNAME PASSWORD]]\n", name);
+    printf("%s bench [--json] [--samples N] [INTERFACE [IP PORT USERNAME PASSWORD]]\n", name);
+    printf("%s fleet [--input FILE] [--output DIR] TARGETS -- COMMAND [ARGS...]\n", name);
+    printf("\n");
+    printf("INTERFACE may be 'sim MODEL FILE [PROFILE]' to use a simulated BMC, where\n");
+    printf("MODEL is ast2400, ast2500 or ast2600 and PROFILE is one of none, devmem, p2a,\n");
+    printf("l2a, ilpc or debug, or OP_NS:BYTE_NS for a custom access latency.\n");
+    printf("\n");
+    printf("INTERFACE may be 'replay FILE [TIMING]' to replay accesses recorded with\n");
+    printf("--record, where TIMING scales the recorded latencies by a factor, or is\n");
+    printf("OP_NS:BYTE_NS to model a different bridge.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  -b, --bulk-bridge NAME  Use the named bridge for bulk transfers\n");
+    printf("  -B, --max-baud RATE     Allow the debug UART to run at up to RATE baud\n");
+    printf("  -c, --cache             Cache accesses to memory regions of the BMC\n");
+    printf("  -d, --device BDF        Use the BMC behind the PCIe device at BDF\n");
+    printf("  -F, --lpc-fw BASE[:LENGTH[:OFFSET]]\n");
+    printf("                          Reach LPC FW space from OFFSET through the host's\n");
+    printf("                          physical address range at BASE, enabling the l2a\n");
+    printf("                          bridge\n");
+    printf("  -h, --help              Show this help\n");
+    printf("  -l, --list-bridges      List the available bridge drivers\n");
+    printf("  -m, --remeasure         Ignore saved bridge performance measurements\n");
+    printf("  -p, --pipeline DEPTH    Keep up to DEPTH debug UART commands in flight\n");
+    printf("  -q, --quiet             Suppress logging\n");
+    printf("  -R, --record FILE       Record all AHB accesses to FILE for replay\n");
+    printf("  -r, --register-bridge NAME\n");
+    printf("                          Use the named bridge for register accesses\n");
+    printf("  -s, --skip-bridge NAME  Don't probe the named bridge driver\n");
+    printf("  -S, --stripe            Split large transfers across all available bridges\n");
+    printf("  -t, --stats             Report statistics on AHB accesses at exit\n");
+    printf("  -T, --timeline FILE     Also record AHB accesses to FILE as Chrome trace events\n");
+    printf("  -v, --verbose           Increase logging verbosity\n");
+    printf("  -V, --version           Show the version\n");
+}
+
+/*
+ * BASE[:LENGTH[:OFFSET]], where LENGTH defaults to the 16MiB firmware decode of
+ * most chipsets, and OFFSET, the LPC FW address decoded at BASE, to 0
+ */
+static int parse_lpc_fw(const char *arg)
+{
+    unsigned long long base, len = 16 << 20, offset = 0;
+    char *end;
+
+    errno = 0;
+    base = strtoull(arg, &end, 0);
+    if (errno || end == arg)
+        return -EINVAL;
+
+    if (*end == ':') {
+        const char *start = end + 1;
+
+        len = strtoull(start, &end, 0);
+        if (errno || end == start)
+            return -EINVAL;
+    }
+
+    if (*end == ':') {
+        const char *start = end + 1;
+
+        offset = strtoull(start, &end, 0);
+        if (errno || end == start || offset > UINT32_MAX)
+            return -EINVAL;
+    }
+
+    if (*end || base > UINT64_MAX - len)
+        return -EINVAL;
+
+    return lpc_set_fw_window(base, len, offset);
 }
 
 struct command {
@@ -90,22 +169,38 @@ static const struct command cmds[] = {
     { "otp", cmd_otp },
     { "trace", cmd_trace },
     { "coprocessor", cmd_coprocessor},
+    { "bench", cmd_bench },
+    { "fleet", cmd_fleet },
     { },
 };
 
 int main(int argc, char *argv[])
 {
     const struct command *cmd = &cmds[0];
+    const char *per_process = NULL;
     bool show_help = false;
     bool quiet = false;
     int verbose = 0;
+    int rc;
 
     while (1) {
         static struct option long_options[] = {
+            { "bulk-bridge", required_argument, NULL, 'b' },
+            { "cache", no_argument, NULL, 'c' },
+            { "device", required_argument, NULL, 'd' },
             { "help", no_argument, NULL, 'h' },
+            { "max-baud", required_argument, NULL, 'B' },
+            { "pipeline", required_argument, NULL, 'p' },
             { "quiet", no_argument, NULL, 'q' },
+            { "record", required_argument, NULL, 'R' },
+            { "register-bridge", required_argument, NULL, 'r' },
+            { "remeasure", no_argument, NULL, 'm' },
             { "skip-bridge", required_argument, NULL, 's' },
+            { "stripe", no_argument, NULL, 'S' },
+            { "stats", no_argument, NULL, 't' },
+            { "timeline", required_argument, NULL, 'T' },
             { "list-bridges", no_argument, NULL, 'l' },
+            { "lpc-fw", required_argument, NULL, 'F' },
             { "verbose", no_argument, NULL, 'v' },
             { "version", no_argument, NULL, 'V' },
             { },
@@ -113,14 +208,51 @@ int main(int argc, char *argv[])
         int option_index = 0;
         int c;
 
-        c = getopt_long(argc, argv, "+hlqs:vV", long_options, &option_index);
+        c = getopt_long(argc, argv, "+b:B:cd:F:hlmp:qr:R:s:StT:vV", long_options, &option_index);
         if (c == -1)
             break;
 
         switch (c) {
+            case 'b':
+                host_set_bulk_bridge(optarg);
+                break;
+            case 'B':
+                if (debug_set_max_baud(strtol(optarg, NULL, 0))) {
+                    fprintf(stderr, "Error: debug UART rate must be at least 115200\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                soc_set_cache_enabled(true);
+                break;
+            case 'd':
+                per_process = "--device";
+                if (pci_set_device(optarg)) {
+                    fprintf(stderr, "Error: '%s' is not a PCIe address\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                /* The LPC bridges reach whichever BMC the host's LPC bus is attached to */
+                disable_bridge_driver("ilpc");
+                disable_bridge_driver("l2a");
+                disable_bridge_driver("devmem");
+                break;
+            case 'F':
+                if ((rc = parse_lpc_fw(optarg))) {
+                    fprintf(stderr, "Error: can't use LPC FW window '%s': %s\n",
+                            optarg, strerror(-rc));
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'h':
                 show_help = true;
                 break;
+            case 'p':
+                if (debug_set_depth(strtoul(optarg, NULL, 0))) {
+                    fprintf(stderr, "Error: pipeline depth must be between 1 and %d\n",
+                            DEBUG_DEPTH_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'l':
                 print_bridge_drivers();
                 exit(EXIT_SUCCESS);
@@ -131,15 +263,38 @@ int main(int argc, char *argv[])
             case 'V':
                 print_version(program_invocation_short_name);
                 exit(EXIT_SUCCESS);
+            case 'm':
+                host_set_remeasure(true);
+                break;
             case 'q':
                 quiet = true;
                 break;
+            case 'r':
+                host_set_register_bridge(optarg);
+                break;
+            case 'R':
+                per_process = "--record";
+                host_set_record(optarg);
+                break;
             case 's':
                 if (disable_bridge_driver(optarg)) {
                     fprintf(stderr, "Error: '%s' not a recognized bridge name (use '-l' to list)\n", optarg);
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'S':
+                host_set_striping(true);
+                break;
+            case 't':
+            case 'T':
+                if (c == 'T')
+                    per_process = "--timeline";
+                if ((rc = stats_enable(c == 'T' ? optarg : NULL))) {
+                    fprintf(stderr, "Error: failed to enable statistics: %s\n",
+                            strerror(-rc));
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case '?':
                 exit(EXIT_FAILURE);
             default:
@@ -162,12 +317,28 @@ int main(int argc, char *argv[])
         log_set_level(level_trace);
     }
 
+    /* Allow inspection of a stalled command without the cost of trace logging */
+    if ((rc = ahb_ring_dump_on_signal(SIGUSR1)) < 0)
+        logd("Failed to install SIGUSR1 handler: %s\n", strerror(-rc));
+
+    /* Each fleet target is run with the global options given here */
+    if (!strcmp("fleet", argv[optind])) {
+        if (per_process) {
+            fprintf(stderr, "Error: %s can't be shared by fleet targets\n",
+                    per_process);
+            exit(EXIT_FAILURE);
+        }
+
+        fleet_set_options(optind - 1, argv + 1);
+    }
+
     while (cmd->fn) {
         if (!strcmp(cmd->name, argv[optind])) {
             int offset = optind;
 
-            /* probe uses getopt, but for subcommands not using getopt */
-            if (strcmp("probe", argv[optind])) {
+            /* probe, bench and fleet use getopt, but for subcommands not using getopt */
+            if (strcmp("probe", argv[optind]) && strcmp("bench", argv[optind]) &&
+                    strcmp("fleet", argv[optind])) {
                 offset += 1;
             }
             optind = 1;
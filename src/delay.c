@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "delay.h"
+
+#include <time.h>
+
+static uint64_t delay_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void delay_ns(uint64_t ns)
+{
+    uint64_t end;
+
+    if (!ns)
+        return;
+
+    end = delay_now() + ns;
+
+    /* Sleep for long delays, but spin for short ones to keep them accurate */
+    if (ns > 100000) {
+        struct timespec ts = {
+            .tv_sec = (ns - 50000) / 1000000000ULL,
+            .tv_nsec = (ns - 50000) % 1000000000ULL,
+        };
+
+        nanosleep(&ts, NULL);
+    }
+
+    while (delay_now() < end)
+        ;
+}
@@ -0,0 +1,11 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _DELAY_H
+#define _DELAY_H
+
+#include <stdint.h>
+
+/* Wait for ns nanoseconds, accurately even for delays of a few microseconds */
+void delay_ns(uint64_t ns);
+
+#endif
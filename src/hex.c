@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "hex.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Each word is decoded from its 8 characters independently of the separators,
+ * so the vector paths can gather the words of a run into one register and
+ * decode them together. Within a word the first digit is the most significant.
+ */
+
+static inline int hex_nibble(uint8_t c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+static int hex_decode_1(const char *str, uint32_t *word)
+{
+    uint32_t val = 0;
+    int i;
+
+    for (i = 0; i < HEX_WORD_LEN; i++) {
+        int nibble = hex_nibble(str[i]);
+
+        if (nibble < 0)
+            return -EINVAL;
+
+        val = (val << 4) | nibble;
+    }
+
+    *word = val;
+
+    return 0;
+}
+
+static inline uint64_t hex_load64(const char *str)
+{
+    uint64_t val;
+
+    memcpy(&val, str, sizeof(val));
+
+    return val;
+}
+
+/*
+ * The nibble pairs of two words, packed into bytes in the order of the text
+ * from the least significant byte of pairs
+ */
+static inline void hex_store_2(uint64_t pairs, uint32_t *words)
+{
+    words[0] = __builtin_bswap32(pairs);
+    words[1] = __builtin_bswap32(pairs >> 32);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static int hex_decode_4_avx2(const char *str, uint32_t *words)
+{
+    __m256i c, lower, digit, alpha, nibbles, bytes;
+
+    c = _mm256_set_epi64x(hex_load64(str + 3 * HEX_WORD_STRIDE),
+                          hex_load64(str + 2 * HEX_WORD_STRIDE),
+                          hex_load64(str + 1 * HEX_WORD_STRIDE),
+                          hex_load64(str));
+    lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+
+    /* Characters from 0x80 are negative, and so fail both checks */
+    digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                             _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+    alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                             _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    if (_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != -1)
+        return -EINVAL;
+
+    nibbles = _mm256_blendv_epi8(
+                    _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10)),
+                    _mm256_sub_epi8(c, _mm256_set1_epi8('0')), digit);
+
+    /* Each 16-bit lane holds a digit pair, the more significant in the low byte */
+    bytes = _mm256_or_si256(
+                _mm256_and_si256(_mm256_slli_epi16(nibbles, 4),
+                                 _mm256_set1_epi16(0xff)),
+                _mm256_srli_epi16(nibbles, 8));
+    bytes = _mm256_packus_epi16(bytes, bytes);
+
+    hex_store_2(_mm256_extract_epi64(bytes, 0), &words[0]);
+    hex_store_2(_mm256_extract_epi64(bytes, 2), &words[2]);
+
+    return 0;
+}
+
+static int hex_decode_2_sse2(const char *str, uint32_t *words)
+{
+    __m128i c, lower, digit, alpha, nibbles, bytes;
+
+    c = _mm_set_epi64x(hex_load64(str + HEX_WORD_STRIDE), hex_load64(str));
+    lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+    digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                          _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                          _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff)
+        return -EINVAL;
+
+    nibbles = _mm_or_si128(
+                _mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                _mm_andnot_si128(digit,
+                                 _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+
+    bytes = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(nibbles, 4),
+                                       _mm_set1_epi16(0xff)),
+                         _mm_srli_epi16(nibbles, 8));
+    bytes = _mm_packus_epi16(bytes, bytes);
+
+    hex_store_2(_mm_cvtsi128_si64(bytes), words);
+
+    return 0;
+}
+
+static bool hex_have_avx2(void)
+{
+    static int avx2 = -1;
+
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2");
+    }
+
+    return avx2;
+}
+#elif defined(__VSX__)
+/* Written with the generic vector extensions, which lower to VSX */
+typedef uint8_t hex_u8x16 __attribute__((vector_size(16)));
+typedef int8_t hex_s8x16 __attribute__((vector_size(16)));
+
+static int hex_decode_2_vsx(const char *str, uint32_t *words)
+{
+    const hex_u8x16 even = { 0, 2, 4, 6, 8, 10, 12, 14, 0, 2, 4, 6, 8, 10, 12, 14 };
+    const hex_u8x16 odd = { 1, 3, 5, 7, 9, 11, 13, 15, 1, 3, 5, 7, 9, 11, 13, 15 };
+    hex_u8x16 c, lower, nibbles, bytes;
+    hex_s8x16 digit, alpha, valid;
+    uint64_t pairs;
+    int i;
+
+    memcpy(&c, str, HEX_WORD_LEN);
+    memcpy((uint8_t *)&c + HEX_WORD_LEN, str + HEX_WORD_STRIDE, HEX_WORD_LEN);
+    lower = c | 0x20;
+
+    digit = (c >= '0') & (c <= '9');
+    alpha = (lower >= 'a') & (lower <= 'f');
+    valid = digit | alpha;
+    for (i = 0; i < 16; i++) {
+        if (!valid[i])
+            return -EINVAL;
+    }
+
+    nibbles = ((c - '0') & (hex_u8x16)digit) |
+              ((lower - ('a' - 10)) & ~(hex_u8x16)digit);
+
+    bytes = (__builtin_shuffle(nibbles, even) << 4) |
+            __builtin_shuffle(nibbles, odd);
+
+    /* POWER hosts may be big-endian, where the first byte is most significant */
+    memcpy(&pairs, &bytes, sizeof(pairs));
+    hex_store_2(le64toh(pairs), words);
+
+    return 0;
+}
+#endif
+
+int hex_decode_words(const char *str, size_t count, uint32_t *words)
+{
+    size_t i;
+
+    for (i = 1; i < count; i++) {
+        if (str[i * HEX_WORD_STRIDE - 1] != ' ')
+            return -EINVAL;
+    }
+
+    i = 0;
+#if defined(__x86_64__)
+    if (count >= 4 && hex_have_avx2()) {
+        for (; i + 4 <= count; i += 4) {
+            if (hex_decode_4_avx2(str + i * HEX_WORD_STRIDE, &words[i]))
+                return -EINVAL;
+        }
+    }
+
+    for (; i + 2 <= count; i += 2) {
+        if (hex_decode_2_sse2(str + i * HEX_WORD_STRIDE, &words[i]))
+            return -EINVAL;
+    }
+#elif defined(__VSX__)
+    for (; i + 2 <= count; i += 2) {
+        if (hex_decode_2_vsx(str + i * HEX_WORD_STRIDE, &words[i]))
+            return -EINVAL;
+    }
+#endif
+
+    for (; i < count; i++) {
+        if (hex_decode_1(str + i * HEX_WORD_STRIDE, &words[i]))
+            return -EINVAL;
+    }
+
+    return 0;
+}
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _HEX_H
+#define _HEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The text of a 32-bit word, and of each word after the first in a run */
+#define HEX_WORD_LEN            8
+#define HEX_WORD_STRIDE         (HEX_WORD_LEN + 1)
+
+/*
+ * Decode count words of exactly HEX_WORD_LEN hexadecimal digits, separated by
+ * single spaces, as printed by the debug UART. Only the count * HEX_WORD_STRIDE
+ * - 1 bytes of the run are read, so str needn't be terminated.
+ *
+ * @return 0 on success, or -EINVAL if the run is malformed
+ */
+int hex_decode_words(const char *str, size_t count, uint32_t *words);
+
+#endif
@@ -11,15 +11,70 @@
 #include "compiler.h"
 #include "host.h"
 #include "log.h"
+#include "path.h"
+#include "pci.h"
+#include "rev.h"
+#include "record.h"
+#include "route.h"
+#include "stats.h"
+#include "stripe.h"
 
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 struct bridge {
 	struct list_node entry;
 	const struct bridge_driver *driver;
 	struct ahb *ahb;
+	/* Seconds per register access, 0 if not measured */
+	double latency;
+	/* Bulk transfer bytes per second, 0 if not measured */
+	double throughput;
 };
 
+/* SCU000 is readable without side-effects on all supported SoCs */
+#define HOST_MEASURE_REG        0x1e6e2000
+#define HOST_MEASURE_READS      16
+#define HOST_MEASURE_LEN        4096
+
+static bool host_striping;
+static bool host_remeasure;
+static const char *host_register_bridge;
+static const char *host_bulk_bridge;
+static const char *host_record;
+
+void host_set_striping(bool enable)
+{
+    host_striping = enable;
+}
+
+void host_set_register_bridge(const char *name)
+{
+    host_register_bridge = name;
+}
+
+void host_set_bulk_bridge(const char *name)
+{
+    host_bulk_bridge = name;
+}
+
+void host_set_remeasure(bool enable)
+{
+    host_remeasure = enable;
+}
+
+void host_set_record(const char *path)
+{
+    host_record = path;
+}
+
 void print_bridge_drivers(void)
 {
     struct bridge_driver **bridges;
@@ -66,6 +121,11 @@ int host_init(struct host *ctx, int argc, char *argv[])
     int rc;
 
     list_head_init(&ctx->bridges);
+    ctx->stripe = NULL;
+    ctx->route = NULL;
+    ctx->record = NULL;
+    ctx->stats = NULL;
+    ctx->routed = NULL;
 
     bridges = autodata_get(bridge_drivers, &n_bridges);
 
@@ -92,6 +152,8 @@ int host_init(struct host *ctx, int argc, char *argv[])
 
             bridge->driver = bridges[i];
             bridge->ahb = ahb;
+            bridge->latency = 0;
+            bridge->throughput = 0;
 
             list_add(&ctx->bridges, &bridge->entry);
         }
@@ -109,6 +171,25 @@ void host_destroy(struct host *ctx)
 {
     struct bridge *bridge, *next;
 
+    free(ctx->stats);
+    ctx->stats = NULL;
+
+    if (ctx->record) {
+        record_destroy(ctx->record);
+        free(ctx->record);
+        ctx->record = NULL;
+    }
+
+    free(ctx->route);
+    ctx->route = NULL;
+    ctx->routed = NULL;
+
+    if (ctx->stripe) {
+        stripe_destroy(ctx->stripe);
+        free(ctx->stripe);
+        ctx->stripe = NULL;
+    }
+
     list_for_each_safe(&ctx->bridges, bridge, next, entry) {
         bridge->driver->destroy(bridge->ahb);
         list_del(&bridge->entry);
@@ -116,18 +197,401 @@ void host_destroy(struct host *ctx)
     }
 }
 
-struct ahb *host_get_ahb(struct host *ctx)
+/*
+ * Bridges that contend for the same hardware resource can't make progress
+ * concurrently, so only stripe across bridges whose resources are disjoint.
+ */
+static struct ahb *host_get_stripe(struct host *ctx, struct bridge *primary)
+{
+    unsigned int resources = primary->driver->resources;
+    struct bridge *bridge;
+    int rc;
+
+    if (ctx->stripe)
+        return stripe_as_ahb(ctx->stripe);
+
+    ctx->stripe = malloc(sizeof(*ctx->stripe));
+    if (!ctx->stripe)
+        return primary->ahb;
+
+    if ((rc = stripe_init(ctx->stripe, primary->ahb)) < 0) {
+        logd("Failed to initialise striping: %d\n", rc);
+        goto cleanup_stripe;
+    }
+
+    list_for_each(&ctx->bridges, bridge, entry) {
+        if (bridge == primary)
+            continue;
+
+        if (bridge->driver->local != primary->driver->local)
+            continue;
+
+        if (bridge->driver->resources & resources) {
+            logd("Not striping across the %s bridge as it shares resources with a selected bridge\n",
+                 bridge->driver->name);
+            continue;
+        }
+
+        if ((rc = stripe_add_path(ctx->stripe, bridge->ahb)) < 0)
+            break;
+
+        resources |= bridge->driver->resources;
+    }
+
+    if (ctx->stripe->n_paths > 1)
+        return stripe_as_ahb(ctx->stripe);
+
+    logd("No additional bridges available for striping\n");
+    stripe_destroy(ctx->stripe);
+
+cleanup_stripe:
+    free(ctx->stripe);
+    ctx->stripe = NULL;
+
+    return primary->ahb;
+}
+
+static double host_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct bridge *host_find_bridge(struct host *ctx, const char *name)
+{
+    struct bridge *bridge;
+
+    list_for_each(&ctx->bridges, bridge, entry) {
+        if (!strcmp(bridge->driver->name, name))
+            return bridge;
+    }
+
+    return NULL;
+}
+
+/*
+ * Measurements are kept per target, identified by the selected PCIe device (if
+ * any) and the SoC revision, as the same bridge can perform very differently
+ * against another BMC or from another host.
+ */
+static void host_load_measurements(struct host *ctx, const char *target)
+{
+    char path[PATH_MAX];
+    double latency, throughput;
+    char id[64], name[64];
+    FILE *file;
+
+    if (path_cache_file("bridges", path, sizeof(path), false) < 0)
+        return;
+
+    if (!(file = fopen(path, "r")))
+        return;
+
+    while (fscanf(file, "%63s %63s %lf %lf", id, name, &latency, &throughput) == 4) {
+        struct bridge *bridge;
+
+        if (strcmp(id, target) || !(bridge = host_find_bridge(ctx, name)))
+            continue;
+
+        if (latency <= 0 || throughput <= 0)
+            continue;
+
+        bridge->latency = latency;
+        bridge->throughput = throughput;
+    }
+
+    fclose(file);
+}
+
+static void host_save_measurements(struct host *ctx, const char *target)
+{
+    char path[PATH_MAX], tmp[PATH_MAX + 4];
+    double latency, throughput;
+    char id[64], name[64];
+    struct bridge *bridge;
+    FILE *old, *file;
+    int rc;
+
+    if ((rc = path_cache_file("bridges", path, sizeof(path), true)) < 0) {
+        logd("Not saving bridge measurements: %d\n", rc);
+        return;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.new", path);
+
+    if (!(file = fopen(tmp, "w"))) {
+        logd("Failed to save bridge measurements to %s: %s\n", tmp,
+             strerror(errno));
+        return;
+    }
+
+    /* Keep the measurements for other targets and bridges not probed now */
+    if ((old = fopen(path, "r"))) {
+        while (fscanf(old, "%63s %63s %lf %lf", id, name, &latency,
+                      &throughput) == 4) {
+            if (strcmp(id, target) || !host_find_bridge(ctx, name))
+                fprintf(file, "%s %s %.9g %.9g\n", id, name, latency,
+                        throughput);
+        }
+        fclose(old);
+    }
+
+    list_for_each(&ctx->bridges, bridge, entry) {
+        if (bridge->latency > 0 && bridge->throughput > 0)
+            fprintf(file, "%s %s %.9g %.9g\n", target, bridge->driver->name,
+                    bridge->latency, bridge->throughput);
+    }
+
+    if (fclose(file) || rename(tmp, path) < 0) {
+        logd("Failed to save bridge measurements to %s: %s\n", path,
+             strerror(errno));
+        unlink(tmp);
+    }
+}
+
+static int host_measure_bridge(struct bridge *bridge, uint32_t dram)
+{
+    double start, elapsed;
+    uint32_t val;
+    ssize_t rc;
+    void *buf;
+    int i;
+
+    start = host_now();
+    for (i = 0; i < HOST_MEASURE_READS; i++) {
+        if ((rc = ahb_readl(bridge->ahb, HOST_MEASURE_REG, &val)) < 0)
+            return rc;
+    }
+    elapsed = host_now() - start;
+
+    if (!(buf = malloc(HOST_MEASURE_LEN)))
+        return -ENOMEM;
+
+    start = host_now();
+    rc = ahb_read(bridge->ahb, dram, buf, HOST_MEASURE_LEN);
+    free(buf);
+    if (rc < 0)
+        return rc;
+
+    /* Guard against clocks too coarse to measure fast local bridges */
+    bridge->latency = elapsed > 0 ? elapsed / HOST_MEASURE_READS : 1e-9;
+    elapsed = host_now() - start;
+    bridge->throughput = HOST_MEASURE_LEN / (elapsed > 0 ? elapsed : 1e-9);
+
+    return 0;
+}
+
+static int host_measure_bridges(struct host *ctx, struct bridge *primary)
 {
     struct bridge *bridge;
+    const char *device = pci_get_device();
+    bool measured = false;
+    char target[64];
+    uint32_t dram;
+    int64_t rev;
+    int rc;
+
+    rev = rev_probe(primary->ahb);
+    if (rev < 0)
+        return rev;
+
+    snprintf(target, sizeof(target), "%s/%08" PRIx32, device ? device : "any",
+             (uint32_t)rev);
+
+    if (!host_remeasure)
+        host_load_measurements(ctx, target);
+
+    dram = rev_is_generation(rev, ast_g4) ? 0x40000000 : 0x80000000;
+
+    list_for_each(&ctx->bridges, bridge, entry) {
+        if (bridge->driver->local != primary->driver->local)
+            continue;
+
+        if (!host_remeasure && bridge->latency > 0 && bridge->throughput > 0) {
+            logd("Using saved measurements for the %s bridge\n",
+                 bridge->driver->name);
+            continue;
+        }
+
+        bridge->latency = 0;
+        bridge->throughput = 0;
+
+        if ((rc = host_measure_bridge(bridge, dram)) < 0) {
+            logd("Failed to measure the %s bridge: %d\n", bridge->driver->name,
+                 rc);
+            continue;
+        }
 
-    bridge = list_top(&ctx->bridges, struct bridge, entry);
+        measured = true;
+    }
+
+    if (measured)
+        host_save_measurements(ctx, target);
+
+    return 0;
+}
+
+/*
+ * Register accesses are dominated by round-trip latency while bulk transfers
+ * are dominated by throughput, and the best bridge for each can differ. For
+ * instance, L2A is much faster than iLPC for bulk transfers, while P2A needs
+ * to move its window for register accesses scattered across the AHB.
+ */
+static int host_select_bridges(struct host *ctx, struct bridge *primary,
+                               struct bridge **regs, struct bridge **bulk)
+{
+    struct bridge *bridge;
+    size_t candidates = 0;
+    int rc;
+
+    *regs = NULL;
+    *bulk = NULL;
+
+    if (host_register_bridge && !(*regs = host_find_bridge(ctx, host_register_bridge))) {
+        loge("The %s bridge is not available for register accesses\n",
+             host_register_bridge);
+        return -ENOENT;
+    }
+
+    if (host_bulk_bridge && !(*bulk = host_find_bridge(ctx, host_bulk_bridge))) {
+        loge("The %s bridge is not available for bulk transfers\n",
+             host_bulk_bridge);
+        return -ENOENT;
+    }
+
+    list_for_each(&ctx->bridges, bridge, entry) {
+        if (bridge->driver->local == primary->driver->local)
+            candidates++;
+    }
+
+    if ((*regs && *bulk) || candidates < 2)
+        goto out;
+
+    if ((rc = host_measure_bridges(ctx, primary)) < 0) {
+        logd("Failed to measure the available bridges: %d\n", rc);
+        goto out;
+    }
+
+    list_for_each(&ctx->bridges, bridge, entry) {
+        if (bridge->driver->local != primary->driver->local)
+            continue;
+
+        if (!(bridge->latency > 0 && bridge->throughput > 0))
+            continue;
 
-    if (bridge) {
+        logd("The %s bridge takes %.1fus per register access and transfers %.1fKiB/s\n",
+             bridge->driver->name, bridge->latency * 1e6,
+             bridge->throughput / 1024);
+
+        if (!host_register_bridge &&
+                (!*regs || bridge->latency < (*regs)->latency))
+            *regs = bridge;
+
+        if (!host_bulk_bridge &&
+                (!*bulk || bridge->throughput > (*bulk)->throughput))
+            *bulk = bridge;
+    }
+
+out:
+    if (!*regs)
+        *regs = primary;
+
+    if (!*bulk)
+        *bulk = primary;
+
+    return 0;
+}
+
+static struct ahb *host_get_routed_ahb(struct host *ctx)
+{
+    struct bridge *primary, *regs, *bulk;
+    struct ahb *ahb;
+
+    if (ctx->routed)
+        return ctx->routed;
+
+    primary = list_top(&ctx->bridges, struct bridge, entry);
+
+    if (!primary) {
+        loge("Bridge discovery failed, cannot access BMC AHB\n");
+        return NULL;
+    }
+
+    if (host_select_bridges(ctx, primary, &regs, &bulk) < 0)
+        return NULL;
+
+    ahb = host_striping ? host_get_stripe(ctx, bulk) : bulk->ahb;
+
+    if (regs == bulk) {
         logd("Accessing the BMC's AHB via the %s bridge\n",
-             bridge->driver->name);
-        return bridge->ahb;
+             bulk->driver->name);
+        return ctx->routed = ahb;
+    }
+
+    logd("Accessing the BMC's AHB via the %s bridge for register accesses and the %s bridge for bulk transfers\n",
+         regs->driver->name, bulk->driver->name);
+
+    ctx->route = malloc(sizeof(*ctx->route));
+    if (!ctx->route)
+        return ctx->routed = ahb;
+
+    route_init(ctx->route, ahb, regs->ahb);
+
+    return ctx->routed = route_as_ahb(ctx->route);
+}
+
+struct ahb *host_get_ahb(struct host *ctx)
+{
+    struct ahb *ahb;
+
+    if (ctx->stats)
+        return stats_as_ahb(ctx->stats);
+
+    if (!(ahb = host_get_routed_ahb(ctx)))
+        return NULL;
+
+    if (host_record && !ctx->record) {
+        int rc;
+
+        if (!(ctx->record = malloc(sizeof(*ctx->record))))
+            return NULL;
+
+        if ((rc = record_init(ctx->record, ahb, host_record)) < 0) {
+            loge("Failed to record AHB accesses to %s: %d\n", host_record, rc);
+            free(ctx->record);
+            ctx->record = NULL;
+            return NULL;
+        }
+
+        logi("Recording AHB accesses to %s\n", host_record);
+    }
+
+    if (ctx->record)
+        ahb = record_as_ahb(ctx->record);
+
+    if (!stats_enabled())
+        return ahb;
+
+    ctx->stats = malloc(sizeof(*ctx->stats));
+    if (!ctx->stats)
+        return ahb;
+
+    stats_init(ctx->stats, ahb);
+
+    return stats_as_ahb(ctx->stats);
+}
+
+struct ahb *host_get_bridge(struct host *ctx, unsigned int index)
+{
+    struct bridge *bridge;
+
+    list_for_each(&ctx->bridges, bridge, entry) {
+        if (!index--)
+            return bridge->ahb;
     }
 
-    loge("Bridge discovery failed, cannot access BMC AHB\n");
     return NULL;
 }
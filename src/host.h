@@ -8,10 +8,29 @@
 
 #include "ccan/list/list.h"
 
+#include <stdbool.h>
+
+struct record;
+struct route;
+struct stats;
+struct stripe;
+
 struct host {
 	struct list_head bridges;
+	struct stripe *stripe;
+	struct route *route;
+	struct record *record;
+	struct stats *stats;
+	/* The routed interface, once bridges have been selected */
+	struct ahb *routed;
 };
 
+void host_set_striping(bool enable);
+void host_set_register_bridge(const char *name);
+void host_set_bulk_bridge(const char *name);
+void host_set_remeasure(bool enable);
+void host_set_record(const char *path);
+
 int host_init(struct host *ctx, int argc, char *argv[]);
 void host_destroy(struct host *ctx);
 
@@ -20,6 +39,9 @@ void print_bridge_drivers(void);
 
 struct ahb *host_get_ahb(struct host *ctx);
 
+/* Access the individual probed bridges, bypassing any routing or striping */
+struct ahb *host_get_bridge(struct host *ctx, unsigned int index);
+
 static inline int host_bridge_release_from_ahb(struct ahb *ahb)
 {
 	return ahb->drv->release ? ahb->drv->release(ahb) : 0;
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "layer.h"
+
+#include <stddef.h>
+
+int ahb_layer_release(struct ahb *ahb)
+{
+    return ahb_release_bridge(ahb_layer_from_ahb(ahb)->lower);
+}
+
+int ahb_layer_reinit(struct ahb *ahb)
+{
+    return ahb_reinit_bridge(ahb_layer_from_ahb(ahb)->lower);
+}
+
+int ahb_layer_begin(struct ahb *ahb)
+{
+    return ahb_begin_session(ahb_layer_from_ahb(ahb)->lower);
+}
+
+void ahb_layer_end(struct ahb *ahb)
+{
+    ahb_end_session(ahb_layer_from_ahb(ahb)->lower);
+}
+
+void ahb_layer_init(struct ahb_layer *ctx, struct ahb *lower,
+                    const struct ahb_ops *ops)
+{
+    ctx->lower = lower;
+
+    ctx->drv = *lower->drv;
+    ctx->drv.probe = NULL;
+    ctx->drv.destroy = NULL;
+    ctx->drv.release = ahb_layer_release;
+    ctx->drv.reinit = ahb_layer_reinit;
+    ctx->drv.begin = ahb_layer_begin;
+    ctx->drv.end = ahb_layer_end;
+
+    ahb_init_ops(&ctx->ahb, &ctx->drv, ops);
+    ctx->ahb.layer = true;
+}
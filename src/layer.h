@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _LAYER_H
+#define _LAYER_H
+
+#include "ahb.h"
+#include "bridge.h"
+
+/*
+ * An AHB layer stacks on top of another AHB interface to add behaviour such
+ * as caching. The layer presents the name and locality of the bridge it wraps,
+ * and forwards bridge release, reinit and session requests down the stack.
+ */
+struct ahb_layer {
+    struct ahb ahb;
+    struct bridge_driver drv;
+    struct ahb *lower;
+};
+
+void ahb_layer_init(struct ahb_layer *ctx, struct ahb *lower,
+                    const struct ahb_ops *ops);
+
+static inline struct ahb *ahb_layer_as_ahb(struct ahb_layer *ctx)
+{
+    return &ctx->ahb;
+}
+
+static inline struct ahb_layer *ahb_layer_from_ahb(struct ahb *ahb)
+{
+    return (struct ahb_layer *)ahb;
+}
+
+int ahb_layer_release(struct ahb *ahb);
+int ahb_layer_reinit(struct ahb *ahb);
+int ahb_layer_begin(struct ahb *ahb);
+void ahb_layer_end(struct ahb *ahb);
+
+#endif
@@ -19,7 +19,7 @@ const int log_colour_lookup[] = {
     [level_error] = colour_red,
 };
 
-static enum log_level log_current_level;
+enum log_level log_current_level;
 
 static void log_write_all(int fd, const char *buf, size_t len)
 {
@@ -1,6 +1,8 @@
 #ifndef _LOG_H
 #define _LOG_H
 
+#include <stdbool.h>
+
 enum log_level { level_none, level_error, level_info, level_debug, level_trace };
 
 enum log_colour { colour_white, colour_yellow, colour_green, colour_red };
@@ -11,9 +13,23 @@ void log_highlight(int fd, enum log_colour, const char *fmt, ...);
 
 void log_set_level(enum log_level);
 
-#define logt(f, ...) log_msg(level_trace, f, ##__VA_ARGS__)
-#define logd(f, ...) log_msg(level_debug, f, ##__VA_ARGS__)
-#define logi(f, ...) log_msg(level_info, f, ##__VA_ARGS__)
-#define loge(f, ...) log_msg(level_error, f, ##__VA_ARGS__)
+extern enum log_level log_current_level;
+
+static inline bool log_enabled(enum log_level lvl)
+{
+    return lvl <= log_current_level;
+}
+
+/* Test the level before the call so disabled messages cost no formatting */
+#define log_gated(lvl, f, ...) \
+    do { \
+        if (log_enabled(lvl)) \
+            log_msg(lvl, f, ##__VA_ARGS__); \
+    } while (0)
+
+#define logt(f, ...) log_gated(level_trace, f, ##__VA_ARGS__)
+#define logd(f, ...) log_gated(level_debug, f, ##__VA_ARGS__)
+#define logi(f, ...) log_gated(level_info, f, ##__VA_ARGS__)
+#define loge(f, ...) log_gated(level_error, f, ##__VA_ARGS__)
 
 #endif
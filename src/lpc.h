@@ -11,13 +11,76 @@
 #include <stddef.h>
 #include <stdint.h>
 
+struct lpc_ring;
+
 struct lpc
 {
     int fd;
     const char *space;
+    /* Delay after each access, for devices that can't keep up with the host */
+    unsigned int delay;
+    /* Mapping of the space, where it's memory-mapped by the host */
+    void *map;
+    size_t len;
+    /* The LPC address of offset 0 in the space */
+    uint32_t base;
+    /* Submission queue for batches, where the host provides one */
+    struct lpc_ring *ring;
+};
+
+enum lpc_op_type { lpc_op_read, lpc_op_write };
+
+/*
+ * An access in a batch submitted with lpc_submit(). The ops are executed in
+ * order and execution stops at the first failure, including a short transfer.
+ */
+struct lpc_op {
+    enum lpc_op_type type;
+    size_t addr;
+    void *buf;          /* lpc_op_read */
+    const void *src;    /* lpc_op_write */
+    size_t len;
 };
 
+#define LPC_DELAY_MAX   8
+
+static inline void lpc_set_delay(struct lpc *ctx, unsigned int delay)
+{
+    ctx->delay = delay;
+}
+
+/*
+ * Find the smallest delay for which test, a self-test of the device behind
+ * the port I/O, passes. The test returns 1 on success, 0 on failure, or a
+ * negative error code.
+ */
+static inline int lpc_calibrate(struct lpc *ctx,
+                                int (*test)(struct lpc *ctx, void *data),
+                                void *data)
+{
+    unsigned int delay;
+    int rc;
+
+    for (delay = 0; delay <= LPC_DELAY_MAX; delay = delay ? delay << 1 : 1) {
+        lpc_set_delay(ctx, delay);
+
+        if ((rc = test(ctx, data)))
+            return rc < 0 ? rc : 0;
+    }
+
+    lpc_set_delay(ctx, 0);
+
+    return -EIO;
+}
+
 #if HAVE_LPC
+/*
+ * Where the host chipset decodes LPC FW cycles into its physical address space,
+ * locate the window: len bytes at host address base, which the chipset decodes
+ * to LPC FW address offset.
+ */
+int lpc_set_fw_window(uint64_t base, size_t len, uint32_t offset);
+
 int lpc_init(struct lpc *ctx, const char *space);
 int lpc_destroy(struct lpc *ctx);
 
@@ -30,7 +93,16 @@ int lpc_writel(struct lpc *ctx, size_t addr, uint32_t val);
 
 int lpc_read(struct lpc *ctx, size_t addr, void *val, size_t size);
 int lpc_write(struct lpc *ctx, size_t addr, const void *val, size_t size);
+
+int lpc_submit(struct lpc *ctx, struct lpc_op *ops, size_t n);
 #else
+static inline int
+lpc_set_fw_window(uint64_t base __unused, size_t len __unused,
+                  uint32_t offset __unused)
+{
+    return -ENOTSUP;
+}
+
 static inline int
 lpc_init(struct lpc *ctx __unused, const char *space __unused)
 {
@@ -96,6 +168,13 @@ lpc_write(struct lpc *ctx __unused, size_t addr __unused, const void *val
 {
     return -ENOTSUP;
 }
+
+static inline int
+lpc_submit(struct lpc *ctx __unused, struct lpc_op *ops __unused,
+           size_t n __unused)
+{
+    return -ENOTSUP;
+}
 #endif
 
 #endif
@@ -4,41 +4,192 @@
 #include "mb.h"
 #include "mmio.h"
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
-volatile void *mmio_memcpy(volatile void * restrict dst, const volatile void * restrict src, size_t len)
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__VSX__)
+#include <altivec.h>
+#endif
+
+/*
+ * The MMIO side of each copy is always accessed naturally aligned, using the
+ * widest access permitted at each position. The memory side may have any
+ * alignment and is accessed through memcpy(), which compiles to unaligned
+ * loads and stores, or to shifts and merges where they aren't supported.
+ */
+
+#if defined(__x86_64__)
+__attribute__((target("avx")))
+static void mmio_read_32(void *dst, const volatile void *src)
 {
-    if (((unsigned long)src & 0x3) != ((unsigned long)dst & 0x3)) {
-        while (len) {
-            *(volatile uint8_t * restrict)dst++ = *(const volatile uint8_t * restrict)src++;
-            len--;
-        }
+    __m256i v = _mm256_load_si256((const __m256i *)src);
 
-        iob();
+    _mm256_storeu_si256((__m256i *)dst, v);
+}
 
-        return dst;
-    }
+__attribute__((target("avx")))
+static void mmio_write_32(volatile void *dst, const void *src)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)src);
 
-    while (len && ((unsigned long)src & 0x3) && ((unsigned long)dst & 0x3)) {
-        *(volatile uint8_t * restrict)dst++ = *(const volatile uint8_t * restrict)src++;
-        len--;
-    }
+    _mm256_store_si256((__m256i *)dst, v);
+}
+
+static void mmio_read_16(void *dst, const volatile void *src)
+{
+    __m128i v = _mm_load_si128((const __m128i *)src);
+
+    _mm_storeu_si128((__m128i *)dst, v);
+}
 
-    while (len > 3) {
-        const volatile uint32_t * restrict tsrc = src;
-        volatile uint32_t * restrict tdst = dst;
-        *tdst = *tsrc;
-        len -= sizeof(*tdst);
-        src += sizeof(*tsrc);
-        dst += sizeof(*tdst);
+static void mmio_write_16(volatile void *dst, const void *src)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)src);
+
+    _mm_store_si128((__m128i *)dst, v);
+}
+#elif defined(__VSX__)
+static void mmio_read_16(void *dst, const volatile void *src)
+{
+    vec_xst(vec_xl(0, (const unsigned int *)src), 0, (unsigned int *)dst);
+}
+
+static void mmio_write_16(volatile void *dst, const void *src)
+{
+    vec_xst(vec_xl(0, (const unsigned int *)src), 0, (unsigned int *)dst);
+}
+#endif
+
+size_t mmio_cpu_width(void)
+{
+#if defined(__x86_64__)
+    static size_t width;
+
+    if (!width) {
+        __builtin_cpu_init();
+        width = __builtin_cpu_supports("avx") ? 32 : 16;
     }
 
+    return width;
+#elif defined(__VSX__)
+    return 16;
+#else
+    return sizeof(uint64_t);
+#endif
+}
+
+static inline size_t mmio_unit(uintptr_t addr, size_t len, size_t width)
+{
+    size_t unit = width;
+
+    while (unit > 1 && ((addr & (unit - 1)) || len < unit))
+        unit >>= 1;
+
+    return unit;
+}
+
+void mmio_read(void *dst, const volatile void *src, size_t len, size_t width)
+{
+    uint8_t *cursor = dst;
+
+    if (width > mmio_cpu_width())
+        width = mmio_cpu_width();
+
     while (len) {
-        *(volatile uint8_t * restrict)dst++ = *(const volatile uint8_t * restrict)src++;
-        len--;
+        size_t unit = mmio_unit((uintptr_t)src, len, width);
+
+        switch (unit) {
+#if defined(__x86_64__)
+            case 32:
+                mmio_read_32(cursor, src);
+                break;
+#endif
+#if defined(__x86_64__) || defined(__VSX__)
+            case 16:
+                mmio_read_16(cursor, src);
+                break;
+#endif
+            case 8: {
+                uint64_t v = *(const volatile uint64_t *)src;
+                memcpy(cursor, &v, sizeof(v));
+                break;
+            }
+            case 4: {
+                uint32_t v = *(const volatile uint32_t *)src;
+                memcpy(cursor, &v, sizeof(v));
+                break;
+            }
+            case 2: {
+                uint16_t v = *(const volatile uint16_t *)src;
+                memcpy(cursor, &v, sizeof(v));
+                break;
+            }
+            default:
+                unit = 1;
+                *cursor = *(const volatile uint8_t *)src;
+                break;
+        }
+
+        src = (const volatile uint8_t *)src + unit;
+        cursor += unit;
+        len -= unit;
     }
 
     iob();
+}
+
+void mmio_write(volatile void *dst, const void *src, size_t len, size_t width)
+{
+    const uint8_t *cursor = src;
+
+    if (width > mmio_cpu_width())
+        width = mmio_cpu_width();
+
+    while (len) {
+        size_t unit = mmio_unit((uintptr_t)dst, len, width);
 
-    return dst;
+        switch (unit) {
+#if defined(__x86_64__)
+            case 32:
+                mmio_write_32(dst, cursor);
+                break;
+#endif
+#if defined(__x86_64__) || defined(__VSX__)
+            case 16:
+                mmio_write_16(dst, cursor);
+                break;
+#endif
+            case 8: {
+                uint64_t v;
+                memcpy(&v, cursor, sizeof(v));
+                *(volatile uint64_t *)dst = v;
+                break;
+            }
+            case 4: {
+                uint32_t v;
+                memcpy(&v, cursor, sizeof(v));
+                *(volatile uint32_t *)dst = v;
+                break;
+            }
+            case 2: {
+                uint16_t v;
+                memcpy(&v, cursor, sizeof(v));
+                *(volatile uint16_t *)dst = v;
+                break;
+            }
+            default:
+                unit = 1;
+                *(volatile uint8_t *)dst = *cursor;
+                break;
+        }
+
+        dst = (volatile uint8_t *)dst + unit;
+        cursor += unit;
+        len -= unit;
+    }
+
+    iob();
 }
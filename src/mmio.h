@@ -6,6 +6,15 @@
 
 #include <stddef.h>
 
-volatile void *mmio_memcpy(volatile void *dst, const volatile void *src, size_t len);
+/* The widest single access the CPU can make, in bytes */
+size_t mmio_cpu_width(void);
+
+/*
+ * Copy between memory and MMIO using naturally aligned accesses of at most
+ * width bytes on the MMIO side, which must not be wider than the device
+ * supports. Either side may have any alignment.
+ */
+void mmio_read(void *dst, const volatile void *src, size_t len, size_t width);
+void mmio_write(volatile void *dst, const void *src, size_t len, size_t width);
 
 #endif
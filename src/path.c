@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "path.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+int path_cache_file(const char *name, char *path, size_t len, bool create)
+{
+    const char *base, *fmt;
+    char dir[PATH_MAX];
+    int rc;
+
+    if ((base = getenv("XDG_CACHE_HOME")) && *base) {
+        fmt = "%s";
+    } else if ((base = getenv("HOME")) && *base) {
+        fmt = "%s/.cache";
+    } else {
+        return -ENOENT;
+    }
+
+    rc = snprintf(dir, sizeof(dir), fmt, base);
+    if (rc < 0 || (size_t)rc >= sizeof(dir))
+        return -ENAMETOOLONG;
+
+    if (create && mkdir(dir, 0755) < 0 && errno != EEXIST)
+        return -errno;
+
+    rc = snprintf(path, len, "%s/culvert", dir);
+    if (rc < 0 || (size_t)rc >= len)
+        return -ENAMETOOLONG;
+
+    if (create && mkdir(path, 0755) < 0 && errno != EEXIST)
+        return -errno;
+
+    rc = snprintf(path, len, "%s/culvert/%s", dir, name);
+    if (rc < 0 || (size_t)rc >= len)
+        return -ENAMETOOLONG;
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _PATH_H
+#define _PATH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Locate NAME in culvert's cache directory, optionally creating the directory */
+int path_cache_file(const char *name, char *path, size_t len, bool create);
+
+#endif
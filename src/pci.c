@@ -13,10 +13,16 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <limits.h>
+#include <stdbool.h>
 
+#include "path.h"
 #include "pci.h"
 #include "shell.h"
 
+#define PCI_DEVICES		"/sys/bus/pci/devices/"
+#define PCI_MAX_DEVICES		64
+
 int read_sysfs_id(int dirfd, const char *file)
 {
 	char id_string[7];
@@ -42,19 +48,68 @@ int read_sysfs_id(int dirfd, const char *file)
 	return id;
 }
 
-int pci_open(uint16_t vid, uint16_t did, int bar)
+static char pci_device[PCI_BDF_LEN];
+
+int pci_parse_bdf(const char *bdf, char *out)
+{
+	unsigned int domain, bus, dev, fn;
+	int end = -1;
+
+	/* Accept both DDDD:BB:DD.F and the BB:DD.F shorthand used by lspci */
+	if (sscanf(bdf, "%4x:%2x:%2x.%1x%n", &domain, &bus, &dev, &fn, &end) != 4 ||
+	    bdf[end]) {
+		domain = 0;
+		end = -1;
+		if (sscanf(bdf, "%2x:%2x.%1x%n", &bus, &dev, &fn, &end) != 3 ||
+		    bdf[end])
+			return -EINVAL;
+	}
+
+	if (dev > 0x1f || fn > 0x7)
+		return -EINVAL;
+
+	snprintf(out, PCI_BDF_LEN, "%04x:%02x:%02x.%x", domain, bus, dev, fn);
+
+	return 0;
+}
+
+int pci_set_device(const char *bdf)
+{
+	return pci_parse_bdf(bdf, pci_device);
+}
+
+const char *pci_get_device(void)
+{
+	return *pci_device ? pci_device : NULL;
+}
+
+static bool pci_device_is(const char *bdf, uint16_t vid, uint16_t did)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), PCI_DEVICES "%s/vendor", bdf);
+	if (read_sysfs_id(AT_FDCWD, path) != vid)
+		return false;
+
+	snprintf(path, sizeof(path), PCI_DEVICES "%s/device", bdf);
+
+	return read_sysfs_id(AT_FDCWD, path) == did;
+}
+
+static int pci_bdf_cmp(const void *a, const void *b)
 {
-        char *res;
-        int rc;
-        int fd;
-	int found = 0;
+	return strcmp(a, b);
+}
 
+int pci_list(uint16_t vid, uint16_t did, char (*bdfs)[PCI_BDF_LEN], size_t len)
+{
 	struct dirent *de;
+	size_t found = 0;
+	char path[300]; /* de->d_name has a max of 255, and add some change */
 	int dfd;
 	DIR *d;
-	char path[300]; /* de->d_name has a max of 255, and add some change */
 
-	d = opendir("/sys/bus/pci/devices/");
+	d = opendir(PCI_DEVICES);
 	if (!d)
 		return -errno;
 
@@ -72,29 +127,145 @@ int pci_open(uint16_t vid, uint16_t did, int bar)
 		snprintf(path, sizeof(path), "%s/device", de->d_name);
 		this_did = read_sysfs_id(dfd, path);
 
+		if (this_vid != vid || this_did != did)
+			continue;
+
+		if (strlen(de->d_name) >= PCI_BDF_LEN)
+			continue;
+
+		if (found < len)
+			strcpy(bdfs[found], de->d_name);
+
+		found++;
+	}
+
+	closedir(d);
+
+	/* readdir() order is arbitrary, so sort to keep the first match stable */
+	qsort(bdfs, found < len ? found : len, PCI_BDF_LEN, pci_bdf_cmp);
+
+	return found;
+}
+
+/*
+ * Walking every PCI device in sysfs is slow on large systems, so remember
+ * where the devices were found. Entries are checked against sysfs before use,
+ * so a stale index only costs a rescan.
+ */
+static bool pci_index_lookup(uint16_t vid, uint16_t did, char *bdf)
+{
+	unsigned int this_vid, this_did;
+	char path[PATH_MAX];
+	char this[PCI_BDF_LEN];
+	bool found = false;
+	FILE *index;
+
+	if (path_cache_file("pci", path, sizeof(path), false) < 0)
+		return false;
+
+	if (!(index = fopen(path, "r")))
+		return false;
+
+	while (fscanf(index, "%x %x %15s", &this_vid, &this_did, this) == 3) {
 		if (this_vid == vid && this_did == did) {
-			found = 1;
+			found = pci_device_is(this, vid, did);
 			break;
 		}
 	}
 
-	/* NB: dfd and de->d_name are both invalidated by closedir() */
-	if (!found) {
-		closedir(d);
-		return -ENOENT;
+	fclose(index);
+
+	if (found)
+		strcpy(bdf, this);
+
+	return found;
+}
+
+static void pci_index_save(uint16_t vid, uint16_t did,
+			   char (*bdfs)[PCI_BDF_LEN], size_t n)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	unsigned int this_vid, this_did;
+	char this[PCI_BDF_LEN];
+	FILE *old, *index;
+	size_t i;
+
+	if (path_cache_file("pci", path, sizeof(path), true) < 0)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+
+	if (!(index = fopen(tmp, "w")))
+		return;
+
+	/* Keep the entries for other devices */
+	if ((old = fopen(path, "r"))) {
+		while (fscanf(old, "%x %x %15s", &this_vid, &this_did, this) == 3) {
+			if (this_vid != vid || this_did != did)
+				fprintf(index, "%04x %04x %s\n", this_vid, this_did,
+					this);
+		}
+		fclose(old);
 	}
 
-	rc = asprintf(&res, "%s/resource%d", de->d_name, bar);
-	if (rc == -1) {
-		closedir(d);
-		return -errno;
+	for (i = 0; i < n; i++)
+		fprintf(index, "%04x %04x %s\n", vid, did, bdfs[i]);
+
+	if (fclose(index) || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+static int pci_find(uint16_t vid, uint16_t did, char *bdf)
+{
+	char bdfs[PCI_MAX_DEVICES][PCI_BDF_LEN];
+	int rc;
+
+	if (*pci_device) {
+		if (!pci_device_is(pci_device, vid, did))
+			return -ENODEV;
+
+		strcpy(bdf, pci_device);
+
+		return 0;
 	}
 
-	fd = openat(dfd, res, O_RDWR | O_SYNC);
-	free(res);
-	closedir(d);
+	if (pci_index_lookup(vid, did, bdf))
+		return 0;
+
+	rc = pci_list(vid, did, bdfs, PCI_MAX_DEVICES);
+	if (rc < 0)
+		return rc;
+
+	if (rc > PCI_MAX_DEVICES)
+		rc = PCI_MAX_DEVICES;
+
+	pci_index_save(vid, did, bdfs, rc);
+
+	if (!rc)
+		return -ENOENT;
+
+	strcpy(bdf, bdfs[0]);
+
+	return 0;
+}
+
+int pci_open(uint16_t vid, uint16_t did, int bar)
+{
+	char bdf[PCI_BDF_LEN];
+	char path[PATH_MAX];
+	int rc;
+	int fd;
+
+	if ((rc = pci_find(vid, did, bdf)) < 0)
+		return rc;
+
+	snprintf(path, sizeof(path), PCI_DEVICES "%s/resource%d", bdf, bar);
+
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0)
+		return -errno;
 
-        return fd;
+	return fd;
 }
 
 int pci_close(int fd)
@@ -4,8 +4,23 @@
 #ifndef _PCI_H
 #define _PCI_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* Long enough for DDDD:BB:DD.F */
+#define PCI_BDF_LEN	16
+
+/* Normalise a DDDD:BB:DD.F or BB:DD.F address into out */
+int pci_parse_bdf(const char *bdf, char *out);
+
+/* Restrict pci_open() to the device at the given address */
+int pci_set_device(const char *bdf);
+/* The address given to pci_set_device(), or NULL if none was given */
+const char *pci_get_device(void);
+
+/* Find the addresses of up to len matching devices, returning the number found */
+int pci_list(uint16_t vid, uint16_t did, char (*bdfs)[PCI_BDF_LEN], size_t len);
+
 int pci_open(uint16_t vid, uint16_t did, int bar);
 
 int pci_close(int fd);
@@ -5,6 +5,8 @@
 #include "prompt.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,6 +52,133 @@ int prompt_gets(struct prompt *ctx, char *output, size_t len)
     return 0;
 }
 
+/*
+ * Fetch the next character, waiting at most timeout_ms for it to arrive if the
+ * stream is non-blocking. A negative timeout_ms waits indefinitely.
+ */
+static int prompt_getc(struct prompt *ctx, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fileno(ctx->stream), .events = POLLIN };
+    int c, rc;
+
+    for (;;) {
+        c = getc(ctx->stream);
+        if (c != EOF)
+            return c;
+
+        if (!ferror(ctx->stream))
+            return -EIO;
+
+        if (timeout_ms < 0 || errno != EAGAIN)
+            return -errno;
+
+        clearerr(ctx->stream);
+
+        rc = poll(&pfd, 1, timeout_ms);
+        if (rc < 0)
+            return -errno;
+        if (!rc)
+            return -ETIMEDOUT;
+    }
+}
+
+static int prompt_set_nonblock(struct prompt *ctx, bool nonblock)
+{
+    int fd = fileno(ctx->stream);
+    int flags;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+        return -errno;
+
+    flags = nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (fcntl(fd, F_SETFL, flags) < 0)
+        return -errno;
+
+    return 0;
+}
+
+static int __prompt_read_until(struct prompt *ctx, const char *str,
+                               char *output, size_t len, int timeout_ms)
+{
+    size_t matched = 0, stored = 0;
+    size_t str_len = strlen(str);
+    size_t i;
+    int c;
+
+    while (matched < str_len) {
+        c = prompt_getc(ctx, timeout_ms);
+        if (c < 0)
+            return c;
+
+        if (c == str[matched]) {
+            matched++;
+            continue;
+        }
+
+        /* The partial match was output, as is c unless it restarts the match */
+        for (i = 0; i < matched; i++) {
+            if (stored + 1 < len)
+                output[stored++] = str[i];
+        }
+
+        matched = (c == str[0]);
+        if (!matched && stored + 1 < len)
+            output[stored++] = c;
+    }
+
+    if (len)
+        output[stored] = '\0';
+
+    return 0;
+}
+
+/*
+ * Consume the stream up to and including str, leaving any later output
+ * buffered for subsequent reads. The text preceding str is stored to output,
+ * truncated to fit and terminated. str mustn't overlap itself, as for a prompt.
+ */
+int prompt_read_until(struct prompt *ctx, const char *str, char *output,
+                      size_t len)
+{
+    return __prompt_read_until(ctx, str, output, len, -1);
+}
+
+/* As for prompt_read_until(), but give up if the output stalls for timeout_ms */
+int prompt_read_until_timeout(struct prompt *ctx, const char *str,
+                              char *output, size_t len, int timeout_ms)
+{
+    int rc, cleanup;
+
+    if ((rc = prompt_set_nonblock(ctx, true)) < 0)
+        return rc;
+
+    rc = __prompt_read_until(ctx, str, output, len, timeout_ms);
+
+    cleanup = prompt_set_nonblock(ctx, false);
+
+    return rc < 0 ? rc : cleanup;
+}
+
+/* Discard the stream's output until it has been quiet for quiet_ms */
+int prompt_drain(struct prompt *ctx, int quiet_ms)
+{
+    int rc, cleanup;
+
+    if ((rc = prompt_set_nonblock(ctx, true)) < 0)
+        return rc;
+
+    while ((rc = prompt_getc(ctx, quiet_ms)) >= 0)
+        ;
+
+    cleanup = prompt_set_nonblock(ctx, false);
+
+    if (rc != -ETIMEDOUT)
+        return rc;
+
+    return cleanup;
+}
+
 int prompt_expect_into(struct prompt *ctx, const char *str, char *prior,
                          size_t len, char **prompt)
 {
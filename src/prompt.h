@@ -26,6 +26,11 @@ int prompt_expect_into(struct prompt *ctx, const char *str, char *prior,
 ssize_t prompt_write(struct prompt *ctx, const char *cmd, size_t len);
 ssize_t prompt_read(struct prompt *ctx, char *output, size_t len);
 int prompt_gets(struct prompt *ctx, char *output, size_t len);
+int prompt_read_until(struct prompt *ctx, const char *str, char *output,
+		      size_t len);
+int prompt_read_until_timeout(struct prompt *ctx, const char *str,
+			      char *output, size_t len, int timeout_ms);
+int prompt_drain(struct prompt *ctx, int quiet_ms);
 
 int prompt_run(struct prompt *ctx, const char *cmd);
 int prompt_expect_run(struct prompt *ctx, const char *prompt, const char *cmd);
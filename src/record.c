@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "log.h"
+#include "record.h"
+
+#include "ccan/container_of/container_of.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#define to_record(ahb) container_of(ahb_layer_from_ahb(ahb), struct record, layer)
+
+static uint64_t record_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static inline uint32_t record_clamp(uint64_t ns)
+{
+    return ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+static void record_log(struct record *ctx, enum ahb_op_type type, int flags,
+                       uint32_t phys, size_t len, int rc, const void *data,
+                       size_t data_len, uint64_t start, uint64_t end)
+{
+    struct record_entry entry;
+
+    pthread_mutex_lock(&ctx->lock);
+
+    entry.type = type;
+    entry.flags = flags;
+    entry.reserved = 0;
+    entry.phys = htole32(phys);
+    entry.len = htole32(data_len);
+    entry.rc = htole32(rc);
+    entry.dur_ns = htole32(record_clamp(end - start));
+
+    /* The length of the access is implied by the data for all but failed reads */
+    if (type == ahb_op_read && rc < 0)
+        entry.len = htole32(len);
+
+    if (fwrite(&entry, sizeof(entry), 1, ctx->log) != 1 ||
+            (data_len && fwrite(data, data_len, 1, ctx->log) != 1)) {
+        loge("Failed to write AHB access log: %s\n", strerror(errno));
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static ssize_t record_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct record *ctx = to_record(ahb);
+    uint64_t start = record_now();
+    ssize_t rc;
+
+    rc = ahb_read(ctx->layer.lower, phys, buf, len);
+    record_log(ctx, ahb_op_read, 0, phys, len, rc, buf, rc < 0 ? 0 : rc,
+               start, record_now());
+
+    return rc;
+}
+
+static ssize_t record_write(struct ahb *ahb, uint32_t phys, const void *buf,
+                            size_t len)
+{
+    struct record *ctx = to_record(ahb);
+    uint64_t start = record_now();
+    ssize_t rc;
+
+    rc = ahb_write(ctx->layer.lower, phys, buf, len);
+    record_log(ctx, ahb_op_write, 0, phys, len, rc, buf, len, start,
+               record_now());
+
+    return rc;
+}
+
+static int record_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
+{
+    struct record *ctx = to_record(ahb);
+    uint64_t start = record_now();
+    uint32_t le;
+    int rc;
+
+    rc = ahb_readl(ctx->layer.lower, phys, val);
+    le = htole32(rc ? 0 : *val);
+    record_log(ctx, ahb_op_readl, 0, phys, sizeof(le), rc, &le, sizeof(le),
+               start, record_now());
+
+    return rc;
+}
+
+static int record_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
+{
+    struct record *ctx = to_record(ahb);
+    uint64_t start = record_now();
+    uint32_t le = htole32(val);
+    int rc;
+
+    rc = ahb_writel(ctx->layer.lower, phys, val);
+    record_log(ctx, ahb_op_writel, 0, phys, sizeof(le), rc, &le, sizeof(le),
+               start, record_now());
+
+    return rc;
+}
+
+/*
+ * The ops of a batch are logged individually so the log can be replayed
+ * however the batch is executed. The duration of the batch is attributed to
+ * its first op, and ops that were not attempted are not logged.
+ */
+static int record_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
+{
+    struct record *ctx = to_record(ahb);
+    uint64_t start = record_now();
+    uint64_t end;
+    size_t i;
+    int rc;
+
+    rc = ahb_submit(ctx->layer.lower, ops, n);
+    end = record_now();
+
+    for (i = 0; i < n; i++) {
+        struct ahb_op *op = &ops[i];
+        uint32_t le;
+
+        if (op->rc == -ECANCELED)
+            break;
+
+        switch (op->type) {
+            case ahb_op_read:
+                record_log(ctx, op->type, RECORD_F_BATCH, op->phys, op->len,
+                           op->rc, op->buf, op->rc < 0 ? 0 : op->len, start,
+                           end);
+                break;
+            case ahb_op_write:
+                record_log(ctx, op->type, RECORD_F_BATCH, op->phys, op->len,
+                           op->rc, op->src, op->len, start, end);
+                break;
+            case ahb_op_readl:
+                le = htole32(op->rc ? 0 : *op->valp);
+                record_log(ctx, op->type, RECORD_F_BATCH, op->phys, sizeof(le),
+                           op->rc, &le, sizeof(le), start, end);
+                break;
+            case ahb_op_writel:
+                le = htole32(op->val);
+                record_log(ctx, op->type, RECORD_F_BATCH, op->phys, sizeof(le),
+                           op->rc, &le, sizeof(le), start, end);
+                break;
+        }
+
+        end = start;
+    }
+
+    return rc;
+}
+
+static const struct ahb_ops record_ahb_ops = {
+    .read = record_read,
+    .write = record_write,
+    .readl = record_readl,
+    .writel = record_writel,
+    .submit = record_submit,
+};
+
+int record_init(struct record *ctx, struct ahb *lower, const char *path)
+{
+    int rc;
+
+    ctx->log = fopen(path, "w");
+    if (!ctx->log)
+        return -errno;
+
+    if (fwrite(RECORD_MAGIC, strlen(RECORD_MAGIC), 1, ctx->log) != 1) {
+        rc = -errno;
+        fclose(ctx->log);
+        return rc;
+    }
+
+    pthread_mutex_init(&ctx->lock, NULL);
+
+    ahb_layer_init(&ctx->layer, lower, &record_ahb_ops);
+
+    return 0;
+}
+
+int record_destroy(struct record *ctx)
+{
+    pthread_mutex_destroy(&ctx->lock);
+
+    if (fclose(ctx->log))
+        return -errno;
+
+    return 0;
+}
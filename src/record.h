@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include "ahb.h"
+#include "layer.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RECORD_MAGIC            "culvrec2"
+
+/* The entry was issued as part of a batch submission */
+#define RECORD_F_BATCH          (1 << 0)
+
+/*
+ * A log is RECORD_MAGIC followed by a sequence of entries, each immediately
+ * followed by len bytes of data: the data read or written for ahb_op_read and
+ * ahb_op_write, or the 32-bit value for ahb_op_readl and ahb_op_writel.
+ * Failed reads carry the requested length but no data. All fields are
+ * little-endian.
+ */
+struct record_entry {
+    uint8_t type;       /* enum ahb_op_type */
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t phys;
+    uint32_t len;
+    int32_t rc;
+    /* Duration of the access */
+    uint32_t dur_ns;
+} __attribute__((packed));
+
+/* Logs every access passed to the lower interface, for later replay */
+struct record {
+    struct ahb_layer layer;
+    pthread_mutex_t lock;
+    FILE *log;
+};
+
+int record_init(struct record *ctx, struct ahb *lower, const char *path);
+int record_destroy(struct record *ctx);
+
+static inline struct ahb *record_as_ahb(struct record *ctx)
+{
+    return ahb_layer_as_ahb(&ctx->layer);
+}
+
+#endif
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "log.h"
+#include "route.h"
+
+#include "ccan/container_of/container_of.h"
+
+#include <stdbool.h>
+
+/* SCU000, the protection key register, is readable on all supported SoCs */
+#define ROUTE_FENCE_REG         0x1e6e2000
+
+#define to_route(ahb) container_of(ahb_layer_from_ahb(ahb), struct route, layer)
+
+static int route_select(struct route *ctx, struct ahb *next, bool write)
+{
+    if (ctx->dirty && ctx->dirty != next) {
+        uint32_t val;
+        int rc;
+
+        logt("Fencing writes via the %s bridge\n", ctx->dirty->drv->name);
+
+        if ((rc = ahb_readl(ctx->dirty, ROUTE_FENCE_REG, &val)) < 0)
+            return rc;
+
+        ctx->dirty = NULL;
+    }
+
+    if (write)
+        ctx->dirty = next;
+
+    return 0;
+}
+
+static ssize_t route_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct route *ctx = to_route(ahb);
+    int rc;
+
+    if ((rc = route_select(ctx, ctx->layer.lower, false)) < 0)
+        return rc;
+
+    return ahb_read(ctx->layer.lower, phys, buf, len);
+}
+
+static ssize_t route_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
+{
+    struct route *ctx = to_route(ahb);
+    int rc;
+
+    if ((rc = route_select(ctx, ctx->layer.lower, true)) < 0)
+        return rc;
+
+    return ahb_write(ctx->layer.lower, phys, buf, len);
+}
+
+static int route_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
+{
+    struct route *ctx = to_route(ahb);
+    int rc;
+
+    if ((rc = route_select(ctx, ctx->regs, false)) < 0)
+        return rc;
+
+    return ahb_readl(ctx->regs, phys, val);
+}
+
+static int route_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
+{
+    struct route *ctx = to_route(ahb);
+    int rc;
+
+    if ((rc = route_select(ctx, ctx->regs, true)) < 0)
+        return rc;
+
+    return ahb_writel(ctx->regs, phys, val);
+}
+
+/* Batches are register sequences, with at most small data transfers */
+static int route_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
+{
+    struct route *ctx = to_route(ahb);
+    bool write = false;
+    size_t i;
+    int rc;
+
+    for (i = 0; i < n; i++)
+        write |= (ops[i].type == ahb_op_write || ops[i].type == ahb_op_writel);
+
+    if ((rc = route_select(ctx, ctx->regs, write)) < 0)
+        return rc;
+
+    return ahb_submit(ctx->regs, ops, n);
+}
+
+static const struct ahb_ops route_ops = {
+    .read = route_read,
+    .write = route_write,
+    .readl = route_readl,
+    .writel = route_writel,
+    .submit = route_submit,
+};
+
+static int route_release(struct ahb *ahb)
+{
+    struct route *ctx = to_route(ahb);
+    int rc;
+
+    if ((rc = ahb_release_bridge(ctx->layer.lower)) < 0)
+        return rc;
+
+    return ahb_release_bridge(ctx->regs);
+}
+
+static int route_reinit(struct ahb *ahb)
+{
+    struct route *ctx = to_route(ahb);
+    int rc;
+
+    ctx->dirty = NULL;
+
+    if ((rc = ahb_reinit_bridge(ctx->layer.lower)) < 0)
+        return rc;
+
+    return ahb_reinit_bridge(ctx->regs);
+}
+
+static int route_begin(struct ahb *ahb)
+{
+    struct route *ctx = to_route(ahb);
+    int rc;
+
+    if ((rc = ahb_begin_session(ctx->layer.lower)) < 0)
+        return rc;
+
+    if ((rc = ahb_begin_session(ctx->regs)) < 0)
+        ahb_end_session(ctx->layer.lower);
+
+    return rc;
+}
+
+static void route_end(struct ahb *ahb)
+{
+    struct route *ctx = to_route(ahb);
+
+    ahb_end_session(ctx->regs);
+    ahb_end_session(ctx->layer.lower);
+}
+
+void route_init(struct route *ctx, struct ahb *bulk, struct ahb *regs)
+{
+    ahb_layer_init(&ctx->layer, bulk, &route_ops);
+    ctx->layer.drv.release = route_release;
+    ctx->layer.drv.reinit = route_reinit;
+    ctx->layer.drv.begin = route_begin;
+    ctx->layer.drv.end = route_end;
+    ctx->regs = regs;
+    ctx->dirty = NULL;
+}
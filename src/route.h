@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _ROUTE_H
+#define _ROUTE_H
+
+#include "ahb.h"
+#include "layer.h"
+
+/*
+ * Sends bulk transfers via one AHB interface and register accesses via
+ * another. Writes issued on one interface are fenced with a read on that
+ * interface before the other interface is used, so accesses can't be observed
+ * out of order by the BMC.
+ */
+struct route {
+    struct ahb_layer layer;
+    struct ahb *regs;
+    /* The interface with writes that may still be posted, if any */
+    struct ahb *dirty;
+};
+
+void route_init(struct route *ctx, struct ahb *bulk, struct ahb *regs);
+
+static inline struct ahb *route_as_ahb(struct route *ctx)
+{
+    return ahb_layer_as_ahb(&ctx->layer);
+}
+
+#endif
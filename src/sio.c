@@ -11,6 +11,8 @@
 #define SIO_ADDR(ctx) ((ctx)->base)
 #define SIO_DATA(ctx) ((ctx)->base + 1)
 
+#define SIO_SELF_TEST_ROUNDS 8
+
 int sio_init(struct sio *ctx)
 {
     ctx->base = 0x2e;
@@ -47,8 +49,6 @@ static int sio_present(struct sio *ctx)
     uint8_t dev;
     int rc;
 
-    logd("Probing 0x%x for SuperIO\n", ctx->base);
-
     /* Dumb heuristics as we don't have access to the LPCHC */
     rc = sio_unlock(ctx);
     logt("Unlocking SuperIO: %d\n", rc);
@@ -88,19 +88,43 @@ out:
     return rc;
 }
 
+/*
+ * Port I/O is issued back-to-back, so check the device selection reads back
+ * reliably before trusting it. lpc_calibrate() slows the accesses if not.
+ */
+static int sio_self_test(struct lpc *io __unused, void *data)
+{
+    struct sio *ctx = data;
+    int i, rc;
+
+    for (i = 0; i < SIO_SELF_TEST_ROUNDS; i++) {
+        if ((rc = sio_present(ctx)) != 1)
+            return rc < 0 ? rc : 0;
+    }
+
+    return 1;
+}
+
+static bool sio_detect(struct sio *ctx, uint16_t base)
+{
+    logd("Probing 0x%x for SuperIO\n", base);
+
+    ctx->base = base;
+
+    return !lpc_calibrate(&ctx->io, sio_self_test, ctx);
+}
+
 int sio_probe(struct sio *ctx)
 {
     bool found;
 
-    ctx->base = 0x2e;
-    found = sio_present(ctx);
-    if (!found) {
-        ctx->base = 0x4e;
-        found = sio_present(ctx);
-    }
+    found = sio_detect(ctx, 0x2e);
+    if (!found)
+        found = sio_detect(ctx, 0x4e);
 
     if (found) {
-        logd("Found SuperIO device at 0x%" PRIx16 "\n", ctx->base);
+        logd("Found SuperIO device at 0x%" PRIx16 " with I/O delay %u\n",
+             ctx->base, ctx->io.delay);
     } else {
         logd("SuperIO disabled\n");
     }
@@ -129,3 +153,75 @@ int sio_writeb(struct sio *ctx, uint32_t addr, uint8_t val)
 
     return lpc_writeb(&ctx->io, SIO_DATA(ctx), val);
 }
+
+void sio_batch_init(struct sio_batch *batch, struct sio *sio)
+{
+    batch->sio = sio;
+    batch->n_regs = 0;
+    batch->overflow = false;
+}
+
+static struct lpc_op *sio_batch_add(struct sio_batch *batch, uint32_t addr)
+{
+    struct sio *ctx = batch->sio;
+    struct lpc_op *op;
+    size_t i;
+
+    if (batch->n_regs == SIO_BATCH_MAX) {
+        batch->overflow = true;
+        return NULL;
+    }
+
+    i = batch->n_regs++;
+    batch->regs[i] = addr;
+
+    op = &batch->ops[2 * i];
+    op->type = lpc_op_write;
+    op->addr = SIO_ADDR(ctx);
+    op->src = &batch->regs[i];
+    op->len = 1;
+
+    op++;
+    op->addr = SIO_DATA(ctx);
+    op->len = 1;
+
+    return op;
+}
+
+void sio_batch_readb(struct sio_batch *batch, uint32_t addr, uint8_t *val)
+{
+    struct lpc_op *op;
+
+    if ((op = sio_batch_add(batch, addr))) {
+        op->type = lpc_op_read;
+        op->buf = val;
+    }
+}
+
+void sio_batch_writeb(struct sio_batch *batch, uint32_t addr, uint8_t val)
+{
+    struct lpc_op *op;
+
+    if ((op = sio_batch_add(batch, addr))) {
+        batch->vals[batch->n_regs - 1] = val;
+        op->type = lpc_op_write;
+        op->src = &batch->vals[batch->n_regs - 1];
+    }
+}
+
+int sio_batch_submit(struct sio_batch *batch)
+{
+    int rc;
+
+    if (batch->overflow) {
+        loge("Batch of SuperIO accesses exceeded %d entries\n", SIO_BATCH_MAX);
+        rc = -E2BIG;
+    } else {
+        rc = lpc_submit(&batch->sio->io, batch->ops, 2 * batch->n_regs);
+    }
+
+    batch->n_regs = 0;
+    batch->overflow = false;
+
+    return rc;
+}
@@ -4,6 +4,7 @@
 #ifndef SIO_H
 #define SIO_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -36,4 +37,26 @@ int sio_probe(struct sio *ctx);
 int sio_readb(struct sio *ctx, uint32_t addr, uint8_t *val);
 int sio_writeb(struct sio *ctx, uint32_t addr, uint8_t val);
 
+#define SIO_BATCH_MAX 16
+
+/*
+ * Register accesses queued to be submitted to the LPC bus together. Reads
+ * complete, and their values are only valid, once the batch is submitted.
+ */
+struct sio_batch
+{
+    struct sio *sio;
+    size_t n_regs;
+    bool overflow;
+    uint8_t regs[SIO_BATCH_MAX];
+    uint8_t vals[SIO_BATCH_MAX];
+    /* An address write and a data access per register access */
+    struct lpc_op ops[2 * SIO_BATCH_MAX];
+};
+
+void sio_batch_init(struct sio_batch *batch, struct sio *sio);
+void sio_batch_readb(struct sio_batch *batch, uint32_t addr, uint8_t *val);
+void sio_batch_writeb(struct sio_batch *batch, uint32_t addr, uint8_t val);
+int sio_batch_submit(struct sio_batch *batch);
+
 #endif
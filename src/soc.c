@@ -6,6 +6,8 @@
 #include "devicetree/g6.h"
 
 #include "ast.h"
+#include "cache.h"
+#include "combine.h"
 #include "compiler.h"
 #include "log.h"
 #include "soc.h"
@@ -67,6 +69,8 @@ int soc_from_rev(struct soc *ctx, struct ahb *ahb, uint32_t rev)
 
 	ctx->rev = rev;
 	ctx->ahb = ahb;
+	ctx->cache = NULL;
+	ctx->combine = NULL;
 	list_head_init(&ctx->devices);
 	list_head_init(&ctx->bridges);
 	return soc_align_fdt(ctx, &soc_fdts[rev_generation(rev)]);
@@ -192,6 +196,182 @@ static void soc_unbind_drivers(struct soc *ctx)
 	}
 }
 
+static bool soc_cache_enabled;
+
+void soc_set_cache_enabled(bool enable)
+{
+	soc_cache_enabled = enable;
+}
+
+/*
+ * Call fn for the memory region of each devicetree node that match accepts,
+ * stopping at the first error fn returns.
+ */
+static int soc_for_each_region(struct soc *ctx,
+			       bool (*match)(const void *fdt, int node),
+			       int (*fn)(void *data,
+					 const struct soc_region *region),
+			       void *data)
+{
+	struct soc_device_node dn = { .fdt = &ctx->fdt };
+	struct soc_region region;
+	int node;
+	int rc;
+
+	for (node = fdt_next_node(ctx->fdt.start, -1, NULL); node >= 0;
+	     node = fdt_next_node(ctx->fdt.start, node, NULL)) {
+		if (!match(ctx->fdt.start, node))
+			continue;
+
+		dn.offset = node;
+		if ((rc = soc_device_get_memory(ctx, &dn, &region)) < 0)
+			return rc;
+
+		if ((rc = fn(data, &region)) < 0)
+			return rc;
+	}
+
+	return node == -FDT_ERR_NOTFOUND ? 0 : -EUCLEAN;
+}
+
+static bool soc_cache_match(const void *fdt, int node)
+{
+	const char *type;
+
+	type = fdt_getprop(fdt, node, "device_type", NULL);
+	if (type && !strcmp(type, "memory"))
+		return true;
+
+	return !fdt_node_check_compatible(fdt, node, "mmio-sram");
+}
+
+static int soc_cache_add(void *data, const struct soc_region *region)
+{
+	return cache_add_region(data, region->start, region->length, true);
+}
+
+/* Cache the memory-like regions described by the devicetree */
+static int soc_cache_init(struct soc *ctx)
+{
+	struct cache *cache;
+	int rc;
+
+	cache = malloc(sizeof(*cache));
+	if (!cache)
+		return -ENOMEM;
+
+	if ((rc = cache_init(cache, ctx->ahb)) < 0)
+		goto cleanup_cache;
+
+	if ((rc = soc_for_each_region(ctx, soc_cache_match, soc_cache_add,
+				      cache)) < 0)
+		goto cleanup_init;
+
+	ctx->cache = cache;
+	ctx->ahb = cache_as_ahb(cache);
+
+	logd("Caching AHB accesses via the %s bridge\n", ctx->ahb->drv->name);
+
+	return 0;
+
+cleanup_init:
+	cache_destroy(cache);
+
+cleanup_cache:
+	free(cache);
+
+	return rc;
+}
+
+static void soc_cache_destroy(struct soc *ctx)
+{
+	if (!ctx->cache)
+		return;
+
+	ctx->ahb = ctx->cache->layer.lower;
+	cache_destroy(ctx->cache);
+	free(ctx->cache);
+	ctx->cache = NULL;
+}
+
+int soc_cache_mark(struct soc *ctx, const struct soc_region *region,
+		   bool cacheable)
+{
+	if (!ctx->cache)
+		return 0;
+
+	return cache_add_region(ctx->cache, region->start, region->length,
+				cacheable);
+}
+
+void soc_cache_unmark(struct soc *ctx, const struct soc_region *region,
+		      bool cacheable)
+{
+	if (ctx->cache)
+		cache_remove_region(ctx->cache, region->start, region->length,
+				    cacheable);
+}
+
+void soc_cache_invalidate(struct soc *ctx)
+{
+	if (ctx->cache)
+		cache_invalidate(ctx->cache);
+}
+
+static bool soc_combine_match(const void *fdt, int node)
+{
+	return !!fdt_getprop(fdt, node, "culvert,read-combinable", NULL);
+}
+
+static int soc_combine_add(void *data, const struct soc_region *region)
+{
+	return combine_add_region(data, region->start, region->length);
+}
+
+/* Combine reads of the register blocks the devicetree marks as side-effect free */
+static int soc_combine_init(struct soc *ctx)
+{
+	struct combine *combine;
+	int rc;
+
+	combine = malloc(sizeof(*combine));
+	if (!combine)
+		return -ENOMEM;
+
+	if ((rc = combine_init(combine, ctx->ahb)) < 0)
+		goto cleanup_combine;
+
+	if ((rc = soc_for_each_region(ctx, soc_combine_match, soc_combine_add,
+				      combine)) < 0)
+		goto cleanup_init;
+
+	ctx->combine = combine;
+	ctx->ahb = combine_as_ahb(combine);
+
+	logd("Combining register reads via the %s bridge\n", ctx->ahb->drv->name);
+
+	return 0;
+
+cleanup_init:
+	combine_destroy(combine);
+
+cleanup_combine:
+	free(combine);
+
+	return rc;
+}
+
+static void soc_combine_destroy(struct soc *ctx)
+{
+	if (!ctx->combine)
+		return;
+
+	ctx->ahb = ctx->combine->layer.lower;
+	combine_destroy(ctx->combine);
+	free(ctx->combine);
+	ctx->combine = NULL;
+}
+
 int soc_probe(struct soc *ctx, struct ahb *ahb)
 {
 	int64_t rc;
@@ -208,6 +388,17 @@ int soc_probe(struct soc *ctx, struct ahb *ahb)
 		return rc;
 	}
 
+	/* Local accesses are cheap, don't bother caching them */
+	if (soc_cache_enabled && !ahb->drv->local) {
+		if ((rc = soc_cache_init(ctx)) < 0)
+			logi("Failed to initialise AHB cache, continuing without: %d\n", rc);
+	}
+
+	if (ahb->drv->high_latency) {
+		if ((rc = soc_combine_init(ctx)) < 0)
+			logi("Failed to initialise read combining, continuing without: %d\n", rc);
+	}
+
 	soc_bind_drivers(ctx);
 
 	return 0;
@@ -217,6 +408,9 @@ void soc_destroy(struct soc *ctx)
 {
 	soc_unbind_drivers(ctx);
 
+	soc_combine_destroy(ctx);
+	soc_cache_destroy(ctx);
+
 	free(ctx->fdt.start);
 }
 
@@ -11,6 +11,7 @@
 #include "ccan/autodata/autodata.h"
 #include "ccan/list/list.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -19,14 +20,21 @@ struct soc_fdt {
 	void *end;
 };
 
+struct cache;
+struct combine;
+
 struct soc {
 	uint32_t rev;
 	struct soc_fdt fdt;
 	struct ahb *ahb;
+	struct cache *cache;
+	struct combine *combine;
 	struct list_head devices;
 	struct list_head bridges;
 };
 
+void soc_set_cache_enabled(bool enable);
+
 int soc_probe(struct soc *ctx, struct ahb *ahb);
 
 void soc_destroy(struct soc *ctx);
@@ -63,6 +71,27 @@ static inline int soc_writel(struct soc *ctx, uint32_t phys, uint32_t val)
 	return ahb_writel(ctx->ahb, phys, val);
 }
 
+static inline int
+soc_submit(struct soc *ctx, struct ahb_op *ops, size_t n)
+{
+	return ahb_submit(ctx->ahb, ops, n);
+}
+
+static inline int soc_begin_session(struct soc *ctx)
+{
+	return ahb_begin_session(ctx->ahb);
+}
+
+static inline void soc_end_session(struct soc *ctx)
+{
+	ahb_end_session(ctx->ahb);
+}
+
+static inline void soc_batch_init(struct soc *ctx, struct ahb_batch *batch)
+{
+	ahb_batch_init(batch, ctx->ahb);
+}
+
 static inline ssize_t
 soc_siphon_in(struct soc *ctx, uint32_t phys, size_t len, int outfd)
 {
@@ -143,6 +172,19 @@ int
 soc_device_get_memory_region_named(struct soc *ctx, const struct soc_device_node *dn,
 				   const char *name, struct soc_region *region);
 
+/*
+ * Adjust the cacheability of a region when AHB caching is enabled. Marks are
+ * reference counted and removed with soc_cache_unmark(). A region marked
+ * uncacheable overrides any cacheable region it overlaps.
+ */
+int soc_cache_mark(struct soc *ctx, const struct soc_region *region,
+		   bool cacheable);
+void soc_cache_unmark(struct soc *ctx, const struct soc_region *region,
+		      bool cacheable);
+
+/* Drop all cached data, e.g. when the BMC CPU may have modified memory */
+void soc_cache_invalidate(struct soc *ctx);
+
 struct soc_driver {
 	const char* name;
 	const struct soc_device_id *matches;
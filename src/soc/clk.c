@@ -22,6 +22,7 @@
 #define SCU_SILICON_REVISION		0x7c
 
 struct clk {
+	struct soc *soc;
 	struct scu *scu;
 };
 
@@ -72,6 +73,8 @@ int clk_disable(struct clk *ctx, enum clksrc src)
 
     switch (src) {
     case clk_arm:
+        /* Anything cached so far may have been modified by the running CPU */
+        soc_cache_invalidate(ctx->soc);
         return scu_writel(ctx->scu, SCU_HW_STRAP, SCU_HW_STRAP_ARM_CLK);
     case clk_uart3:
         if ((rc = scu_readl(ctx->scu, SCU_CLK_STOP, &reg)) < 0)
@@ -97,7 +100,13 @@ int clk_enable(struct clk *ctx, enum clksrc src)
 
     switch (src) {
     case clk_arm:
-        return scu_writel(ctx->scu, SCU_SILICON_REVISION, SCU_HW_STRAP_ARM_CLK);
+        /* The CPU is about to run and may modify memory we've cached */
+        if ((rc = scu_writel(ctx->scu, SCU_SILICON_REVISION, SCU_HW_STRAP_ARM_CLK)) < 0)
+            return rc;
+
+        soc_cache_invalidate(ctx->soc);
+
+        return 0;
     case clk_uart3:
         if ((rc = scu_readl(ctx->scu, SCU_CLK_STOP, &reg)) < 0)
             return rc;
@@ -130,6 +139,7 @@ static int clk_driver_init(struct soc *soc, struct soc_device *dev)
         return -ENOMEM;
     }
 
+    ctx->soc = soc;
     ctx->scu = scu_get(soc);
     if (!ctx->scu) {
         rc = -ENODEV;
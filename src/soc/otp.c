@@ -8,6 +8,7 @@
 #include "otp.h"
 #include "rev.h"
 #include "soc.h"
+#include "stats.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -50,8 +51,11 @@ struct otpstrap_status {
 
 static int otp_readl(struct otp *otp, uint32_t offset, uint32_t *val)
 {
+    enum stats_subsys prev = stats_subsys_enter(stats_subsys_otp);
     int rc = soc_readl(otp->soc, otp->iomem.start + offset, val);
 
+    stats_subsys_exit(prev);
+
 #ifdef _OTP_DEBUG
     if (rc)
         printf("otp rd %02x failed: %d\n", offset, rc);
@@ -63,8 +67,11 @@ static int otp_readl(struct otp *otp, uint32_t offset, uint32_t *val)
 }
 static int otp_writel(struct otp *otp, uint32_t offset, uint32_t val)
 {
+    enum stats_subsys prev = stats_subsys_enter(stats_subsys_otp);
     int rc = soc_writel(otp->soc, otp->iomem.start + offset, val);
 
+    stats_subsys_exit(prev);
+
 #ifdef _OTP_DEBUG
     if (rc)
         printf("otp wr %02x failed: %d\n", offset, rc);
@@ -96,52 +103,80 @@ static int otp_wait_complete(struct otp *otp)
     intv.tv_nsec = 1000000L;
     clock_gettime(CLOCK_MONOTONIC, &start);
 
+    if ((rc = soc_begin_session(otp->soc)))
+        return rc;
+
     do {
         rc = otp_readl(otp, OTP_STATUS, &reg);
         if (rc)
-            return rc;
+            goto done;
 
         if ((reg & OTP_STATUS_IDLE) == OTP_STATUS_IDLE)
-            return 0;
+            goto done;
 
         rc = clock_nanosleep(CLOCK_MONOTONIC, 0, &intv, NULL);
         if (rc)
-            return rc;
+            goto done;
 
         clock_gettime(CLOCK_MONOTONIC, &end);
         diff_timespec(&start, &end, &diff);
     } while (!diff.tv_sec && diff.tv_nsec < 500000000L);
 
-    return -ETIMEDOUT;
+    rc = -ETIMEDOUT;
+
+done:
+    soc_end_session(otp->soc);
+
+    return rc;
 }
 
-static int otp_program(struct otp *otp, uint32_t addr, uint32_t val)
+/*
+ * Issue the address, optional data and trigger writes of an OTP command as a
+ * single batch, then wait for the controller to complete it.
+ */
+static int otp_command(struct otp *otp, uint32_t addr, const uint32_t *val,
+                       uint32_t trigger)
 {
+    enum stats_subsys prev;
+    struct ahb_batch batch;
     int rc;
 
-    if ((rc = otp_writel(otp, OTP_ADDR, addr)) < 0)
-        return rc;
+    /* The operands may be written in any order, but must precede the trigger */
+    soc_batch_init(otp->soc, &batch);
+    ahb_batch_set_unordered(&batch, true);
+    ahb_batch_writel(&batch, otp->iomem.start + OTP_ADDR, addr);
+    if (val)
+        ahb_batch_writel(&batch, otp->iomem.start + OTP_COMPARE_1, *val);
+    ahb_batch_set_unordered(&batch, false);
+    ahb_batch_writel(&batch, otp->iomem.start + OTP_COMMAND, trigger);
 
-    if ((rc = otp_writel(otp, OTP_COMPARE_1, val)) < 0)
-        return rc;
+    prev = stats_subsys_enter(stats_subsys_otp);
+    rc = ahb_batch_submit(&batch);
+    stats_subsys_exit(prev);
+
+#ifdef _OTP_DEBUG
+    if (rc)
+        printf("otp cmd %08x @ %04x failed: %d\n", trigger, addr, rc);
+    else
+        printf("otp cmd %08x @ %04x\n", trigger, addr);
+#endif
 
-    if ((rc = otp_writel(otp, OTP_COMMAND, OTP_TRIGGER_PROGRAM)) < 0)
+    if (rc < 0)
         return rc;
 
     return otp_wait_complete(otp);
 }
 
+static int otp_program(struct otp *otp, uint32_t addr, uint32_t val)
+{
+    return otp_command(otp, addr, &val, OTP_TRIGGER_PROGRAM);
+}
+
 static int otp_read_reg(struct otp *otp, uint32_t addr, uint32_t *val)
 {
     int rc;
 
-    if ((rc = otp_writel(otp, OTP_ADDR, addr)) < 0)
-        return rc;
-
-    if ((rc = otp_writel(otp, OTP_COMMAND, OTP_TRIGGER_READ)) < 0)
-        return rc;
-
-    if ((rc = otp_wait_complete(otp)) < 0)
+    if ((rc = otp_command(otp, addr, NULL, OTP_TRIGGER_READ)) < 0)
         return rc;
 
     if ((rc = otp_readl(otp, OTP_COMPARE_1, val)) < 0)
@@ -162,18 +197,7 @@ static int otp_read_config(struct otp *otp, int offset, uint32_t *val)
 
 static int otp_write_reg(struct otp *otp, uint32_t addr, uint32_t val)
 {
-    int rc;
-
-    if ((rc = otp_writel(otp, OTP_ADDR, addr)) < 0)
-        return rc;
-
-    if ((rc = otp_writel(otp, OTP_COMPARE_1, val)) < 0)
-        return rc;
-
-    if ((rc = otp_writel(otp, OTP_COMMAND, OTP_TRIGGER_WRITE_REG)) < 0)
-        return rc;
-
-    return otp_wait_complete(otp);
+    return otp_command(otp, addr, &val, OTP_TRIGGER_WRITE_REG);
 }
 
 static int otp_set_soak(struct otp *otp, unsigned int soak)
@@ -262,9 +286,12 @@ int otp_read(struct otp *otp, enum otp_region reg)
 {
     int rc;
 
-    if ((rc = otp_writel(otp, OTP_PROTECT_KEY, OTP_PASSWD)) < 0)
+    if ((rc = soc_begin_session(otp->soc)) < 0)
         return rc;
 
+    if ((rc = otp_writel(otp, OTP_PROTECT_KEY, OTP_PASSWD)) < 0)
+        goto end_session;
+
     if (reg == otp_region_strap) {
         int i;
         uint32_t res[2] = { 0, 0};
@@ -322,6 +349,9 @@ int otp_read(struct otp *otp, enum otp_region reg)
 done:
     otp_writel(otp, OTP_PROTECT_KEY, 0);
 
+end_session:
+    soc_end_session(otp->soc);
+
     return rc;
 }
 
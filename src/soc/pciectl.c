@@ -121,12 +121,22 @@ static uint32_t pciectl_pdata_collect_region_mask(const struct pciectl_pdata *pd
 static int
 pciectl_device_enforce(struct pciectl *ctx, const struct pciectl_endpoint *ep, enum bridge_mode mode)
 {
+    struct ahb_batch batch;
     uint32_t pcie, misc;
     uint32_t mask;
     int rc;
 
-    if ((rc = soc_readl(ctx->soc, ctx->scu.start + ctx->pdata->config, &pcie)) < 0) {
-        loge("Failed to read PCIe device configuration: %d\n", rc);
+    soc_batch_init(ctx->soc, &batch);
+    ahb_batch_set_unordered(&batch, true);
+    ahb_batch_readl(&batch, ctx->scu.start + ctx->pdata->config, &pcie);
+    if (mode != bm_disabled)
+        ahb_batch_readl(&batch, ctx->scu.start + ctx->pdata->misc, &misc);
+
+    if ((rc = ahb_batch_submit(&batch)) < 0) {
+        if (batch.ops[0].rc)
+            loge("Failed to read PCIe device configuration: %d\n", rc);
+        else
+            loge("Failed to read PCIe MMIO region configuration: %d\n", rc);
         return rc;
     }
 
@@ -140,11 +150,6 @@ pciectl_device_enforce(struct pciectl *ctx, const struct pciectl_endpoint *ep, e
         return rc;
     }
 
-    if ((rc = soc_readl(ctx->soc, ctx->scu.start + ctx->pdata->misc, &misc)) < 0) {
-        loge("Failed to read PCIe MMIO region configuration: %d\n", rc);
-        return rc;
-    }
-
     mask = pciectl_pdata_collect_region_mask(ctx->pdata, ep);
     if (!mask) {
         return 0;
@@ -157,13 +162,19 @@ pciectl_device_enforce(struct pciectl *ctx, const struct pciectl_endpoint *ep, e
         misc &= ~mask;
     }
 
-    if ((rc = soc_writel(ctx->soc, ctx->scu.start + ctx->pdata->misc, misc)) < 0) {
-        loge("Failed to write PCIe MMIO region configuration: %d\n", rc);
-        return rc;
-    }
-
     pcie |= ep->device.mask | ep->function.mask;
-    if ((rc = soc_writel(ctx->soc, ctx->scu.start + ctx->pdata->config, pcie)) < 0) {
+
+    /* Restrict the MMIO regions before enabling the function */
+    ahb_batch_set_unordered(&batch, false);
+    ahb_batch_writel(&batch, ctx->scu.start + ctx->pdata->misc, misc);
+    ahb_batch_writel(&batch, ctx->scu.start + ctx->pdata->config, pcie);
+
+    if ((rc = ahb_batch_submit(&batch)) < 0) {
+        if (batch.ops[0].rc) {
+            loge("Failed to write PCIe MMIO region configuration: %d\n", rc);
+            return rc;
+        }
+
         loge("Failed to enable PCIe VGA device: %d\n", rc);
     }
 
@@ -184,6 +195,7 @@ pciectl_device_enforce(struct pciectl *ctx, const struct pciectl_endpoint *ep, e
 static int
 pciectl_device_status(struct pciectl *ctx, const struct pciectl_endpoint *ep, enum bridge_mode *mode)
 {
+    struct ahb_batch batch;
     uint32_t pcie, misc;
     uint32_t mask;
     int rc;
@@ -207,8 +219,17 @@ pciectl_device_status(struct pciectl *ctx, const struct pciectl_endpoint *ep, en
         }
     }
 
-    if ((rc = soc_readl(ctx->soc, ctx->scu.start + ctx->pdata->config, &pcie)) < 0) {
-        loge("Failed to read PCIe device configuration: %d\n", rc);
+    /* Both are plain SCU configuration registers, fetch them together */
+    soc_batch_init(ctx->soc, &batch);
+    ahb_batch_set_unordered(&batch, true);
+    ahb_batch_readl(&batch, ctx->scu.start + ctx->pdata->config, &pcie);
+    ahb_batch_readl(&batch, ctx->scu.start + ctx->pdata->misc, &misc);
+
+    if ((rc = ahb_batch_submit(&batch)) < 0) {
+        if (batch.ops[0].rc)
+            loge("Failed to read PCIe device configuration: %d\n", rc);
+        else
+            loge("Failed to read PCIe MMIO region configuration: %d\n", rc);
         return rc;
     }
 
@@ -224,11 +245,6 @@ pciectl_device_status(struct pciectl *ctx, const struct pciectl_endpoint *ep, en
         return 0;
     }
 
-    if ((rc = soc_readl(ctx->soc, ctx->scu.start + ctx->pdata->misc, &misc)) < 0) {
-        loge("Failed to read PCIe MMIO region configuration: %d\n", rc);
-        return rc;
-    }
-
     *mode = ((misc & mask) == mask) ? bm_restricted : bm_permissive;
 
     return 0;
@@ -10,6 +10,7 @@
 #include "clk.h"
 #include "log.h"
 #include "sfc.h"
+#include "stats.h"
 
 #include "ccan/container_of/container_of.h"
 
@@ -80,25 +81,48 @@ struct sfc_data {
 static inline int
 sfc_readl(struct sfc_data *ctx, uint32_t offset, uint32_t *val)
 {
-    return soc_readl(ctx->soc, ctx->iomem.start + offset, val);
+    enum stats_subsys prev = stats_subsys_enter(stats_subsys_sfc);
+    int rc;
+
+    rc = soc_readl(ctx->soc, ctx->iomem.start + offset, val);
+    stats_subsys_exit(prev);
+
+    return rc;
 }
 
 static inline int
 sfc_writel(struct sfc_data *ctx, uint32_t offset, uint32_t val)
 {
-    return soc_writel(ctx->soc, ctx->iomem.start + offset, val);
+    enum stats_subsys prev = stats_subsys_enter(stats_subsys_sfc);
+    int rc;
+
+    rc = soc_writel(ctx->soc, ctx->iomem.start + offset, val);
+    stats_subsys_exit(prev);
+
+    return rc;
 }
 
 static inline ssize_t
 flash_read(struct sfc_data *ctx, uint32_t offset, void *buf, size_t len)
 {
-    return soc_read(ctx->soc, ctx->flash.start + offset, buf, len);
+    enum stats_subsys prev = stats_subsys_enter(stats_subsys_sfc);
+    ssize_t rc;
+
+    rc = soc_read(ctx->soc, ctx->flash.start + offset, buf, len);
+    stats_subsys_exit(prev);
+
+    return rc;
 }
 
-static inline ssize_t
-flash_write(struct sfc_data *ctx, uint32_t offset, const void *buf, size_t len)
+static int sfc_batch_submit(struct ahb_batch *batch)
 {
-    return soc_write(ctx->soc, ctx->flash.start + offset, buf, len);
+    enum stats_subsys prev = stats_subsys_enter(stats_subsys_sfc);
+    int rc;
+
+    rc = ahb_batch_submit(batch);
+    stats_subsys_exit(prev);
+
+    return rc;
 }
 
 static uint32_t ast_ahb_freq;
@@ -128,24 +152,35 @@ static int fl_read_stat(struct sfc *ct, uint8_t *stat)
     return ct->cmd_rd(ct, CMD_RDSR, false, 0, stat, 1);
 }
 
-/* Synchronous write completion, probably need a yield hook */
+/*
+ * Synchronous write completion, probably need a yield hook. Polling is
+ * register-heavy, so hold a bridge session throughout.
+ */
 static int fl_sync_wait_idle(struct sfc *ct)
 {
+    struct sfc_data *data = container_of(ct, struct sfc_data, ops);
     uint8_t stat;
     int rc;
 
+    if ((rc = soc_begin_session(data->soc)))
+        return rc;
+
     /* XXX Add timeout */
     for (;;) {
 	rc = fl_read_stat(ct, &stat);
-	if (rc) return rc;
+	if (rc) break;
 	if (!(stat & STAT_WIP)) {
 	    if (ct->finfo->flags & FL_MICRON_BUGS)
 		fl_micron_status(ct);
-	    return 0;
+	    break;
 	}
 	usleep(100);
     }
     /* return FLASH_ERR_WIP_TIMEOUT; */
+
+    soc_end_session(data->soc);
+
+    return rc;
 }
 
 /* Exported for internal use */
@@ -173,24 +208,48 @@ static int fl_wren(struct sfc *ct)
     return -ETIMEDOUT;
 }
 
-static int sfc_start_cmd(struct sfc_data *ct, uint8_t cmd)
+/*
+ * In user mode the flash window no longer reads back the flash contents, and
+ * commands may modify them, so keep the window out of any AHB cache while the
+ * controller is out of read mode.
+ */
+static inline int sfc_cache_hold(struct sfc_data *ct)
 {
-    int rc;
+    return soc_cache_mark(ct->soc, &ct->flash, false);
+}
 
+static inline void sfc_cache_release(struct sfc_data *ct)
+{
+    soc_cache_unmark(ct->soc, &ct->flash, false);
+}
+
+/*
+ * A user-mode command is a fixed sequence of controller register writes and
+ * flash window accesses. Queue the whole sequence so bridges that support
+ * batching can issue it as a single transaction.
+ */
+#define SFC_BATCH_WORDS		16
+
+static void sfc_batch_start_cmd(struct sfc_data *ct, struct ahb_batch *batch,
+				const uint8_t *cmd)
+{
     /* Switch to user mode, CE# dropped */
-    rc = sfc_writel(ct, ct->ctl_reg, ct->ctl_val | 7);
-    if (rc < 0)
-	return rc;
+    ahb_batch_writel(batch, ct->iomem.start + ct->ctl_reg, ct->ctl_val | 7);
 
     /* user mode, CE# active */
-    rc = sfc_writel(ct, ct->ctl_reg, ct->ctl_val | 3);
-    if (rc < 0)
-	return rc;
+    ahb_batch_writel(batch, ct->iomem.start + ct->ctl_reg, ct->ctl_val | 3);
 
     /* write cmd */
-    rc = flash_write(ct, 0, &cmd, 1);
+    ahb_batch_write(batch, ct->flash.start, cmd, 1);
+}
+
+static void sfc_batch_end_cmd(struct sfc_data *ct, struct ahb_batch *batch)
+{
+    /* clear CE# */
+    ahb_batch_writel(batch, ct->iomem.start + ct->ctl_reg, ct->ctl_val | 7);
 
-    return rc == 1 ? 0 : rc;
+    /* Switch back to read mode */
+    ahb_batch_writel(batch, ct->iomem.start + ct->ctl_reg, ct->ctl_read_val);
 }
 
 static void sfc_end_cmd(struct sfc_data *ct)
@@ -206,26 +265,17 @@ static void sfc_end_cmd(struct sfc_data *ct)
     if (rc < 0) { errno = -rc; perror("sfc_writel"); return; }
 }
 
-static int sfc_send_addr(struct sfc_data *ct, uint32_t addr)
+/* @addr must hold the address in big-endian order until the batch is submitted */
+static void sfc_batch_send_addr(struct sfc_data *ct, struct ahb_batch *batch,
+				const uint32_t *addr)
 {
-    const void *ap;
-    int rc, len;
-
-    /* Layout address MSB first in memory */
-    addr = htobe32(addr);
+    const uint8_t *ap = (const uint8_t *)addr;
 
     /* Send the right amount of bytes */
-    ap = (char *)&addr;
-
-    if (ct->mode_4b) {
-	len = 4;
-	rc = flash_write(ct, 0, ap, len);
-    } else {
-	len = 3;
-	rc = flash_write(ct, 0, ap + 1, len);
-    }
-
-    return rc == len ? 0 : rc;
+    if (ct->mode_4b)
+	ahb_batch_write(batch, ct->flash.start, ap, 4);
+    else
+	ahb_batch_write(batch, ct->flash.start, ap + 1, 3);
 }
 
 static int sfc_cmd_rd(struct sfc *ctrl, uint8_t cmd,
@@ -233,18 +283,29 @@ static int sfc_cmd_rd(struct sfc *ctrl, uint8_t cmd,
 			 uint32_t size)
 {
     struct sfc_data *ct = container_of(ctrl, struct sfc_data, ops);
+    uint32_t words[SFC_BATCH_WORDS];
+    struct ahb_batch batch;
+    uint8_t *buf = buffer;
+    uint32_t be_addr;
     int rc;
 
-    rc = sfc_start_cmd(ct, cmd);
-    if (rc)
-	goto bail;
-    if (has_addr) {
-	rc = sfc_send_addr(ct, addr);
-	if (rc)
-	    goto bail;
-    }
-    if (buffer && size) {
-        uint32_t i = 0;
+    if (!buffer)
+	size = 0;
+
+    if ((rc = sfc_cache_hold(ct)) < 0)
+	return rc;
+
+    /* Layout address MSB first in memory */
+    be_addr = htobe32(addr);
+
+    soc_batch_init(ct->soc, &batch);
+    sfc_batch_start_cmd(ct, &batch, &cmd);
+    if (has_addr)
+	sfc_batch_send_addr(ct, &batch, &be_addr);
+
+    do {
+        uint32_t chunk = size > sizeof(words) ? sizeof(words) : size;
+        uint32_t i;
 
         /*
          * Some bridges (P2A and debug UART, probably others too) have a quirk
@@ -256,24 +317,28 @@ static int sfc_cmd_rd(struct sfc *ctrl, uint8_t cmd,
          *
          * Writes don't have this problem, thankfully.
          */
-        while (size) {
-            uint8_t *buf = buffer;
-            uint32_t val = 0;
-
-            rc = soc_readl(ct->soc, ct->flash.start, &val);
-            if (rc)
-                goto bail;
-
-            if (size) { buf[i++] = (val >>  0) & 0xff; size--; }
-            if (size) { buf[i++] = (val >>  8) & 0xff; size--; }
-            if (size) { buf[i++] = (val >> 16) & 0xff; size--; }
-            if (size) { buf[i++] = (val >> 24) & 0xff; size--; }
-        }
-        rc = 0;
-    }
+        for (i = 0; i < chunk; i += 4)
+            ahb_batch_readl(&batch, ct->flash.start, &words[i / 4]);
+
+        if (chunk == size)
+            sfc_batch_end_cmd(ct, &batch);
+
+        if ((rc = sfc_batch_submit(&batch)))
+            goto bail;
+
+        for (i = 0; i < chunk; i++)
+            *buf++ = (words[i / 4] >> (8 * (i & 3))) & 0xff;
+
+        size -= chunk;
+    } while (size);
+
+    sfc_cache_release(ct);
+
+    return 0;
 
 bail:
     sfc_end_cmd(ct);
+    sfc_cache_release(ct);
 
     return rc;
 }
@@ -283,28 +348,36 @@ static int sfc_cmd_wr(struct sfc *ctrl, uint8_t cmd,
 			 uint32_t size)
 {
     struct sfc_data *ct = container_of(ctrl, struct sfc_data, ops);
-    ssize_t rc;
+    struct ahb_batch batch;
+    uint32_t be_addr;
+    int rc;
 
-    rc = sfc_start_cmd(ct, cmd);
-    if (rc)
-	goto bail;
+    if ((rc = sfc_cache_hold(ct)) < 0)
+	return rc;
 
-    if (has_addr) {
-	rc = sfc_send_addr(ct, addr);
-	if (rc)
-	    goto bail;
-    }
+    /* Layout address MSB first in memory */
+    be_addr = htobe32(addr);
+
+    soc_batch_init(ct->soc, &batch);
+    sfc_batch_start_cmd(ct, &batch, &cmd);
+    if (has_addr)
+	sfc_batch_send_addr(ct, &batch, &be_addr);
     if (buffer && size)
-	rc = flash_write(ct, 0, buffer, size);
-bail:
-    sfc_end_cmd(ct);
+	ahb_batch_write(&batch, ct->flash.start, buffer, size);
+    sfc_batch_end_cmd(ct, &batch);
+
+    if ((rc = sfc_batch_submit(&batch)))
+	sfc_end_cmd(ct);
+
+    sfc_cache_release(ct);
 
-    return rc == (ssize_t)size ? 0 : rc;
+    return rc;
 }
 
 static int sfc_set_4b(struct sfc *ctrl, bool enable)
 {
     struct sfc_data *ct = container_of(ctrl, struct sfc_data, ops);
+    struct ahb_batch batch;
     uint32_t ce_ctrl = 0;
     int rc;
 
@@ -331,15 +404,18 @@ static int sfc_set_4b(struct sfc *ctrl, bool enable)
     }
     ct->mode_4b = enable;
 
+    /* The window may map different flash contents in the new mode */
+    soc_cache_invalidate(ct->soc);
+
+    soc_batch_init(ct->soc, &batch);
+
     /* Update read mode */
-    rc = sfc_writel(ct, ct->ctl_reg, ct->ctl_read_val);
-    if (rc < 0)
-	return rc;
+    ahb_batch_writel(&batch, ct->iomem.start + ct->ctl_reg, ct->ctl_read_val);
 
     if (ce_ctrl && ct->type == SFC_TYPE_FMC)
-	return sfc_writel(ct, FMC_CE_CTRL, ce_ctrl);
+	ahb_batch_writel(&batch, ct->iomem.start + FMC_CE_CTRL, ce_ctrl);
 
-    return 0;
+    return sfc_batch_submit(&batch);
 }
 
 static int sfc_direct_read(struct sfc *ctrl, uint32_t pos, void *buf, uint32_t len)
@@ -1017,6 +1093,10 @@ static int sfc_driver_init(struct soc *soc, struct soc_device *dev)
 	goto fail;
     }
 
+    /* In read mode the flash window behaves as memory */
+    if ((rc = soc_cache_mark(soc, &ct->flash, true)) < 0)
+	goto fail;
+
     soc_device_set_drvdata(dev, &ct->ops);
 
     return 0;
@@ -1059,6 +1139,8 @@ static void sfc_driver_destroy(struct soc_device *dev)
     }
 
 cleanup_ct:
+    soc_cache_unmark(ct->soc, &ct->flash, true);
+
     /* Free the whole lot */
     free(ct);
 }
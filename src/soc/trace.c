@@ -6,12 +6,14 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "ahb.h"
 #include "ast.h"
 #include "bits.h"
 #include "log.h"
 #include "soc.h"
+#include "stats.h"
 #include "trace.h"
 
 #define AHBC_BUF_LEN                    (64 * 1024)
@@ -113,50 +115,65 @@ static int trace_style(int width, int offset)
 
 static int ahbc_readl(struct trace *ctx, uint32_t off, uint32_t *val)
 {
-    return soc_readl(ctx->soc, ctx->ahbc.start + off, val);
+    enum stats_subsys prev = stats_subsys_enter(stats_subsys_trace);
+    int rc;
+
+    rc = soc_readl(ctx->soc, ctx->ahbc.start + off, val);
+    stats_subsys_exit(prev);
+
+    return rc;
 }
 
-static int ahbc_writel(struct trace *ctx, uint32_t off, uint32_t val)
+static int ahbc_batch_submit(struct ahb_batch *batch)
 {
-    return soc_writel(ctx->soc, ctx->ahbc.start + off, val);
+    enum stats_subsys prev = stats_subsys_enter(stats_subsys_trace);
+    int rc;
+
+    rc = ahb_batch_submit(batch);
+    stats_subsys_exit(prev);
+
+    return rc;
 }
 
 int trace_start(struct trace *ctx, uint32_t addr, int width, enum trace_mode mode)
 {
-    uint32_t csr, buf;
-    size_t i;
+    struct ahb_batch batch;
+    uint32_t csr;
+    void *zeros;
+    int style;
     int rc;
 
     logd("%s: 0x%08" PRIx32 " %d %d\n", __func__, addr, width, mode);
 
+    if ((style = trace_style(width, addr & 3)) < 0)
+        return style;
+
+    zeros = calloc(1, ctx->sram.length);
+    if (!zeros)
+        return -ENOMEM;
+
     assert(ctx->sram.length >= (32 * 1024));
     csr = AHBC_BCR_CSR_BUF_LEN_32K << AHBC_BCR_CSR_BUF_LEN_SHIFT;
     csr |= AHBC_BCR_CSR_POLL_MODE * mode;
 
-    if ((rc = ahbc_writel(ctx, R_AHBC_BCR_CSR, csr)))
-        return rc;
-
-    if ((rc = ahbc_writel(ctx, R_AHBC_BCR_ADDR, addr & ~3)))
-        return rc;
+    soc_batch_init(ctx->soc, &batch);
+    ahb_batch_writel(&batch, ctx->ahbc.start + R_AHBC_BCR_CSR, csr);
+    ahb_batch_writel(&batch, ctx->ahbc.start + R_AHBC_BCR_ADDR, addr & ~3);
 
     logi("Zeroing trace buffer [%p - %p]\n", ctx->sram.start, ctx->sram.start + ctx->sram.length);
+    ahb_batch_write(&batch, ctx->sram.start, zeros, ctx->sram.length);
 
-    for (i = 0; i < (ctx->sram.length / 4); i++) {
-        soc_writel(ctx->soc, 4 * i + ctx->sram.start, 0);
-    }
-
-    buf = ctx->sram.start | AHBC_BCR_BUF_WRAP;
-    if ((rc = ahbc_writel(ctx, R_AHBC_BCR_BUF, buf)))
-        return rc;
+    ahb_batch_writel(&batch, ctx->ahbc.start + R_AHBC_BCR_BUF,
+                     ctx->sram.start | AHBC_BCR_BUF_WRAP);
 
-    if ((rc = trace_style(width, addr & 3)) < 0)
-        return rc;
-
-    csr |= rc << AHBC_BCR_CSR_POLL_DATA_SHIFT;
+    csr |= style << AHBC_BCR_CSR_POLL_DATA_SHIFT;
     csr |= AHBC_BCR_CSR_FLUSH;
     csr |= AHBC_BCR_CSR_POLL_EN;
+    ahb_batch_writel(&batch, ctx->ahbc.start + R_AHBC_BCR_CSR, csr);
 
-    if ((rc = ahbc_writel(ctx, R_AHBC_BCR_CSR, csr)))
+    rc = ahbc_batch_submit(&batch);
+    free(zeros);
+    if (rc)
         return rc;
 
     logi("Started AHB trace for 0x%08" PRIx32 "\n", addr);
@@ -166,6 +183,7 @@ int trace_start(struct trace *ctx, uint32_t addr, int width, enum trace_mode mod
 
 int trace_stop(struct trace *ctx)
 {
+    struct ahb_batch batch;
     uint32_t csr;
     int rc;
 
@@ -179,14 +197,16 @@ int trace_stop(struct trace *ctx)
 
     logt("%s: csr: 0x%08" PRIx32 "\n", __func__, csr);
 
+    soc_batch_init(ctx->soc, &batch);
+
     /* Note: This won't flush the tail values if they don't form a full word */
     csr |= AHBC_BCR_CSR_FLUSH;
-    if ((rc = ahbc_writel(ctx, R_AHBC_BCR_CSR, csr)))
-        return rc;
+    ahb_batch_writel(&batch, ctx->ahbc.start + R_AHBC_BCR_CSR, csr);
 
     csr &= ~(AHBC_BCR_CSR_POLL_EN | AHBC_BCR_CSR_FLUSH);
+    ahb_batch_writel(&batch, ctx->ahbc.start + R_AHBC_BCR_CSR, csr);
 
-    if ((rc = ahbc_writel(ctx, R_AHBC_BCR_CSR, csr)))
+    if ((rc = ahbc_batch_submit(&batch)))
         return rc;
 
     logi("Stopped AHB trace\n");
@@ -197,6 +217,7 @@ int trace_stop(struct trace *ctx)
 int trace_dump(struct trace *ctx, int outfd)
 {
     uint32_t buf_len, write_ptr;
+    struct ahb_batch batch;
     uint32_t csr, buf;
     uint32_t merge;
     uint32_t base;
@@ -204,14 +225,18 @@ int trace_dump(struct trace *ctx, int outfd)
     ssize_t rc;
     size_t len;
 
-    if ((rc = ahbc_readl(ctx, R_AHBC_BCR_CSR, &csr)))
-        return rc;
+    /* Reading the registers has no side-effects */
+    soc_batch_init(ctx->soc, &batch);
+    ahb_batch_set_unordered(&batch, true);
+    ahb_batch_readl(&batch, ctx->ahbc.start + R_AHBC_BCR_CSR, &csr);
+    ahb_batch_readl(&batch, ctx->ahbc.start + R_AHBC_BCR_BUF, &buf);
+    ahb_batch_readl(&batch, ctx->ahbc.start + R_AHBC_BCR_FIFO_MERGE, &merge);
 
-    logt("%s: csr: 0x%08" PRIx32 "\n", __func__, csr);
-
-    if ((rc = ahbc_readl(ctx, R_AHBC_BCR_BUF, &buf)))
+    /* Failing to read the merge FIFO isn't fatal */
+    if ((rc = ahbc_batch_submit(&batch)) && batch.ops[2].rc != rc)
         return rc;
 
+    logt("%s: csr: 0x%08" PRIx32 "\n", __func__, csr);
     logt("%s: buf: 0x%08" PRIx32 "\n", __func__, buf);
 
     /*
@@ -221,8 +246,7 @@ int trace_dump(struct trace *ctx, int outfd)
      * you might not see anything flushed to the trace buffer, but it'll be in
      * the merge FIFO.
      */
-    rc = ahbc_readl(ctx, R_AHBC_BCR_FIFO_MERGE, &merge);
-    if (!rc)
+    if (!batch.ops[2].rc)
         logi("%s: partial trace reg: 0x%08" PRIx32 "\n", __func__, merge);
 
     wrapped = buf & AHBC_BCR_BUF_WRAP;
@@ -282,6 +306,11 @@ static int trace_driver_init(struct soc *soc, struct soc_device *dev)
 
     ctx->soc = soc;
 
+    /* The trace engine writes to the buffer behind our back */
+    if ((rc = soc_cache_mark(soc, &ctx->sram, false)) < 0) {
+        goto cleanup_ctx;
+    }
+
     soc_device_set_drvdata(dev, ctx);
 
     if ((rc = trace_stop(ctx)) < 0) {
@@ -298,7 +327,11 @@ cleanup_ctx:
 
 static void trace_driver_destroy(struct soc_device *dev)
 {
-    free(soc_device_get_drvdata(dev));
+    struct trace *ctx = soc_device_get_drvdata(dev);
+
+    soc_cache_unmark(ctx->soc, &ctx->sram, false);
+
+    free(ctx);
 }
 
 static const struct soc_driver trace_driver = {
@@ -0,0 +1,435 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "stats.h"
+
+#include "ccan/container_of/container_of.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Latencies are histogrammed in power-of-two buckets of nanoseconds */
+#define STATS_BUCKETS           40
+
+/* Batches are accounted as a whole in addition to the ops they contain */
+#define STATS_OP_SUBMIT         (ahb_op_writel + 1)
+#define STATS_OPS               (STATS_OP_SUBMIT + 1)
+
+#define to_stats(ahb) container_of(ahb_layer_from_ahb(ahb), struct stats, layer)
+
+struct stats_op_acct {
+    unsigned long count;
+    unsigned long errors;
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t max_ns;
+    unsigned long hist[STATS_BUCKETS];
+};
+
+struct stats_subsys_acct {
+    unsigned long count;
+    uint64_t bytes;
+    uint64_t ns;
+};
+
+static const char *stats_op_names[STATS_OPS] = {
+    [ahb_op_read] = "read",
+    [ahb_op_write] = "write",
+    [ahb_op_readl] = "readl",
+    [ahb_op_writel] = "writel",
+    [STATS_OP_SUBMIT] = "submit",
+};
+
+static const char *stats_subsys_names[stats_subsys_max] = {
+    [stats_subsys_other] = "other",
+    [stats_subsys_sfc] = "sfc",
+    [stats_subsys_otp] = "otp",
+    [stats_subsys_trace] = "trace",
+    [stats_subsys_siphon] = "siphon",
+};
+
+static const char *stats_counter_names[stats_counter_max] = {
+    [stats_p2a_remap] = "p2a RBAR remaps",
+    [stats_l2a_remap] = "l2a HICR7/8 remaps",
+};
+
+static bool stats_active;
+static struct timespec stats_epoch;
+static struct stats_op_acct stats_ops[STATS_OPS];
+static struct stats_subsys_acct stats_subsystems[stats_subsys_max];
+static unsigned long stats_counters[stats_counter_max];
+
+static pthread_mutex_t stats_timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *stats_timeline;
+static bool stats_timeline_empty = true;
+
+static int stats_next_tid;
+static __thread int stats_tid;
+static __thread enum stats_subsys stats_current;
+
+static inline void stats_add(uint64_t *var, uint64_t val)
+{
+    __atomic_fetch_add(var, val, __ATOMIC_RELAXED);
+}
+
+static inline void stats_inc(unsigned long *var)
+{
+    __atomic_fetch_add(var, 1, __ATOMIC_RELAXED);
+}
+
+static void stats_max(uint64_t *var, uint64_t val)
+{
+    uint64_t cur = __atomic_load_n(var, __ATOMIC_RELAXED);
+
+    while (val > cur) {
+        if (__atomic_compare_exchange_n(var, &cur, val, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+}
+
+static uint64_t stats_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - stats_epoch.tv_sec) * 1000000000ULL
+            + now.tv_nsec - stats_epoch.tv_nsec;
+}
+
+static int stats_thread_id(void)
+{
+    if (!stats_tid)
+        stats_tid = __atomic_add_fetch(&stats_next_tid, 1, __ATOMIC_RELAXED);
+
+    return stats_tid;
+}
+
+static void stats_timeline_event(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void stats_timeline_event(const char *fmt, ...)
+{
+    va_list args;
+
+    pthread_mutex_lock(&stats_timeline_lock);
+
+    if (stats_timeline) {
+        fputs(stats_timeline_empty ? "\n" : ",\n", stats_timeline);
+        stats_timeline_empty = false;
+
+        va_start(args, fmt);
+        vfprintf(stats_timeline, fmt, args);
+        va_end(args);
+    }
+
+    pthread_mutex_unlock(&stats_timeline_lock);
+}
+
+static void stats_record(int type, uint32_t phys, size_t len, int rc,
+                         uint64_t start)
+{
+    uint64_t ns = stats_now() - start;
+    struct stats_subsys_acct *subsys = &stats_subsystems[stats_current];
+    struct stats_op_acct *op = &stats_ops[type];
+    int bucket;
+
+    bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (bucket >= STATS_BUCKETS)
+        bucket = STATS_BUCKETS - 1;
+
+    if (rc < 0)
+        len = 0;
+
+    stats_inc(&op->count);
+    if (rc < 0)
+        stats_inc(&op->errors);
+    stats_add(&op->bytes, len);
+    stats_add(&op->ns, ns);
+    stats_max(&op->max_ns, ns);
+    stats_inc(&op->hist[bucket]);
+
+    stats_inc(&subsys->count);
+    stats_add(&subsys->bytes, len);
+    stats_add(&subsys->ns, ns);
+
+    if (stats_timeline)
+        stats_timeline_event("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                             "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                             "\"args\":{\"phys\":\"0x%08" PRIx32 "\","
+                             "\"len\":%zu,\"rc\":%d}}",
+                             stats_op_names[type],
+                             stats_subsys_names[stats_current],
+                             start / 1000.0, ns / 1000.0, getpid(),
+                             stats_thread_id(), phys, len, rc);
+}
+
+static ssize_t stats_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct stats *ctx = to_stats(ahb);
+    uint64_t start = stats_now();
+    ssize_t rc;
+
+    rc = ahb_read(ctx->layer.lower, phys, buf, len);
+    stats_record(ahb_op_read, phys, rc, rc, start);
+
+    return rc;
+}
+
+static ssize_t stats_write(struct ahb *ahb, uint32_t phys, const void *buf,
+                           size_t len)
+{
+    struct stats *ctx = to_stats(ahb);
+    uint64_t start = stats_now();
+    ssize_t rc;
+
+    rc = ahb_write(ctx->layer.lower, phys, buf, len);
+    stats_record(ahb_op_write, phys, rc, rc, start);
+
+    return rc;
+}
+
+static int stats_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
+{
+    struct stats *ctx = to_stats(ahb);
+    uint64_t start = stats_now();
+    int rc;
+
+    rc = ahb_readl(ctx->layer.lower, phys, val);
+    stats_record(ahb_op_readl, phys, sizeof(*val), rc, start);
+
+    return rc;
+}
+
+static int stats_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
+{
+    struct stats *ctx = to_stats(ahb);
+    uint64_t start = stats_now();
+    int rc;
+
+    rc = ahb_writel(ctx->layer.lower, phys, val);
+    stats_record(ahb_op_writel, phys, sizeof(val), rc, start);
+
+    return rc;
+}
+
+static int stats_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
+{
+    struct stats *ctx = to_stats(ahb);
+    uint64_t start = stats_now();
+    size_t total = 0;
+    size_t i;
+    int rc;
+
+    rc = ahb_submit(ctx->layer.lower, ops, n);
+
+    /* The ops of a batch are counted, but their latency is that of the batch */
+    for (i = 0; i < n; i++) {
+        struct stats_op_acct *op = &stats_ops[ops[i].type];
+        size_t len;
+
+        len = (ops[i].type == ahb_op_read || ops[i].type == ahb_op_write) ?
+                ops[i].len : sizeof(uint32_t);
+
+        stats_inc(&op->count);
+        if (ops[i].rc < 0)
+            stats_inc(&op->errors);
+        else
+            stats_add(&op->bytes, len);
+
+        total += len;
+    }
+
+    stats_record(STATS_OP_SUBMIT, n ? ops[0].phys : 0, total, rc, start);
+
+    return rc;
+}
+
+static const struct ahb_ops stats_ahb_ops = {
+    .read = stats_read,
+    .write = stats_write,
+    .readl = stats_readl,
+    .writel = stats_writel,
+    .submit = stats_submit,
+};
+
+void stats_init(struct stats *ctx, struct ahb *lower)
+{
+    ahb_layer_init(&ctx->layer, lower, &stats_ahb_ops);
+}
+
+void stats_count(enum stats_counter counter)
+{
+    stats_inc(&stats_counters[counter]);
+
+    if (stats_timeline)
+        stats_timeline_event("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\","
+                             "\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                             stats_counter_names[counter],
+                             stats_subsys_names[stats_current],
+                             stats_now() / 1000.0, getpid(),
+                             stats_thread_id());
+}
+
+enum stats_subsys stats_subsys_enter(enum stats_subsys subsys)
+{
+    enum stats_subsys prev = stats_current;
+
+    stats_current = subsys;
+
+    return prev;
+}
+
+void stats_subsys_exit(enum stats_subsys prev)
+{
+    stats_current = prev;
+}
+
+/* The upper bound of the bucket containing the given fraction of samples */
+static double stats_percentile_us(const struct stats_op_acct *op, uint64_t timed,
+                                  double fraction)
+{
+    uint64_t target = (uint64_t)(timed * fraction);
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        seen += op->hist[i];
+        if (seen > target)
+            break;
+    }
+
+    if (i == STATS_BUCKETS)
+        i--;
+
+    /* The bound of the last bucket may be well beyond the slowest op */
+    if ((1ULL << i) > op->max_ns)
+        return op->max_ns / 1000.0;
+
+    return (double)(1ULL << i) / 1000.0;
+}
+
+static void stats_report(void)
+{
+    uint64_t elapsed = stats_now();
+    int i;
+
+    pthread_mutex_lock(&stats_timeline_lock);
+    if (stats_timeline) {
+        fputs("\n]}\n", stats_timeline);
+        fclose(stats_timeline);
+        stats_timeline = NULL;
+    }
+    pthread_mutex_unlock(&stats_timeline_lock);
+
+    fprintf(stderr, "\nAHB statistics over %.3fs:\n\n", elapsed / 1e9);
+
+    fprintf(stderr, "%-8s %10s %8s %12s %12s %10s %10s %10s %10s\n",
+            "op", "count", "errors", "bytes", "total ms", "mean us",
+            "p50 us", "p99 us", "max us");
+    for (i = 0; i < STATS_OPS; i++) {
+        const struct stats_op_acct *op = &stats_ops[i];
+        uint64_t timed = 0;
+        int j;
+
+        if (!op->count)
+            continue;
+
+        for (j = 0; j < STATS_BUCKETS; j++)
+            timed += op->hist[j];
+
+        /* Ops only issued as part of a batch have no latency of their own */
+        if (!timed) {
+            fprintf(stderr, "%-8s %10lu %8lu %12" PRIu64 " %12s %10s %10s %10s %10s\n",
+                    stats_op_names[i], op->count, op->errors, op->bytes,
+                    "-", "-", "-", "-", "-");
+            continue;
+        }
+
+        fprintf(stderr, "%-8s %10lu %8lu %12" PRIu64 " %12.3f %10.3f %10.3f %10.3f %10.3f\n",
+                stats_op_names[i], op->count, op->errors, op->bytes,
+                op->ns / 1e6, (op->ns / 1e3) / timed,
+                stats_percentile_us(op, timed, 0.50),
+                stats_percentile_us(op, timed, 0.99),
+                op->max_ns / 1e3);
+    }
+
+    fprintf(stderr, "\n%-8s %10s %12s %12s %8s\n",
+            "subsys", "count", "bytes", "total ms", "time %");
+    for (i = 0; i < stats_subsys_max; i++) {
+        const struct stats_subsys_acct *subsys = &stats_subsystems[i];
+
+        if (!subsys->count)
+            continue;
+
+        fprintf(stderr, "%-8s %10lu %12" PRIu64 " %12.3f %8.1f\n",
+                stats_subsys_names[i], subsys->count, subsys->bytes,
+                subsys->ns / 1e6, elapsed ? (100.0 * subsys->ns) / elapsed : 0);
+    }
+
+    fprintf(stderr, "\n");
+    for (i = 0; i < stats_counter_max; i++) {
+        if (stats_counters[i])
+            fprintf(stderr, "%s: %lu\n", stats_counter_names[i],
+                    stats_counters[i]);
+    }
+}
+
+/* Called before any accesses are made, so the timeline needs no locking */
+static int stats_open_timeline(const char *timeline)
+{
+    FILE *file;
+
+    if (!(file = fopen(timeline, "w")))
+        return -errno;
+
+    /* The last timeline given wins, finish any earlier one */
+    if (stats_timeline) {
+        fputs("\n]}\n", stats_timeline);
+        fclose(stats_timeline);
+    }
+
+    stats_timeline = file;
+    stats_timeline_empty = true;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", stats_timeline);
+
+    return 0;
+}
+
+int stats_enable(const char *timeline)
+{
+    int rc;
+
+    /* Statistics may already be active, e.g. for '-t -T FILE' */
+    if (timeline && (rc = stats_open_timeline(timeline)) < 0)
+        return rc;
+
+    if (stats_active)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &stats_epoch);
+
+    if (atexit(stats_report)) {
+        if (stats_timeline) {
+            fclose(stats_timeline);
+            stats_timeline = NULL;
+        }
+        return -ENOMEM;
+    }
+
+    stats_active = true;
+
+    return 0;
+}
+
+bool stats_enabled(void)
+{
+    return stats_active;
+}
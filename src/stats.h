@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "ahb.h"
+#include "layer.h"
+
+#include <stdbool.h>
+
+/* The subsystems to which AHB accesses are attributed */
+enum stats_subsys {
+    stats_subsys_other,
+    stats_subsys_sfc,
+    stats_subsys_otp,
+    stats_subsys_trace,
+    stats_subsys_siphon,
+    stats_subsys_max,
+};
+
+/* Events inside the bridge drivers that are counted separately */
+enum stats_counter {
+    stats_p2a_remap,
+    stats_l2a_remap,
+    stats_counter_max,
+};
+
+/*
+ * Counts, sizes and times each access passed to the lower interface. The
+ * results are accumulated globally and reported at exit.
+ */
+struct stats {
+    struct ahb_layer layer;
+};
+
+/*
+ * Enable collection of statistics and report them at exit. If timeline is not
+ * NULL, each access is also written to it as a Chrome trace event, for viewing
+ * in chrome://tracing or Perfetto.
+ */
+int stats_enable(const char *timeline);
+bool stats_enabled(void);
+
+void stats_init(struct stats *ctx, struct ahb *lower);
+
+static inline struct ahb *stats_as_ahb(struct stats *ctx)
+{
+    return ahb_layer_as_ahb(&ctx->layer);
+}
+
+void stats_count(enum stats_counter counter);
+
+/*
+ * Attribute the calling thread's accesses to subsys until the previous
+ * subsystem returned here is restored with stats_subsys_exit(). Nested
+ * attributions take precedence over their enclosing attribution.
+ */
+enum stats_subsys stats_subsys_enter(enum stats_subsys subsys);
+void stats_subsys_exit(enum stats_subsys prev);
+
+#endif
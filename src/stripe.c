@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "log.h"
+#include "stripe.h"
+
+#include "ccan/container_of/container_of.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+/* Transfers smaller than this aren't worth distributing */
+#define STRIPE_MIN_LEN          (256 * 1024)
+#define STRIPE_PIECE            (64 * 1024)
+/* Size of the first piece issued to a path, to measure it cheaply */
+#define STRIPE_PROBE            (4 * 1024)
+
+#define to_stripe(ahb) container_of(ahb_layer_from_ahb(ahb), struct stripe, layer)
+
+static double stripe_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Called with the lock held */
+static bool stripe_path_is_fastest(struct stripe *ctx, struct stripe_path *path)
+{
+    size_t i;
+
+    for (i = 0; i < ctx->n_paths; i++) {
+        struct stripe_path *other = &ctx->paths[i];
+
+        if (other == path)
+            continue;
+
+        if (other->rate > path->rate)
+            return false;
+
+        if (other->rate == path->rate && other < path)
+            return false;
+    }
+
+    return true;
+}
+
+/* Called with the lock held */
+static bool stripe_claim(struct stripe *ctx, struct stripe_path *path,
+                         size_t *offset, size_t *piece)
+{
+    size_t remaining;
+
+    if (ctx->err)
+        return false;
+
+    remaining = ctx->len - ctx->next;
+    if (!remaining)
+        return false;
+
+    *piece = path->rate > 0 ? STRIPE_PIECE : STRIPE_PROBE;
+    if (*piece > remaining)
+        *piece = remaining;
+
+    /*
+     * A slow path shouldn't take a piece if the other paths would finish all
+     * the remaining work before it completed the piece. The fastest path
+     * always takes work so the job is guaranteed to complete.
+     */
+    if (path->rate > 0 && !stripe_path_is_fastest(ctx, path)) {
+        double others = 0;
+        size_t i;
+
+        for (i = 0; i < ctx->n_paths; i++) {
+            if (&ctx->paths[i] != path)
+                others += ctx->paths[i].rate;
+        }
+
+        if (others > 0 && (*piece / path->rate) > (remaining / others))
+            return false;
+    }
+
+    *offset = ctx->next;
+    ctx->next += *piece;
+
+    return true;
+}
+
+static void *stripe_worker(void *data)
+{
+    struct stripe_path *path = data;
+    struct stripe *ctx = path->stripe;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        size_t offset, piece;
+
+        while (!ctx->exit && ctx->generation == seen)
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+
+        if (ctx->exit)
+            break;
+
+        seen = ctx->generation;
+
+        while (stripe_claim(ctx, path, &offset, &piece)) {
+            uint32_t phys = ctx->phys + offset;
+            void *buf = ctx->buf + offset;
+            bool write = ctx->write;
+            double start, elapsed;
+            ssize_t rc;
+
+            pthread_mutex_unlock(&ctx->lock);
+
+            start = stripe_now();
+            if (write)
+                rc = ahb_write(path->ahb, phys, buf, piece);
+            else
+                rc = ahb_read(path->ahb, phys, buf, piece);
+            elapsed = stripe_now() - start;
+
+            pthread_mutex_lock(&ctx->lock);
+
+            if (rc < 0) {
+                if (!ctx->err)
+                    ctx->err = rc;
+                break;
+            }
+
+            path->bytes += piece;
+            if (elapsed > 0) {
+                double rate = piece / elapsed;
+
+                path->rate = path->rate > 0 ? (0.75 * path->rate + 0.25 * rate) : rate;
+            }
+        }
+
+        ctx->busy--;
+        pthread_cond_broadcast(&ctx->cond);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+static ssize_t stripe_transfer(struct stripe *ctx, bool write, uint32_t phys,
+                               void *buf, size_t len)
+{
+    int rc;
+
+    pthread_mutex_lock(&ctx->lock);
+
+    ctx->write = write;
+    ctx->phys = phys;
+    ctx->buf = buf;
+    ctx->len = len;
+    ctx->next = 0;
+    ctx->err = 0;
+    ctx->busy = ctx->n_paths;
+    ctx->generation++;
+    pthread_cond_broadcast(&ctx->cond);
+
+    while (ctx->busy)
+        pthread_cond_wait(&ctx->cond, &ctx->lock);
+
+    rc = ctx->err;
+
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc ? rc : (ssize_t)len;
+}
+
+static ssize_t stripe_read(struct ahb *ahb, uint32_t phys, void *buf, size_t len)
+{
+    struct stripe *ctx = to_stripe(ahb);
+
+    if (ctx->n_paths < 2 || len < STRIPE_MIN_LEN)
+        return ahb_read(ctx->layer.lower, phys, buf, len);
+
+    return stripe_transfer(ctx, false, phys, buf, len);
+}
+
+static ssize_t stripe_write(struct ahb *ahb, uint32_t phys, const void *buf, size_t len)
+{
+    struct stripe *ctx = to_stripe(ahb);
+
+    if (ctx->n_paths < 2 || len < STRIPE_MIN_LEN)
+        return ahb_write(ctx->layer.lower, phys, buf, len);
+
+    /* The workers never write through the buffer for write jobs */
+    return stripe_transfer(ctx, true, phys, (void *)buf, len);
+}
+
+static int stripe_readl(struct ahb *ahb, uint32_t phys, uint32_t *val)
+{
+    return ahb_readl(to_stripe(ahb)->layer.lower, phys, val);
+}
+
+static int stripe_writel(struct ahb *ahb, uint32_t phys, uint32_t val)
+{
+    return ahb_writel(to_stripe(ahb)->layer.lower, phys, val);
+}
+
+static int stripe_submit(struct ahb *ahb, struct ahb_op *ops, size_t n)
+{
+    return ahb_submit(to_stripe(ahb)->layer.lower, ops, n);
+}
+
+static const struct ahb_ops stripe_ops = {
+    .read = stripe_read,
+    .write = stripe_write,
+    .readl = stripe_readl,
+    .writel = stripe_writel,
+    .submit = stripe_submit,
+};
+
+static int stripe_release(struct ahb *ahb)
+{
+    struct stripe *ctx = to_stripe(ahb);
+    size_t i;
+    int rc;
+
+    for (i = 0; i < ctx->n_paths; i++) {
+        if ((rc = ahb_release_bridge(ctx->paths[i].ahb)) < 0)
+            return rc;
+    }
+
+    return 0;
+}
+
+static int stripe_reinit(struct ahb *ahb)
+{
+    struct stripe *ctx = to_stripe(ahb);
+    size_t i;
+    int rc;
+
+    for (i = 0; i < ctx->n_paths; i++) {
+        if ((rc = ahb_reinit_bridge(ctx->paths[i].ahb)) < 0)
+            return rc;
+    }
+
+    return 0;
+}
+
+static int stripe_begin(struct ahb *ahb)
+{
+    struct stripe *ctx = to_stripe(ahb);
+    size_t i;
+    int rc;
+
+    for (i = 0; i < ctx->n_paths; i++) {
+        if ((rc = ahb_begin_session(ctx->paths[i].ahb)) < 0)
+            goto unwind;
+    }
+
+    return 0;
+
+unwind:
+    while (i--)
+        ahb_end_session(ctx->paths[i].ahb);
+
+    return rc;
+}
+
+static void stripe_end(struct ahb *ahb)
+{
+    struct stripe *ctx = to_stripe(ahb);
+    size_t i;
+
+    for (i = ctx->n_paths; i--;)
+        ahb_end_session(ctx->paths[i].ahb);
+}
+
+int stripe_add_path(struct stripe *ctx, struct ahb *ahb)
+{
+    struct stripe_path *path;
+    int rc;
+
+    if (ctx->n_paths == STRIPE_MAX_PATHS)
+        return -ENOSPC;
+
+    path = &ctx->paths[ctx->n_paths];
+    memset(path, 0, sizeof(*path));
+    path->stripe = ctx;
+    path->ahb = ahb;
+
+    if ((rc = pthread_create(&path->thread, NULL, stripe_worker, path)))
+        return -rc;
+
+    ctx->n_paths++;
+
+    logd("Striping bulk transfers across the %s bridge\n", ahb->drv->name);
+
+    return 0;
+}
+
+int stripe_init(struct stripe *ctx, struct ahb *primary)
+{
+    int rc;
+
+    memset(ctx, 0, sizeof(*ctx));
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->cond, NULL);
+
+    ahb_layer_init(&ctx->layer, primary, &stripe_ops);
+    ctx->layer.drv.release = stripe_release;
+    ctx->layer.drv.reinit = stripe_reinit;
+    ctx->layer.drv.begin = stripe_begin;
+    ctx->layer.drv.end = stripe_end;
+
+    if ((rc = stripe_add_path(ctx, primary)) < 0) {
+        pthread_cond_destroy(&ctx->cond);
+        pthread_mutex_destroy(&ctx->lock);
+    }
+
+    return rc;
+}
+
+void stripe_destroy(struct stripe *ctx)
+{
+    size_t i;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->exit = true;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (i = 0; i < ctx->n_paths; i++) {
+        struct stripe_path *path = &ctx->paths[i];
+
+        pthread_join(path->thread, NULL);
+
+        logd("Striped %zu bytes via the %s bridge at %.0f bytes/s\n",
+             path->bytes, path->ahb->drv->name, path->rate);
+    }
+
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->lock);
+}
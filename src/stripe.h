@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _STRIPE_H
+#define _STRIPE_H
+
+#include "ahb.h"
+#include "layer.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STRIPE_MAX_PATHS        4
+
+struct stripe;
+
+struct stripe_path {
+    struct stripe *stripe;
+    struct ahb *ahb;
+    pthread_t thread;
+    /* Observed throughput in bytes per second, 0 until measured */
+    double rate;
+    size_t bytes;
+};
+
+/*
+ * Splits large transfers into pieces that are handed out to one worker thread
+ * per bridge, so transfers scale with the number of independent paths to the
+ * BMC. Register accesses and small transfers use the primary bridge from the
+ * calling thread.
+ */
+struct stripe {
+    struct ahb_layer layer;
+    struct stripe_path paths[STRIPE_MAX_PATHS];
+    size_t n_paths;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool exit;
+
+    /* The current job, protected by lock */
+    unsigned long generation;
+    bool write;
+    uint32_t phys;
+    void *buf;
+    size_t len;
+    size_t next;
+    size_t busy;
+    int err;
+};
+
+int stripe_init(struct stripe *ctx, struct ahb *primary);
+int stripe_add_path(struct stripe *ctx, struct ahb *ahb);
+void stripe_destroy(struct stripe *ctx);
+
+static inline struct ahb *stripe_as_ahb(struct stripe *ctx)
+{
+    return ahb_layer_as_ahb(&ctx->layer);
+}
+
+#endif
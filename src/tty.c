@@ -25,7 +25,25 @@ struct baud_map {
 
 static const struct baud_map tty_baud_map[] = {
     { 1200, B1200 },
+    { 38400, B38400 },
+    { 57600, B57600 },
     { 115200, B115200 },
+    { 230400, B230400 },
+#ifdef B460800
+    { 460800, B460800 },
+#endif
+#ifdef B500000
+    { 500000, B500000 },
+#endif
+#ifdef B921600
+    { 921600, B921600 },
+#endif
+#ifdef B1000000
+    { 1000000, B1000000 },
+#endif
+#ifdef B1500000
+    { 1500000, B1500000 },
+#endif
     { 0, B0 }, /* Sentinel */
 };
 
@@ -56,6 +56,29 @@ static inline uint16_t baud_to_divisor(int baud)
     return ((24000000 / 13) / (16 * baud));
 }
 
+/* The scratch register has no side-effects, so check it holds what we write */
+static int suart_self_test(struct lpc *io, void *data)
+{
+    static const uint8_t patterns[] = { 0x55, 0xaa, 0x00, 0xff, 0x5a, 0xa5 };
+    struct suart *ctx = data;
+    uint8_t val;
+    size_t i;
+    int rc;
+
+    for (i = 0; i < sizeof(patterns); i++) {
+        if ((rc = lpc_writeb(io, ctx->base + UART_SCR, patterns[i])))
+            return rc;
+
+        if ((rc = lpc_readb(io, ctx->base + UART_SCR, &val)))
+            return rc;
+
+        if (val != patterns[i])
+            return 0;
+    }
+
+    return 1;
+}
+
 static int __suart_init(struct suart *ctx, enum sio_dev dev, bool defaults,
                         uint16_t base, int sirq)
 {
@@ -149,6 +172,15 @@ static int __suart_init(struct suart *ctx, enum sio_dev dev, bool defaults,
     if (rc)
         return rc;
 
+    rc = lpc_calibrate(io, suart_self_test, ctx);
+    if (rc == -EIO) {
+        logi("SUART scratch register is unreliable, using the slowest port I/O\n");
+        lpc_set_delay(io, LPC_DELAY_MAX);
+    } else if (rc) {
+        goto cleanup_lpc;
+    }
+    logd("SUART I/O delay: %u\n", io->delay);
+
     /* Disable interrupts, will be polling */
     rc = lpc_writeb(io, ctx->base + UART_IER, 0);
     if (rc)